@@ -0,0 +1,146 @@
+// Grid construction by sorting (cell, particle) pairs with an LSD radix sort. The result is the same grid as the
+// CPU counting sort: the particles sorted by cell, and by index within every cell.
+
+// The host defines the sizes it enqueues with, the values here only apply to builds without definitions.
+#ifndef RADIX_BITS
+#define RADIX_BITS 4							// Bits sorted per pass.
+#endif
+#ifndef GRID_LOCAL_SIZE
+#define GRID_LOCAL_SIZE 256						// Work-group size of all kernels, must be a power of two.
+#endif
+#define RADIX_BINS (1 << RADIX_BITS)			// Digits per pass.
+
+// Exclusive work-efficient (Blelloch) scan of one value per work-item in local memory. Returns the sum of the
+// values of the work-items before this one and stores the sum of all values in total.
+uint LocalScan(__local uint* data, uint value, __local uint* total)
+{
+	uint lid = get_local_id(0);
+	data[lid] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Up-sweep: sum ever larger subtrees in place.
+	for (uint stride = 1; stride < GRID_LOCAL_SIZE; stride <<= 1)
+	{
+		uint idx = (lid + 1) * stride * 2 - 1;
+		if (idx < GRID_LOCAL_SIZE) data[idx] += data[idx - stride];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0) *total = data[GRID_LOCAL_SIZE - 1], data[GRID_LOCAL_SIZE - 1] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Down-sweep: hand every subtree the sum of everything to its left.
+	for (uint stride = GRID_LOCAL_SIZE >> 1; stride > 0; stride >>= 1)
+	{
+		uint idx = (lid + 1) * stride * 2 - 1;
+		if (idx < GRID_LOCAL_SIZE)
+		{
+			uint left = data[idx - stride];
+			data[idx - stride] = data[idx];
+			data[idx] += left;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	return data[lid];
+}
+
+// Computes the cell of every particle as its sort key, with the particle index as value.
+__kernel void ComputeKeys(__global const float* posX, __global const float* posY, __global uint* cells, __global uint* indices,
+	uint count, uint cellWidth, uint cellHeight, uint resolution)
+{
+	uint i = get_global_id(0);
+	if (i >= count) return;
+
+	uint gx = min((uint)(posX[i] / (float)cellWidth), resolution - 1);
+	uint gy = min((uint)(posY[i] / (float)cellHeight), resolution - 1);
+	cells[i] = gx + gy * resolution;
+	indices[i] = i;
+}
+
+// Counts the digits of the keys in every block of GRID_LOCAL_SIZE keys. The histograms are stored digit-major, so
+// scanning them yields the output offset of every digit in every block.
+__kernel void RadixHistogram(__global const uint* keys, uint count, uint shift, __global uint* histograms)
+{
+	__local uint bins[RADIX_BINS];
+
+	uint lid = get_local_id(0), i = get_global_id(0);
+	if (lid < RADIX_BINS) bins[lid] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (i < count) atomic_inc(&bins[(keys[i] >> shift) & (RADIX_BINS - 1)]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid < RADIX_BINS) histograms[lid * get_num_groups(0) + get_group_id(0)] = bins[lid];
+}
+
+// Moves the pairs of every block to their place in the output, ordered by digit. The block is first sorted by digit
+// in local memory with one stable split per bit, such that the pairs leave the block in order and every digit is
+// written to a contiguous range.
+__kernel void RadixScatter(__global const uint* keysIn, __global const uint* valuesIn, __global uint* keysOut, __global uint* valuesOut,
+	uint count, uint shift, __global const uint* offsets)
+{
+	__local uint scratch[GRID_LOCAL_SIZE], total;
+	__local uint localKeys[GRID_LOCAL_SIZE], localValues[GRID_LOCAL_SIZE];
+	__local uint digitStart[RADIX_BINS];
+
+	uint lid = get_local_id(0), group = get_group_id(0), i = get_global_id(0);
+	uint valid = min(count - group * GRID_LOCAL_SIZE, (uint)GRID_LOCAL_SIZE);
+
+	// Missing pairs get the largest digit, they then end up behind all pairs of the block.
+	uint key = i < count ? keysIn[i] : 0xFFFFFFFFu;
+	uint value = i < count ? valuesIn[i] : 0;
+
+	for (uint bit = 0; bit < RADIX_BITS; bit++)
+	{
+		uint set = (key >> (shift + bit)) & 1;
+		uint zerosBefore = LocalScan(scratch, 1 - set, &total);
+		uint pos = set ? total + (lid - zerosBefore) : zerosBefore;
+
+		localKeys[pos] = key, localValues[pos] = value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		key = localKeys[lid], value = localValues[lid];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// The first pair of every digit marks where the digit starts in the block.
+	uint digit = (key >> shift) & (RADIX_BINS - 1);
+	if (lid == 0 || ((localKeys[lid - 1] >> shift) & (RADIX_BINS - 1)) != digit) digitStart[digit] = lid;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid < valid)
+	{
+		uint dst = offsets[digit * get_num_groups(0) + group] + lid - digitStart[digit];
+		keysOut[dst] = key, valuesOut[dst] = value;
+	}
+}
+
+// Exclusive scan of every block of GRID_LOCAL_SIZE values, the sum of every block is stored in blockSums.
+__kernel void ScanBlocks(__global uint* data, uint n, __global uint* blockSums)
+{
+	__local uint scratch[GRID_LOCAL_SIZE], total;
+
+	uint i = get_global_id(0);
+	uint prefix = LocalScan(scratch, i < n ? data[i] : 0, &total);
+	if (i < n) data[i] = prefix;
+	if (get_local_id(0) == 0) blockSums[get_group_id(0)] = total;
+}
+
+// Adds the scanned block sums to the values of every block.
+__kernel void AddBlockSums(__global uint* data, uint n, __global const uint* blockSums)
+{
+	uint i = get_global_id(0);
+	if (i < n) data[i] += blockSums[get_group_id(0)];
+}
+
+// Finds where every cell starts in the sorted keys, cellStart[nCells] is the number of keys. Every key starts the
+// cells after the key before it up to its own, so empty cells start where the next non-empty cell does.
+__kernel void FindCellStarts(__global const uint* sortedKeys, uint count, uint nCells, __global uint* cellStart)
+{
+	uint i = get_global_id(0);
+	if (i > count) return;
+
+	uint first = i == 0 ? 0 : sortedKeys[i - 1] + 1;
+	uint last = i == count ? nCells : sortedKeys[i];
+	for (uint c = first; c <= last; c++) cellStart[c] = i;
+}
@@ -0,0 +1,145 @@
+// Particle simulation kernels. Every kernel mirrors a stage of the CPU simulation, with the particle state
+// stored as structure-of-arrays in global memory. The grid is built by the kernels in grid.cl.
+
+#define RESTITUTION 0.9f
+#define MAX_SPEED 256.0f
+
+// Variants specialized with -D GRID_RESOLUTION=<cells> and -D PARTICLE_COUNT=<particles> let the compiler fold the
+// grid arithmetic and the bounds checks, the generic variant reads both from the kernel arguments.
+#ifdef GRID_RESOLUTION
+#define RESOLUTION GRID_RESOLUTION
+#else
+#define RESOLUTION resolution
+#endif
+#ifdef PARTICLE_COUNT
+#define COUNT PARTICLE_COUNT
+#else
+#define COUNT count
+#endif
+
+// Keeps the positions at the start of the tick for the renderer.
+__kernel void KeepPositions(__global const float* posX, __global const float* posY, __global float* prevX, __global float* prevY, uint count)
+{
+	uint i = get_global_id(0);
+	if (i >= COUNT) return;
+
+	prevX[i] = posX[i], prevY[i] = posY[i];
+}
+
+// Tests two particles at their predicted positions and resolves the collision.
+void Collide(__global float* posX, __global float* posY, __global float* velX, __global float* velY,
+	__global const float* radius, __global const float* invMass, uint i, uint j, float dt)
+{
+	float dx = (posX[i] + velX[i] * dt) - (posX[j] + velX[j] * dt);
+	float dy = (posY[i] + velY[i] * dt) - (posY[j] + velY[j] * dt);
+	float radii = radius[i] + radius[j];
+	if (dx * dx + dy * dy > radii * radii) return;
+
+	// Normal
+	float nx = posX[j] - posX[i], ny = posY[j] - posY[i];
+	float invLength = rsqrt(nx * nx + ny * ny);
+	nx *= invLength, ny *= invLength;
+
+	// Velocity along the normal, do not resolve if velocities are separating.
+	float velAlongNormal = (velX[j] - velX[i]) * nx + (velY[j] - velY[i]) * ny;
+	if (velAlongNormal > 0.0f) return;
+
+	// Apply impulse
+	float impulseScalar = -(1.0f + RESTITUTION) * velAlongNormal;
+	impulseScalar /= invMass[i] + invMass[j];
+	float impulseX = impulseScalar * nx, impulseY = impulseScalar * ny;
+	velX[i] -= invMass[i] * impulseX, velY[i] -= invMass[i] * impulseY;
+	velX[j] += invMass[j] * impulseX, velY[j] += invMass[j] * impulseY;
+
+	// Correct positions by half the overlap each.
+	float ox = posX[i] - posX[j], oy = posY[i] - posY[j];
+	float overlap = radii - sqrt(ox * ox + oy * oy);
+	float correctionX = overlap * 0.5f * nx, correctionY = overlap * 0.5f * ny;
+	posX[i] -= correctionX, posY[i] -= correctionY;
+	posX[j] += correctionX, posY[j] += correctionY;
+}
+
+// Resolves the collisions of the particles in one cell of a 3x2 colour class. A cell touches itself and its right,
+// bottom-left, bottom and bottom-right neighbours, so the cells of a single class never share particles.
+__kernel void CollideCells(__global float* posX, __global float* posY, __global float* velX, __global float* velY,
+	__global const float* radius, __global const float* invMass, __global const uint* cellStart, __global const uint* cellParticles,
+	uint resolution, uint classX, uint classY, float dt)
+{
+	uint id = get_global_id(0), perRow = (RESOLUTION + 2) / 3;
+	uint x = classX + 3 * (id % perRow), y = classY + 2 * (id / perRow);
+	if (x >= RESOLUTION || y >= RESOLUTION) return;
+
+	uint cell = x + y * RESOLUTION;
+	uint start = cellStart[cell], end = cellStart[cell + 1];
+	if (start == end) return;
+
+	uint neighbours[4], nNeighbours = 0;
+	if (x + 2 < RESOLUTION) neighbours[nNeighbours++] = x + 1 + y * RESOLUTION;
+	if (y + 2 < RESOLUTION) neighbours[nNeighbours++] = x + (y + 1) * RESOLUTION;
+	if (x + 2 < RESOLUTION && y + 2 < RESOLUTION) neighbours[nNeighbours++] = x + 1 + (y + 1) * RESOLUTION;
+	if (x > 0 && y + 2 < RESOLUTION) neighbours[nNeighbours++] = x - 1 + (y + 1) * RESOLUTION;
+
+	// Every particle is tested against the particles after it in the cell, then against the neighbouring cells.
+	for (uint a = start; a < end; a++)
+	{
+		uint i = cellParticles[a];
+		for (uint b = a + 1; b < end; b++) Collide(posX, posY, velX, velY, radius, invMass, i, cellParticles[b], dt);
+		for (uint n = 0; n < nNeighbours; n++)
+			for (uint b = cellStart[neighbours[n]]; b < cellStart[neighbours[n] + 1]; b++)
+				Collide(posX, posY, velX, velY, radius, invMass, i, cellParticles[b], dt);
+	}
+}
+
+// Pushes the particles in the cells around the cursor away from it.
+__kernel void ApplyInput(__global const float* posX, __global const float* posY, __global float* velX, __global float* velY,
+	__global const uint* particleCells, uint count, uint resolution, int xmin, int xmax, int ymin, int ymax,
+	float cursorX, float cursorY, float dt)
+{
+	uint i = get_global_id(0);
+	if (i >= COUNT) return;
+
+	int x = (int)(particleCells[i] % RESOLUTION), y = (int)(particleCells[i] / RESOLUTION);
+	if (x < xmin || x >= xmax || y < ymin || y >= ymax) return;
+
+	float dx = posX[i] - cursorX, dy = posY[i] - cursorY;
+	float sqrdlength = dx * dx + dy * dy;
+	if (sqrdlength == 0.0f || sqrdlength > 128.0f * 128.0f) return;
+
+	// Apply forces based on reciprocal distance.
+	float force = 25.0f * 128.0f * 128.0f / sqrdlength;
+	float vx = velX[i] + force * dx * dt, vy = velY[i] + force * dy * dt;
+
+	float speed = sqrt(vx * vx + vy * vy);
+	if (speed > MAX_SPEED) vx = (vx / speed) * MAX_SPEED, vy = (vy / speed) * MAX_SPEED;
+
+	velX[i] = vx, velY[i] = vy;
+}
+
+// Moves the particles and bounces them off the screen boundaries.
+__kernel void Integrate(__global float* posX, __global float* posY, __global float* velX, __global float* velY,
+	__global const float* radius, uint count, float width, float height, float dt)
+{
+	uint i = get_global_id(0);
+	if (i >= COUNT) return;
+
+	float px = posX[i] + velX[i] * dt, py = posY[i] + velY[i] * dt;
+	float r = radius[i];
+
+	if (px - r < 0.0f) px = r, velX[i] *= -1.0f;
+	if (py - r < 0.0f) py = r, velY[i] *= -1.0f;
+	if (px + r >= width) px = width - r - 1.0f, velX[i] *= -1.0f;
+	if (py + r >= height) py = height - r - 1.0f, velY[i] *= -1.0f;
+
+	posX[i] = px, posY[i] = py;
+}
+
+// Colours the particles by the direction they move in.
+__kernel void WriteColors(__global const float* velX, __global const float* velY, __global uint* color, uint count)
+{
+	uint i = get_global_id(0);
+	if (i >= COUNT) return;
+
+	float invLength = rsqrt(velX[i] * velX[i] + velY[i] * velY[i]);
+	float dx = velX[i] * invLength, dy = velY[i] * invLength;
+	color[i] = 0x000000FFu | ((uint)(dx * 127.0f + 128.0f) << 24) | ((uint)(dy * 127.0f + 128.0f) << 16);
+}
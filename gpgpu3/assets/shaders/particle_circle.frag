@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec2 pixel;
+flat in ivec2 centre;
+flat in int radSquared;
+flat in vec3 circleColor;
+
+out vec3 color;
+
+void main(){
+  // Same test as the CPU rasterizer, on the pixel this fragment lies in.
+  ivec2 d = ivec2(floor(pixel)) - centre;
+  if (d.x * d.x + d.y * d.y >= radSquared) discard;
+
+  color = circleColor;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#version 330 core
+
+// Corner of the quad, shared by all particles.
+layout(location = 0) in vec2 corner;
+// Values of a particle, advanced once per instance.
+layout(location = 1) in float prevX;
+layout(location = 2) in float prevY;
+layout(location = 3) in float posX;
+layout(location = 4) in float posY;
+layout(location = 5) in float radius;
+layout(location = 6) in vec4 packedColor;
+
+// Size of the surface the CPU rasterizer draws to, in pixels.
+uniform vec2 renderSize;
+// Interpolation factor between the previous and the current position.
+uniform float alpha;
+
+// Position in surface pixels, row 0 at the top.
+out vec2 pixel;
+flat out ivec2 centre;
+flat out int radSquared;
+flat out vec3 circleColor;
+
+void main(){
+  // Truncate the centre and radius to whole pixels, like the CPU rasterizer.
+  centre = ivec2(mix(vec2(prevX, prevY), vec2(posX, posY), alpha));
+  int r = int(radius);
+  radSquared = r * r;
+
+  // Colors are packed as 0xRRGGBBAA, so the bytes are reversed in memory.
+  circleColor = packedColor.abg;
+
+  // Cover the pixels [centre - r, centre + r].
+  pixel = vec2(centre - r) + corner * float(2 * r + 1);
+  vec2 ndc = pixel / renderSize * 2.0 - 1.0;
+  gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+}
\ No newline at end of file
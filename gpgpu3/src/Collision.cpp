@@ -0,0 +1,627 @@
+#include "stdfax.h"
+#include "Collision.h"
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows intrinsics of any instruction set in every function.
+#define TARGET_SSE4
+#define TARGET_AVX2
+#else
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Position of the padding of a ParticleBlock, the square of the distance to any particle still fits a float.
+#define BLOCK_FAR_AWAY 1e18f
+
+#pragma region Scalar
+/*
+* Checks if two particles collide.
+*/
+static bool CheckCollision(const ParticleStore& p, uint i, uint j, float dt)
+{
+	float dx = (p.posX[i] + p.velX[i] * dt) - (p.posX[j] + p.velX[j] * dt);
+	float dy = (p.posY[i] + p.velY[i] * dt) - (p.posY[j] + p.velY[j] * dt);
+
+	float radii = p.radius[i] + p.radius[j];
+	return dx * dx + dy * dy <= radii * radii;
+}
+
+/*
+* Resolve collision between two particles.
+*/
+static void ResolveCollision(ParticleStore& p, uint i, uint j)
+{
+	// Normal
+	glm::vec2 normal = glm::normalize(glm::vec2(p.posX[j] - p.posX[i], p.posY[j] - p.posY[i]));
+
+	// Relative velocity
+	glm::vec2 rv = glm::vec2(p.velX[j] - p.velX[i], p.velY[j] - p.velY[i]);
+
+	// Velocity along the normal
+	float velAlongNormal = glm::dot(rv, normal);
+
+	// Do not resolve if velocities are separating
+	if (velAlongNormal > 0) return;
+
+	// Calculate impulse scalar
+	float impulseScalar = -(1.0f + RESTITUTION) * velAlongNormal;
+	impulseScalar /= p.invMass[i] + p.invMass[j];
+
+	// Apply impulse
+	glm::vec2 impulse = impulseScalar * normal;
+	p.velX[i] -= p.invMass[i] * impulse.x, p.velY[i] -= p.invMass[i] * impulse.y;
+	p.velX[j] += p.invMass[j] * impulse.x, p.velY[j] += p.invMass[j] * impulse.y;
+
+	// Calculate overlap
+	float overlap = (p.radius[i] + p.radius[j]) - glm::length(glm::vec2(p.posX[i] - p.posX[j], p.posY[i] - p.posY[j]));
+
+	// Correct positions.
+	glm::vec2 correction = overlap * 0.5f * normal;
+	p.posX[i] -= correction.x, p.posY[i] -= correction.y;
+	p.posX[j] += correction.x, p.posY[j] += correction.y;
+}
+
+static void NarrowPhaseScalar(ParticleStore& p, uint i, const uint* candidates, uint count, float dt)
+{
+	for (uint c = 0; c < count; c++)
+		if (CheckCollision(p, i, candidates[c], dt)) ResolveCollision(p, i, candidates[c]);
+}
+
+static void GenerateContactsScalar(ParticleStore& p, uint i, const uint* candidates, uint count, float dt, std::vector<Contact>& contacts)
+{
+	for (uint c = 0; c < count; c++)
+	{
+		uint j = candidates[c];
+		if (!CheckCollision(p, i, j, dt)) continue;
+
+		// Coinciding particles have no normal.
+		float nx = p.posX[j] - p.posX[i], ny = p.posY[j] - p.posY[i];
+		float length = sqrtf(nx * nx + ny * ny);
+		if (length <= 0.0f) continue;
+
+		contacts.push_back({ i, j, nx / length, ny / length, (p.radius[i] + p.radius[j]) - length });
+	}
+}
+#pragma endregion
+
+/*
+* The SIMD kernels test a batch of partners against the state of particle i at the start of the batch.
+* The impulses and position corrections of all contacts in the batch are computed at once, applied to the
+* partners and summed for particle i. Lanes without a contact, or whose velocities are separating, are masked out.
+*/
+
+#pragma region SSE4
+TARGET_SSE4 static void NarrowPhaseSSE4(ParticleStore& p, uint i, const uint* candidates, uint count, float dt)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 restitution = _mm_set1_ps(-(1.0f + RESTITUTION));
+	const __m128 vdt = _mm_set1_ps(dt);
+
+	uint padded[4];
+	alignas(16) float impulseX[4], impulseY[4], correctionX[4], correctionY[4];
+
+	for (uint c = 0; c < count; c += 4)
+	{
+		// Pad the last batch with particle i, these lanes are masked out.
+		uint lanes = glm::min(count - c, 4u);
+		const uint* idx = &candidates[c];
+		if (lanes < 4)
+		{
+			for (uint k = 0; k < 4; k++) padded[k] = k < lanes ? candidates[c + k] : i;
+			idx = padded;
+		}
+		int valid = (1 << lanes) - 1;
+
+		__m128 pix = _mm_set1_ps(p.posX[i]), piy = _mm_set1_ps(p.posY[i]);
+		__m128 vix = _mm_set1_ps(p.velX[i]), viy = _mm_set1_ps(p.velY[i]);
+		__m128 ri = _mm_set1_ps(p.radius[i]), invMi = _mm_set1_ps(p.invMass[i]);
+
+		// Gather the partners.
+		__m128 pjx = _mm_setr_ps(p.posX[idx[0]], p.posX[idx[1]], p.posX[idx[2]], p.posX[idx[3]]);
+		__m128 pjy = _mm_setr_ps(p.posY[idx[0]], p.posY[idx[1]], p.posY[idx[2]], p.posY[idx[3]]);
+		__m128 vjx = _mm_setr_ps(p.velX[idx[0]], p.velX[idx[1]], p.velX[idx[2]], p.velX[idx[3]]);
+		__m128 vjy = _mm_setr_ps(p.velY[idx[0]], p.velY[idx[1]], p.velY[idx[2]], p.velY[idx[3]]);
+		__m128 rj = _mm_setr_ps(p.radius[idx[0]], p.radius[idx[1]], p.radius[idx[2]], p.radius[idx[3]]);
+
+		// Test the predicted positions.
+		__m128 dx = _mm_sub_ps(_mm_add_ps(pix, _mm_mul_ps(vix, vdt)), _mm_add_ps(pjx, _mm_mul_ps(vjx, vdt)));
+		__m128 dy = _mm_sub_ps(_mm_add_ps(piy, _mm_mul_ps(viy, vdt)), _mm_add_ps(pjy, _mm_mul_ps(vjy, vdt)));
+		__m128 radii = _mm_add_ps(ri, rj);
+		__m128 hit = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(radii, radii));
+
+		int mask = _mm_movemask_ps(hit) & valid;
+		if (!mask) continue;
+
+		// Normal
+		__m128 nx = _mm_sub_ps(pjx, pix), ny = _mm_sub_ps(pjy, piy);
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)));
+		nx = _mm_div_ps(nx, length), ny = _mm_div_ps(ny, length);
+
+		// Velocity along the normal, do not resolve if velocities are separating.
+		__m128 velAlongNormal = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(vjx, vix), nx), _mm_mul_ps(_mm_sub_ps(vjy, viy), ny));
+		mask &= _mm_movemask_ps(_mm_cmple_ps(velAlongNormal, zero));
+		if (!mask) continue;
+
+		// Impulse and position correction, zeroed for inactive lanes.
+		__m128 invMj = _mm_setr_ps(p.invMass[idx[0]], p.invMass[idx[1]], p.invMass[idx[2]], p.invMass[idx[3]]);
+		__m128 active = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(mask), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128()));
+		__m128 impulse = _mm_div_ps(_mm_mul_ps(restitution, velAlongNormal), _mm_add_ps(invMi, invMj));
+		impulse = _mm_blendv_ps(zero, impulse, active);
+		__m128 correction = _mm_blendv_ps(zero, _mm_mul_ps(_mm_sub_ps(radii, length), half), active);
+
+		_mm_store_ps(impulseX, _mm_mul_ps(impulse, nx)), _mm_store_ps(impulseY, _mm_mul_ps(impulse, ny));
+		_mm_store_ps(correctionX, _mm_mul_ps(correction, nx)), _mm_store_ps(correctionY, _mm_mul_ps(correction, ny));
+
+		// Apply to the partners and accumulate for particle i.
+		float dvx = 0.0f, dvy = 0.0f, dpx = 0.0f, dpy = 0.0f;
+		for (uint k = 0; k < 4; k++)
+		{
+			if (!(mask & (1 << k))) continue;
+			uint j = idx[k];
+			p.velX[j] += p.invMass[j] * impulseX[k], p.velY[j] += p.invMass[j] * impulseY[k];
+			p.posX[j] += correctionX[k], p.posY[j] += correctionY[k];
+			dvx += impulseX[k], dvy += impulseY[k];
+			dpx += correctionX[k], dpy += correctionY[k];
+		}
+
+		p.velX[i] -= p.invMass[i] * dvx, p.velY[i] -= p.invMass[i] * dvy;
+		p.posX[i] -= dpx, p.posY[i] -= dpy;
+	}
+}
+
+TARGET_SSE4 static void GenerateContactsSSE4(ParticleStore& p, uint i, const uint* candidates, uint count, float dt, std::vector<Contact>& contacts)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 vdt = _mm_set1_ps(dt);
+
+	__m128 pix = _mm_set1_ps(p.posX[i]), piy = _mm_set1_ps(p.posY[i]);
+	__m128 vix = _mm_set1_ps(p.velX[i]), viy = _mm_set1_ps(p.velY[i]);
+	__m128 ri = _mm_set1_ps(p.radius[i]);
+
+	uint padded[4];
+	alignas(16) float normalX[4], normalY[4], penetration[4];
+
+	for (uint c = 0; c < count; c += 4)
+	{
+		// Pad the last batch with particle i, these lanes are masked out.
+		uint lanes = glm::min(count - c, 4u);
+		const uint* idx = &candidates[c];
+		if (lanes < 4)
+		{
+			for (uint k = 0; k < 4; k++) padded[k] = k < lanes ? candidates[c + k] : i;
+			idx = padded;
+		}
+		int valid = (1 << lanes) - 1;
+
+		// Gather the partners.
+		__m128 pjx = _mm_setr_ps(p.posX[idx[0]], p.posX[idx[1]], p.posX[idx[2]], p.posX[idx[3]]);
+		__m128 pjy = _mm_setr_ps(p.posY[idx[0]], p.posY[idx[1]], p.posY[idx[2]], p.posY[idx[3]]);
+		__m128 vjx = _mm_setr_ps(p.velX[idx[0]], p.velX[idx[1]], p.velX[idx[2]], p.velX[idx[3]]);
+		__m128 vjy = _mm_setr_ps(p.velY[idx[0]], p.velY[idx[1]], p.velY[idx[2]], p.velY[idx[3]]);
+		__m128 rj = _mm_setr_ps(p.radius[idx[0]], p.radius[idx[1]], p.radius[idx[2]], p.radius[idx[3]]);
+
+		// Test the predicted positions.
+		__m128 dx = _mm_sub_ps(_mm_add_ps(pix, _mm_mul_ps(vix, vdt)), _mm_add_ps(pjx, _mm_mul_ps(vjx, vdt)));
+		__m128 dy = _mm_sub_ps(_mm_add_ps(piy, _mm_mul_ps(viy, vdt)), _mm_add_ps(pjy, _mm_mul_ps(vjy, vdt)));
+		__m128 radii = _mm_add_ps(ri, rj);
+		__m128 hit = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(radii, radii));
+
+		int mask = _mm_movemask_ps(hit) & valid;
+		if (!mask) continue;
+
+		// Normal, coinciding particles have none.
+		__m128 nx = _mm_sub_ps(pjx, pix), ny = _mm_sub_ps(pjy, piy);
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)));
+		mask &= _mm_movemask_ps(_mm_cmpgt_ps(length, zero));
+		if (!mask) continue;
+
+		_mm_store_ps(normalX, _mm_div_ps(nx, length)), _mm_store_ps(normalY, _mm_div_ps(ny, length));
+		_mm_store_ps(penetration, _mm_sub_ps(radii, length));
+
+		for (uint k = 0; k < 4; k++)
+			if (mask & (1 << k)) contacts.push_back({ i, idx[k], normalX[k], normalY[k], penetration[k] });
+	}
+}
+
+/*
+* Sum of the lanes.
+*/
+TARGET_SSE4 static float HorizontalSum(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	return _mm_cvtss_f32(_mm_add_ss(v, _mm_movehdup_ps(v)));
+}
+
+TARGET_SSE4 static void NarrowPhaseBlockSSE4(ParticleBlock& b, uint count, uint nFirst, float dt)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 restitution = _mm_set1_ps(-(1.0f + RESTITUTION));
+	const __m128 vdt = _mm_set1_ps(dt);
+
+	for (uint i = 0; i < nFirst; i++)
+		for (uint c = i + 1; c < count; c += 4)
+		{
+			__m128 pix = _mm_set1_ps(b.posX[i]), piy = _mm_set1_ps(b.posY[i]);
+			__m128 vix = _mm_set1_ps(b.velX[i]), viy = _mm_set1_ps(b.velY[i]);
+
+			// Load the partners, the padding after the last one never collides.
+			__m128 pjx = _mm_loadu_ps(&b.posX[c]), pjy = _mm_loadu_ps(&b.posY[c]);
+			__m128 vjx = _mm_loadu_ps(&b.velX[c]), vjy = _mm_loadu_ps(&b.velY[c]);
+
+			// Test the predicted positions.
+			__m128 dx = _mm_sub_ps(_mm_add_ps(pix, _mm_mul_ps(vix, vdt)), _mm_add_ps(pjx, _mm_mul_ps(vjx, vdt)));
+			__m128 dy = _mm_sub_ps(_mm_add_ps(piy, _mm_mul_ps(viy, vdt)), _mm_add_ps(pjy, _mm_mul_ps(vjy, vdt)));
+			__m128 radii = _mm_add_ps(_mm_set1_ps(b.radius[i]), _mm_loadu_ps(&b.radius[c]));
+			__m128 hit = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(radii, radii));
+			if (!_mm_movemask_ps(hit)) continue;
+
+			// Normal
+			__m128 nx = _mm_sub_ps(pjx, pix), ny = _mm_sub_ps(pjy, piy);
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)));
+			nx = _mm_div_ps(nx, length), ny = _mm_div_ps(ny, length);
+
+			// Velocity along the normal, do not resolve if velocities are separating.
+			__m128 velAlongNormal = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(vjx, vix), nx), _mm_mul_ps(_mm_sub_ps(vjy, viy), ny));
+			__m128 active = _mm_and_ps(hit, _mm_cmple_ps(velAlongNormal, zero));
+			if (!_mm_movemask_ps(active)) continue;
+
+			// Impulse and position correction, zeroed for inactive lanes.
+			__m128 invMi = _mm_set1_ps(b.invMass[i]), invMj = _mm_loadu_ps(&b.invMass[c]);
+			// Masked after the multiplication with the normal, which coinciding particles do not have.
+			__m128 impulse = _mm_div_ps(_mm_mul_ps(restitution, velAlongNormal), _mm_add_ps(invMi, invMj));
+			__m128 correction = _mm_mul_ps(_mm_sub_ps(radii, length), half);
+			__m128 impulseX = _mm_and_ps(_mm_mul_ps(impulse, nx), active), impulseY = _mm_and_ps(_mm_mul_ps(impulse, ny), active);
+			__m128 correctionX = _mm_and_ps(_mm_mul_ps(correction, nx), active), correctionY = _mm_and_ps(_mm_mul_ps(correction, ny), active);
+
+			// Apply to the partners in place and sum for particle i.
+			_mm_storeu_ps(&b.velX[c], _mm_add_ps(vjx, _mm_mul_ps(invMj, impulseX)));
+			_mm_storeu_ps(&b.velY[c], _mm_add_ps(vjy, _mm_mul_ps(invMj, impulseY)));
+			_mm_storeu_ps(&b.posX[c], _mm_add_ps(pjx, correctionX));
+			_mm_storeu_ps(&b.posY[c], _mm_add_ps(pjy, correctionY));
+			b.velX[i] -= b.invMass[i] * HorizontalSum(impulseX), b.velY[i] -= b.invMass[i] * HorizontalSum(impulseY);
+			b.posX[i] -= HorizontalSum(correctionX), b.posY[i] -= HorizontalSum(correctionY);
+		}
+}
+#pragma endregion
+
+#pragma region AVX2
+TARGET_AVX2 static void NarrowPhaseAVX2(ParticleStore& p, uint i, const uint* candidates, uint count, float dt)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 restitution = _mm256_set1_ps(-(1.0f + RESTITUTION));
+	const __m256 vdt = _mm256_set1_ps(dt);
+	const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	alignas(32) uint idx[8];
+	alignas(32) float impulseX[8], impulseY[8], correctionX[8], correctionY[8];
+
+	for (uint c = 0; c < count; c += 8)
+	{
+		// Pad the last batch with particle i, these lanes are masked out.
+		uint lanes = glm::min(count - c, 8u);
+		int valid = (1 << lanes) - 1;
+		__m256i validLanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), laneIndices);
+		__m256i vidx = _mm256_maskload_epi32((const int*)&candidates[c], validLanes);
+		vidx = _mm256_blendv_epi8(_mm256_set1_epi32(i), vidx, validLanes);
+
+		__m256 pix = _mm256_set1_ps(p.posX[i]), piy = _mm256_set1_ps(p.posY[i]);
+		__m256 vix = _mm256_set1_ps(p.velX[i]), viy = _mm256_set1_ps(p.velY[i]);
+		__m256 ri = _mm256_set1_ps(p.radius[i]), invMi = _mm256_set1_ps(p.invMass[i]);
+
+		// Gather the partners.
+		__m256 pjx = _mm256_i32gather_ps(p.posX, vidx, 4), pjy = _mm256_i32gather_ps(p.posY, vidx, 4);
+		__m256 vjx = _mm256_i32gather_ps(p.velX, vidx, 4), vjy = _mm256_i32gather_ps(p.velY, vidx, 4);
+		__m256 rj = _mm256_i32gather_ps(p.radius, vidx, 4);
+
+		// Test the predicted positions.
+		__m256 dx = _mm256_sub_ps(_mm256_add_ps(pix, _mm256_mul_ps(vix, vdt)), _mm256_add_ps(pjx, _mm256_mul_ps(vjx, vdt)));
+		__m256 dy = _mm256_sub_ps(_mm256_add_ps(piy, _mm256_mul_ps(viy, vdt)), _mm256_add_ps(pjy, _mm256_mul_ps(vjy, vdt)));
+		__m256 radii = _mm256_add_ps(ri, rj);
+		__m256 hit = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(radii, radii), _CMP_LE_OQ);
+
+		int mask = _mm256_movemask_ps(hit) & valid;
+		if (!mask) continue;
+
+		// Normal
+		__m256 nx = _mm256_sub_ps(pjx, pix), ny = _mm256_sub_ps(pjy, piy);
+		__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)));
+		nx = _mm256_div_ps(nx, length), ny = _mm256_div_ps(ny, length);
+
+		// Velocity along the normal, do not resolve if velocities are separating.
+		__m256 velAlongNormal = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(vjx, vix), nx), _mm256_mul_ps(_mm256_sub_ps(vjy, viy), ny));
+		mask &= _mm256_movemask_ps(_mm256_cmp_ps(velAlongNormal, zero, _CMP_LE_OQ));
+		if (!mask) continue;
+
+		// Impulse and position correction, zeroed for inactive lanes.
+		_mm256_store_si256((__m256i*)idx, vidx);
+		__m256 invMj = _mm256_i32gather_ps(p.invMass, vidx, 4);
+		__m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), laneBits), _mm256_setzero_si256()));
+		__m256 impulse = _mm256_div_ps(_mm256_mul_ps(restitution, velAlongNormal), _mm256_add_ps(invMi, invMj));
+		impulse = _mm256_and_ps(impulse, active);
+		__m256 correction = _mm256_and_ps(_mm256_mul_ps(_mm256_sub_ps(radii, length), half), active);
+
+		_mm256_store_ps(impulseX, _mm256_mul_ps(impulse, nx)), _mm256_store_ps(impulseY, _mm256_mul_ps(impulse, ny));
+		_mm256_store_ps(correctionX, _mm256_mul_ps(correction, nx)), _mm256_store_ps(correctionY, _mm256_mul_ps(correction, ny));
+
+		// Apply to the partners and accumulate for particle i.
+		float dvx = 0.0f, dvy = 0.0f, dpx = 0.0f, dpy = 0.0f;
+		for (uint k = 0; k < 8; k++)
+		{
+			if (!(mask & (1 << k))) continue;
+			uint j = idx[k];
+			p.velX[j] += p.invMass[j] * impulseX[k], p.velY[j] += p.invMass[j] * impulseY[k];
+			p.posX[j] += correctionX[k], p.posY[j] += correctionY[k];
+			dvx += impulseX[k], dvy += impulseY[k];
+			dpx += correctionX[k], dpy += correctionY[k];
+		}
+
+		p.velX[i] -= p.invMass[i] * dvx, p.velY[i] -= p.invMass[i] * dvy;
+		p.posX[i] -= dpx, p.posY[i] -= dpy;
+	}
+}
+
+TARGET_AVX2 static void GenerateContactsAVX2(ParticleStore& p, uint i, const uint* candidates, uint count, float dt, std::vector<Contact>& contacts)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 vdt = _mm256_set1_ps(dt);
+	const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	__m256 pix = _mm256_set1_ps(p.posX[i]), piy = _mm256_set1_ps(p.posY[i]);
+	__m256 vix = _mm256_set1_ps(p.velX[i]), viy = _mm256_set1_ps(p.velY[i]);
+	__m256 ri = _mm256_set1_ps(p.radius[i]);
+
+	alignas(32) float normalX[8], normalY[8], penetration[8];
+
+	for (uint c = 0; c < count; c += 8)
+	{
+		// Pad the last batch with particle i, these lanes are masked out.
+		uint lanes = glm::min(count - c, 8u);
+		int valid = (1 << lanes) - 1;
+		__m256i validLanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), laneIndices);
+		__m256i vidx = _mm256_maskload_epi32((const int*)&candidates[c], validLanes);
+		vidx = _mm256_blendv_epi8(_mm256_set1_epi32(i), vidx, validLanes);
+
+		// Gather the partners.
+		__m256 pjx = _mm256_i32gather_ps(p.posX, vidx, 4), pjy = _mm256_i32gather_ps(p.posY, vidx, 4);
+		__m256 vjx = _mm256_i32gather_ps(p.velX, vidx, 4), vjy = _mm256_i32gather_ps(p.velY, vidx, 4);
+		__m256 rj = _mm256_i32gather_ps(p.radius, vidx, 4);
+
+		// Test the predicted positions.
+		__m256 dx = _mm256_sub_ps(_mm256_add_ps(pix, _mm256_mul_ps(vix, vdt)), _mm256_add_ps(pjx, _mm256_mul_ps(vjx, vdt)));
+		__m256 dy = _mm256_sub_ps(_mm256_add_ps(piy, _mm256_mul_ps(viy, vdt)), _mm256_add_ps(pjy, _mm256_mul_ps(vjy, vdt)));
+		__m256 radii = _mm256_add_ps(ri, rj);
+		__m256 hit = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(radii, radii), _CMP_LE_OQ);
+
+		int mask = _mm256_movemask_ps(hit) & valid;
+		if (!mask) continue;
+
+		// Normal, coinciding particles have none.
+		__m256 nx = _mm256_sub_ps(pjx, pix), ny = _mm256_sub_ps(pjy, piy);
+		__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)));
+		mask &= _mm256_movemask_ps(_mm256_cmp_ps(length, zero, _CMP_GT_OQ));
+		if (!mask) continue;
+
+		_mm256_store_ps(normalX, _mm256_div_ps(nx, length)), _mm256_store_ps(normalY, _mm256_div_ps(ny, length));
+		_mm256_store_ps(penetration, _mm256_sub_ps(radii, length));
+
+		for (uint k = 0; k < 8; k++)
+			if (mask & (1 << k)) contacts.push_back({ i, candidates[c + k], normalX[k], normalY[k], penetration[k] });
+	}
+}
+
+/*
+* Sum of the lanes.
+*/
+TARGET_AVX2 static float HorizontalSum(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehdup_ps(s)));
+}
+
+TARGET_AVX2 static void NarrowPhaseBlockAVX2(ParticleBlock& b, uint count, uint nFirst, float dt)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 restitution = _mm256_set1_ps(-(1.0f + RESTITUTION));
+	const __m256 vdt = _mm256_set1_ps(dt);
+
+	for (uint i = 0; i < nFirst; i++)
+		for (uint c = i + 1; c < count; c += 8)
+		{
+			__m256 pix = _mm256_set1_ps(b.posX[i]), piy = _mm256_set1_ps(b.posY[i]);
+			__m256 vix = _mm256_set1_ps(b.velX[i]), viy = _mm256_set1_ps(b.velY[i]);
+
+			// Load the partners, the padding after the last one never collides.
+			__m256 pjx = _mm256_loadu_ps(&b.posX[c]), pjy = _mm256_loadu_ps(&b.posY[c]);
+			__m256 vjx = _mm256_loadu_ps(&b.velX[c]), vjy = _mm256_loadu_ps(&b.velY[c]);
+
+			// Test the predicted positions.
+			__m256 dx = _mm256_sub_ps(_mm256_add_ps(pix, _mm256_mul_ps(vix, vdt)), _mm256_add_ps(pjx, _mm256_mul_ps(vjx, vdt)));
+			__m256 dy = _mm256_sub_ps(_mm256_add_ps(piy, _mm256_mul_ps(viy, vdt)), _mm256_add_ps(pjy, _mm256_mul_ps(vjy, vdt)));
+			__m256 radii = _mm256_add_ps(_mm256_set1_ps(b.radius[i]), _mm256_loadu_ps(&b.radius[c]));
+			__m256 hit = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(radii, radii), _CMP_LE_OQ);
+			if (!_mm256_movemask_ps(hit)) continue;
+
+			// Normal
+			__m256 nx = _mm256_sub_ps(pjx, pix), ny = _mm256_sub_ps(pjy, piy);
+			__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)));
+			nx = _mm256_div_ps(nx, length), ny = _mm256_div_ps(ny, length);
+
+			// Velocity along the normal, do not resolve if velocities are separating.
+			__m256 velAlongNormal = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(vjx, vix), nx), _mm256_mul_ps(_mm256_sub_ps(vjy, viy), ny));
+			__m256 active = _mm256_and_ps(hit, _mm256_cmp_ps(velAlongNormal, zero, _CMP_LE_OQ));
+			if (!_mm256_movemask_ps(active)) continue;
+
+			// Impulse and position correction, zeroed for inactive lanes.
+			__m256 invMi = _mm256_set1_ps(b.invMass[i]), invMj = _mm256_loadu_ps(&b.invMass[c]);
+			// Masked after the multiplication with the normal, which coinciding particles do not have.
+			__m256 impulse = _mm256_div_ps(_mm256_mul_ps(restitution, velAlongNormal), _mm256_add_ps(invMi, invMj));
+			__m256 correction = _mm256_mul_ps(_mm256_sub_ps(radii, length), half);
+			__m256 impulseX = _mm256_and_ps(_mm256_mul_ps(impulse, nx), active), impulseY = _mm256_and_ps(_mm256_mul_ps(impulse, ny), active);
+			__m256 correctionX = _mm256_and_ps(_mm256_mul_ps(correction, nx), active), correctionY = _mm256_and_ps(_mm256_mul_ps(correction, ny), active);
+
+			// Apply to the partners in place and sum for particle i.
+			_mm256_storeu_ps(&b.velX[c], _mm256_add_ps(vjx, _mm256_mul_ps(invMj, impulseX)));
+			_mm256_storeu_ps(&b.velY[c], _mm256_add_ps(vjy, _mm256_mul_ps(invMj, impulseY)));
+			_mm256_storeu_ps(&b.posX[c], _mm256_add_ps(pjx, correctionX));
+			_mm256_storeu_ps(&b.posY[c], _mm256_add_ps(pjy, correctionY));
+			b.velX[i] -= b.invMass[i] * HorizontalSum(impulseX), b.velY[i] -= b.invMass[i] * HorizontalSum(impulseY);
+			b.posX[i] -= HorizontalSum(correctionX), b.posY[i] -= HorizontalSum(correctionY);
+		}
+}
+#pragma endregion
+
+/*
+* Contacts are resolved with the velocities at the time of resolution, so contacts that were separated by an
+* earlier contact in the same batch are skipped. The stored penetration is used for the position correction.
+*/
+void ResolveContacts(ParticleStore& p, const Contact* contacts, uint count)
+{
+	for (uint c = 0; c < count; c++)
+	{
+		const Contact& contact = contacts[c];
+		uint i = contact.i, j = contact.j;
+
+		// Velocity along the normal, do not resolve if velocities are separating.
+		float velAlongNormal = (p.velX[j] - p.velX[i]) * contact.nx + (p.velY[j] - p.velY[i]) * contact.ny;
+		if (velAlongNormal > 0) continue;
+
+		// Apply impulse
+		float impulseScalar = -(1.0f + RESTITUTION) * velAlongNormal / (p.invMass[i] + p.invMass[j]);
+		float impulseX = impulseScalar * contact.nx, impulseY = impulseScalar * contact.ny;
+		p.velX[i] -= p.invMass[i] * impulseX, p.velY[i] -= p.invMass[i] * impulseY;
+		p.velX[j] += p.invMass[j] * impulseX, p.velY[j] += p.invMass[j] * impulseY;
+
+		// Correct positions.
+		float correction = contact.penetration * 0.5f;
+		p.posX[i] -= correction * contact.nx, p.posY[i] -= correction * contact.ny;
+		p.posX[j] += correction * contact.nx, p.posY[j] += correction * contact.ny;
+	}
+}
+
+/*
+* Queries the instruction sets of the CPU and the OS support for them.
+*/
+static SimdLevel QuerySimdLevel()
+{
+	bool sse4 = false, avx2 = false;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	sse4 = info[2] & (1 << 19);
+	// AVX requires the OS to save the YMM registers on a context switch.
+	bool osSupportsAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+
+	if (maxLeaf >= 7 && osSupportsAVX)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = info[1] & (1 << 5);
+	}
+#else
+	__builtin_cpu_init();
+	sse4 = __builtin_cpu_supports("sse4.1");
+	avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if (avx2) return SimdLevel::AVX2;
+	if (sse4) return SimdLevel::SSE4;
+	return SimdLevel::SCALAR;
+}
+
+SimdLevel DetectSimdLevel()
+{
+	// The CPU does not change, and the debug window asks every frame.
+	static const SimdLevel level = QuerySimdLevel();
+	return level;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return "AVX2";
+	case SimdLevel::SSE4:
+		return "SSE4";
+	default:
+		return "Scalar";
+	}
+}
+
+NarrowPhaseKernel GetNarrowPhaseKernel(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return NarrowPhaseAVX2;
+	case SimdLevel::SSE4:
+		return NarrowPhaseSSE4;
+	default:
+		return NarrowPhaseScalar;
+	}
+}
+
+void GatherBlock(const ParticleStore& p, const uint* indices, uint count, ParticleBlock& b)
+{
+	for (uint k = 0; k < count; k++)
+	{
+		uint j = indices[k];
+		b.posX[k] = p.posX[j], b.posY[k] = p.posY[j];
+		b.velX[k] = p.velX[j], b.velY[k] = p.velY[j];
+		b.radius[k] = p.radius[j], b.invMass[k] = p.invMass[j];
+	}
+
+	// The padding stands still far away from all particles, so it never collides and its lanes add nothing.
+	for (uint k = count; k < count + BLOCK_PADDING; k++)
+	{
+		b.posX[k] = BLOCK_FAR_AWAY, b.posY[k] = BLOCK_FAR_AWAY;
+		b.velX[k] = 0.0f, b.velY[k] = 0.0f;
+		b.radius[k] = 0.0f, b.invMass[k] = 1.0f;
+	}
+}
+
+void ScatterBlock(ParticleStore& p, const uint* indices, uint count, const ParticleBlock& b)
+{
+	for (uint k = 0; k < count; k++)
+	{
+		uint j = indices[k];
+		p.posX[j] = b.posX[k], p.posY[j] = b.posY[k];
+		p.velX[j] = b.velX[k], p.velY[j] = b.velY[k];
+	}
+}
+
+NarrowPhaseBlockKernel GetNarrowPhaseBlockKernel(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return NarrowPhaseBlockAVX2;
+	case SimdLevel::SSE4:
+		return NarrowPhaseBlockSSE4;
+	default:
+		return nullptr;
+	}
+}
+
+ContactKernel GetContactKernel(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return GenerateContactsAVX2;
+	case SimdLevel::SSE4:
+		return GenerateContactsSSE4;
+	default:
+		return GenerateContactsScalar;
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "ParticleStore.h"
+
+#define RESTITUTION 0.9f
+#define BLOCK_CAPACITY 512		// Maximum number of particles in a ParticleBlock.
+#define BLOCK_PADDING 8			// Entries after the last particle of a ParticleBlock, one full AVX2 batch.
+
+/*
+* Instruction sets the narrow phase can be dispatched to.
+*/
+enum class SimdLevel : int
+{
+	SCALAR = 0,
+	SSE4 = 1,
+	AVX2 = 2
+};
+
+/*
+* Contact between two particles, produced by the first stage of the two-phase collision pipeline.
+*/
+struct Contact
+{
+	/* Indices of the particles. */
+	uint i, j;
+	/* Unit normal pointing from particle i to particle j. */
+	float nx, ny;
+	/* Overlap of the two particles along the normal. */
+	float penetration;
+};
+
+/*
+* Narrow-phase kernel. Tests particle i against a list of candidate partners and resolves every contact.
+* @param[in] particles		Particle data.
+* @param[in] i				Index of the particle.
+* @param[in] candidates		Indices of the candidate partners, may not contain i.
+* @param[in] count			Number of candidates.
+* @param[in] dt				Time step used to predict the particle positions.
+*/
+typedef void (*NarrowPhaseKernel)(ParticleStore& particles, uint i, const uint* candidates, uint count, float dt);
+
+/*
+* Contact generation kernel. Tests particle i against a list of candidate partners and appends a contact
+* for every collision, without modifying any particle.
+* @param[in] particles		Particle data.
+* @param[in] i				Index of the particle.
+* @param[in] candidates		Indices of the candidate partners, may not contain i.
+* @param[in] count			Number of candidates.
+* @param[in] dt				Time step used to predict the particle positions.
+* @param[out] contacts		Buffer the contacts are appended to.
+*/
+typedef void (*ContactKernel)(ParticleStore& particles, uint i, const uint* candidates, uint count, float dt, std::vector<Contact>& contacts);
+
+/*
+* Particles of a cell and its neighbouring cells, copied out of the ParticleStore into contiguous arrays. The SIMD
+* narrow phase then loads the partners of a particle instead of gathering them, and updates them in place.
+* The particles are followed by padding that lies far away from everything, such that batches never need a mask.
+*/
+struct ParticleBlock
+{
+	alignas(32) float posX[BLOCK_CAPACITY + BLOCK_PADDING];
+	alignas(32) float posY[BLOCK_CAPACITY + BLOCK_PADDING];
+	alignas(32) float velX[BLOCK_CAPACITY + BLOCK_PADDING];
+	alignas(32) float velY[BLOCK_CAPACITY + BLOCK_PADDING];
+	alignas(32) float radius[BLOCK_CAPACITY + BLOCK_PADDING];
+	alignas(32) float invMass[BLOCK_CAPACITY + BLOCK_PADDING];
+};
+
+/*
+* Narrow-phase kernel over a block. Tests each of the first particles of the block against all particles after it,
+* the same pairs and order as calling a NarrowPhaseKernel per particle, and resolves every contact in the block.
+* @param[in] block			Particles, updated in place.
+* @param[in] count			Number of particles in the block.
+* @param[in] nFirst			Number of particles tested against the particles after them.
+* @param[in] dt				Time step used to predict the particle positions.
+*/
+typedef void (*NarrowPhaseBlockKernel)(ParticleBlock& block, uint count, uint nFirst, float dt);
+
+/*
+* Retrieves the widest instruction set supported by both the CPU and the OS.
+*/
+SimdLevel DetectSimdLevel();
+/*
+* Retrieves a human-readable name for an instruction set.
+*/
+const char* SimdLevelName(SimdLevel level);
+/*
+* Retrieves the narrow-phase kernel for the given instruction set.
+* @param[in] level			Instruction set, should not exceed DetectSimdLevel().
+*/
+NarrowPhaseKernel GetNarrowPhaseKernel(SimdLevel level);
+/*
+* Retrieves the contact generation kernel for the given instruction set.
+* @param[in] level			Instruction set, should not exceed DetectSimdLevel().
+*/
+ContactKernel GetContactKernel(SimdLevel level);
+/*
+* Retrieves the block narrow-phase kernel for the given instruction set.
+* @param[in] level			Instruction set, should not exceed DetectSimdLevel().
+* @returns					The kernel, nullptr for the scalar narrow phase, which stays on the particle store.
+*/
+NarrowPhaseBlockKernel GetNarrowPhaseBlockKernel(SimdLevel level);
+
+/*
+* Copies particles into a block and pads it.
+* @param[in] particles		Particle data.
+* @param[in] indices		Indices of the particles, at most BLOCK_CAPACITY.
+* @param[in] count			Number of particles.
+* @param[out] block			Block receiving the particles.
+*/
+void GatherBlock(const ParticleStore& particles, const uint* indices, uint count, ParticleBlock& block);
+/*
+* Copies the positions and velocities of the particles in a block back.
+* @param[in] particles		Particle data.
+* @param[in] indices		Indices the particles were gathered from.
+* @param[in] count			Number of particles.
+* @param[in] block			Block holding the particles.
+*/
+void ScatterBlock(ParticleStore& particles, const uint* indices, uint count, const ParticleBlock& block);
+
+/*
+* Resolves a list of contacts in order. Contacts whose particles are already separating are skipped.
+* @param[in] particles		Particle data.
+* @param[in] contacts		Contacts to resolve.
+* @param[in] count			Number of contacts.
+*/
+void ResolveContacts(ParticleStore& particles, const Contact* contacts, uint count);
@@ -1,235 +1,845 @@
 #include "stdfax.h"
 #include "Game.h"
+#include "Profiler.h"
 
 #include <glm/gtx/norm.hpp> // glm::length2(...)
+#include <chrono>
 
-#define RESTITUTION 0.9f
 #define SPEED_MOD 100.0f
 #define MAX_SPEED 256.0f
+#define CACHE_LINE_FLOATS 16
+#define MAX_CANDIDATES BLOCK_CAPACITY
+
+/*
+* Milliseconds passed between two time points.
+*/
+static float ElapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+	return std::chrono::duration<float, std::milli>(to - from).count();
+}
+
+/*
+* Restricts settings to the configuration the OpenCL simulation reproduces: the scalar narrow phase visiting the
+* cells by colour class, with the particles in grid order.
+*/
+static void ApplyOpenCLReferenceSettings(SimulationSettings& settings)
+{
+	settings.multithreadedCollisions = true;
+	settings.simdLevel = SimdLevel::SCALAR;
+	settings.twoPhaseCollisions = false;
+	settings.verletLists = false;
+	settings.reorderEnabled = false;
+}
+
+const char* FrameStageName(FrameStage stage)
+{
+	switch (stage)
+	{
+	case FrameStage::GRID: return "grid";
+	case FrameStage::COLLISIONS: return "collisions";
+	case FrameStage::INPUT: return "input";
+	case FrameStage::INTEGRATE: return "integrate";
+	case FrameStage::PUBLISH: return "publish";
+	case FrameStage::RASTER: return "raster";
+	default: return "unknown";
+	}
+}
 
 void Game::UpdateParticleGrid()
 {
+	PROFILE_SCOPE("UpdateParticleGrid");
+
 	// Reset counters to zero.
-	for (int i = 0; i < GRID_RESOLUTION * GRID_RESOLUTION; i++) m_Grid[i * CELL_CAPACITY] = 0;
+	memset(m_CellStart, 0, sizeof(uint) * (GRID_CELLS + 1));
 
 	// Compute cell width in pixels.
 	uint cellWidth = Application::RenderWidth() / GRID_RESOLUTION;
 	uint cellHeight = Application::RenderHeight() / GRID_RESOLUTION;
 
-	// Insert particles in cells.
+	// Compute the cell of every particle.
+	const float* posX = m_Particles.posX, * posY = m_Particles.posY;
+	ParallelFor(0, N_PARTICLES, 0, [&](uint i)
+	{
+		uint gx = glm::min((uint)(posX[i] / cellWidth), GRID_RESOLUTION - 1u);
+		uint gy = glm::min((uint)(posY[i] / cellHeight), GRID_RESOLUTION - 1u);
+		m_ParticleCells[i] = gx + gy * GRID_RESOLUTION;
+	});
+
+	// Histogram pass: count the number of particles per cell, the count of cell c is stored in m_CellStart[c + 1].
+	for (uint i = 0; i < N_PARTICLES; i++) m_CellStart[m_ParticleCells[i] + 1]++;
+
+	// Exclusive prefix sum, after which m_CellStart[c + 1] points to the start of cell c.
+	ParallelScan(m_CellStart + 1, m_CellStart + 1, GRID_CELLS, 0, 0u, [](uint a, uint b) { return a + b; });
+
+	// Scatter pass. Incrementing the cell starts while walking the particles forwards leaves m_CellStart[c + 1]
+	// at the end of cell c, which is the start of cell c + 1, and keeps the particles in each cell sorted.
 	for (uint i = 0; i < N_PARTICLES; i++)
+		m_CellParticles[m_CellStart[m_ParticleCells[i] + 1]++] = i;
+}
+
+void Game::UpdateLocalityStats()
+{
+	struct LocalityStats { ulong distance; uint misses; };
+
+	// Walk the cells in Z-order so that perfectly sorted particles give a distance of exactly one.
+	LocalityStats stats = ParallelReduce(0, GRID_CELLS, 0, LocalityStats{ 0, 0 }, [&](uint m)
 	{
-		// Compute particle cell index.
-		uint gx = m_Particles[i].pos.x / cellWidth;
-		uint gy = m_Particles[i].pos.y / cellHeight;
+		LocalityStats cellStats = { 0, 0 };
+		uint cell = m_MortonCells[m];
+		if (m_CellStart[cell] == m_CellStart[cell + 1]) return cellStats;
+
+		// The particle preceding this cell is the last one of the closest non-empty cell before it in Z-order.
+		int previous = -1;
+		for (int n = (int)m - 1; n >= 0 && previous < 0; n--)
+		{
+			uint before = m_MortonCells[n];
+			if (m_CellStart[before] < m_CellStart[before + 1]) previous = (int)m_CellParticles[m_CellStart[before + 1] - 1];
+		}
+
+		for (uint a = m_CellStart[cell]; a < m_CellStart[cell + 1]; a++)
+		{
+			if (previous >= 0)
+			{
+				uint d = (uint)glm::abs((int)m_CellParticles[a] - previous);
+				cellStats.distance += d;
+				// Count the jumps that likely leave the current cache line.
+				cellStats.misses += d > CACHE_LINE_FLOATS;
+			}
+			previous = (int)m_CellParticles[a];
+		}
+		return cellStats;
+	},
+	[](LocalityStats a, LocalityStats b) { return LocalityStats{ a.distance + b.distance, a.misses + b.misses }; });
 
-		// Compute cell index.
-		uint cell = (gx + gy * GRID_RESOLUTION) * CELL_CAPACITY;
+	m_AvgNeighbourDistance = (float)stats.distance / (float)(N_PARTICLES - 1);
+	m_NeighbourMissRate = (float)stats.misses / (float)(N_PARTICLES - 1);
+}
+
+void Game::ReorderParticles()
+{
+	PROFILE_SCOPE("ReorderParticles");
 
-		// Add particle to cell if there is any space.
-		if (m_Grid[cell] < CELL_CAPACITY - 1)
+	// Concatenate the cells in Z-order, this gives the old particle index for every new index.
+	uint k = 0;
+	for (uint m = 0; m < GRID_CELLS; m++)
+	{
+		uint cell = m_MortonCells[m];
+		for (uint a = m_CellStart[cell]; a < m_CellStart[cell + 1]; a++)
 		{
-			// Index within the cell.
-			uint cellidx = m_Grid[cell];
-			// Add to cell.
-			m_Grid[cell + cellidx + 1] = i;
-			// Increment the counter.
-			m_Grid[cell]++;
+			m_ReorderOrder[k] = m_CellParticles[a];
+			m_ReorderRemap[m_CellParticles[a]] = k++;
 		}
 	}
+
+	// Move the particle data.
+	m_Particles.Permute(m_ReorderOrder);
+
+	// Remap the grid to the new particle indices.
+	ParallelFor(0, GRID_CELLS, 0, [&](uint c)
+	{
+		for (uint a = m_CellStart[c]; a < m_CellStart[c + 1]; a++)
+		{
+			m_CellParticles[a] = m_ReorderRemap[m_CellParticles[a]];
+			m_ParticleCells[m_CellParticles[a]] = c;
+		}
+	});
+
+	m_FramesSinceReorder = 0;
+	m_ReorderCount++;
 }
 
 void Game::UpdateParticleCollisions(float dt)
 {
-	// Loop over all cells in the grid (except last row and last column).
-	for (int y = 0; y < GRID_RESOLUTION; y++)
-		for (int x = 0; x < GRID_RESOLUTION; x++)
+	PROFILE_SCOPE("UpdateParticleCollisions");
+
+	if (m_Settings.twoPhaseCollisions)
+	{
+		UpdateParticleContacts(dt);
+		return;
+	}
+
+	if (!m_Settings.multithreadedCollisions)
+	{
+		// Loop over all cells in the grid.
+		for (int y = 0; y < GRID_RESOLUTION; y++)
+			for (int x = 0; x < GRID_RESOLUTION; x++) UpdateCellCollisions(x, y, dt);
+
+		return;
+	}
+
+	// A cell touches the particles of itself and its right, bottom-left, bottom and bottom-right neighbours.
+	// Cells that are three columns or two rows apart therefore never share particles, so we split the grid
+	// into 3x2 colour classes and process all cells of a single class in parallel.
+	for (int cy = 0; cy < 2; cy++)
+		for (int cx = 0; cx < 3; cx++)
+		{
+			// One job per row of the colour class.
+			ParallelFor(0, GRID_RESOLUTION / 2, 1, [&](uint r)
+			{
+				int y = cy + 2 * (int)r;
+				for (int x = cx; x < GRID_RESOLUTION; x += 3) UpdateCellCollisions(x, y, dt);
+			});
+		}
+}
+
+void Game::UpdateParticleContacts(float dt)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int b = 0; b < GRID_RESOLUTION * 3; b++) m_Contacts[b].clear();
+
+	// Contact generation only reads the particles, so all rows run at once.
+	if (!m_Settings.multithreadedCollisions)
+	{
+		for (int y = 0; y < GRID_RESOLUTION; y++)
+			for (int x = 0; x < GRID_RESOLUTION; x++) UpdateCellCollisions(x, y, dt, &m_Contacts[y * 3 + x % 3]);
+	}
+	else
+	{
+		ParallelFor(0, GRID_RESOLUTION, 1, [&](uint y)
 		{
-			int cell = (x + y * GRID_RESOLUTION) * CELL_CAPACITY;
-			// Number of particles in the cell.
-			int nParticles = m_Grid[cell];
+			for (int x = 0; x < GRID_RESOLUTION; x++) UpdateCellCollisions(x, y, dt, &m_Contacts[y * 3 + x % 3]);
+		});
+	}
 
-			for (int i = 0; i < nParticles; i++)
+	std::chrono::steady_clock::time_point generated = std::chrono::steady_clock::now();
+
+	// The contacts of a cell touch the same particles as its collision checks, so they are resolved in the
+	// same 3x2 colour classes as the single-phase pass.
+	for (int cy = 0; cy < 2; cy++)
+		for (int cx = 0; cx < 3; cx++)
+		{
+			if (!m_Settings.multithreadedCollisions)
 			{
-				Particle& p1 = m_Particles[m_Grid[cell + i + 1]];
-
-				/* Check for collisions within the cell. */
-				for (int j = i + 1; j < nParticles; j++)
-				{
-					Particle& p2 = m_Particles[m_Grid[cell + j + 1]];
-					if (CheckCollision(p1, p2, dt)) ResolveCollision(p1, p2);
-				}
-
-				/*  Check for collision with neighbouring cells. */
-
-				// Cell to the right.
-				if (x < GRID_RESOLUTION - 2)
-				{
-					int nextCell = (x + 1 + y * GRID_RESOLUTION) * CELL_CAPACITY;
-					for (int j = 0; j < m_Grid[nextCell]; j++)
-					{
-						Particle& p2 = m_Particles[m_Grid[nextCell + j + 1]];
-						if (CheckCollision(p1, p2, dt)) ResolveCollision(p1, p2);
-					}
-				}
-
-				// Cell below.
-				if (y < GRID_RESOLUTION - 2)
-				{
-					int nextCell = (x + (y + 1) * GRID_RESOLUTION) * CELL_CAPACITY;
-					for (int j = 0; j < m_Grid[nextCell]; j++)
-					{
-						Particle& p2 = m_Particles[m_Grid[nextCell + j + 1]];
-						if (CheckCollision(p1, p2, dt)) ResolveCollision(p1, p2);
-					}
-				}
-
-				// Cell below to the right.
-				if (x < GRID_RESOLUTION - 2 && y < GRID_RESOLUTION - 2)
-				{
-					int nextCell = (x + 1 + (y + 1) * GRID_RESOLUTION) * CELL_CAPACITY;
-					for (int j = 0; j < m_Grid[nextCell]; j++)
-					{
-						Particle& p2 = m_Particles[m_Grid[nextCell + j + 1]];
-						if (CheckCollision(p1, p2, dt)) ResolveCollision(p1, p2);
-					}
-				}
-
-				// Cell below to the left.
-				if (x > 0 && y < GRID_RESOLUTION - 2)
-				{
-					int nextCell = (x - 1 + (y + 1) * GRID_RESOLUTION) * CELL_CAPACITY;
-					for (int j = 0; j < m_Grid[nextCell]; j++)
-					{
-						Particle& p2 = m_Particles[m_Grid[nextCell + j + 1]];
-						if (CheckCollision(p1, p2, dt)) ResolveCollision(p1, p2);
-					}
-				}
+				for (int y = cy; y < GRID_RESOLUTION; y += 2)
+					ResolveContacts(m_Particles, m_Contacts[y * 3 + cx].data(), (uint)m_Contacts[y * 3 + cx].size());
+				continue;
 			}
+
+			ParallelFor(0, GRID_RESOLUTION / 2, 1, [&](uint r)
+			{
+				const std::vector<Contact>& contacts = m_Contacts[(cy + 2 * r) * 3 + cx];
+				if (!contacts.empty()) ResolveContacts(m_Particles, contacts.data(), (uint)contacts.size());
+			});
 		}
+
+	std::chrono::steady_clock::time_point resolved = std::chrono::steady_clock::now();
+
+	m_ContactCount = 0;
+	for (int b = 0; b < GRID_RESOLUTION * 3; b++) m_ContactCount += (uint)m_Contacts[b].size();
+
+	m_AvgContactGenerationTime = m_AvgContactGenerationTime * 0.95f + ElapsedMs(start, generated) * 0.05f;
+	m_AvgContactResolutionTime = m_AvgContactResolutionTime * 0.95f + ElapsedMs(generated, resolved) * 0.05f;
 }
 
-void Game::HandleUserInput(float dt)
+bool Game::VerletListsExpired(float dt) const
 {
-	// Check if mouse is held down.
-	if (Input::MouseLeftButtonDown())
+	if (!m_VerletListsValid) return true;
+
+	// The lists stay valid as long as no particle has moved more than half the skin, as no pair can
+	// have closed in by more than the skin.
+	float maxDisplacement = m_Settings.verletSkin * 0.5f;
+	return ParallelReduce(0, N_PARTICLES, 0, false, [&](uint i)
 	{
-		glm::ivec2 cpos = Input::CursorPosition();
-		if (cpos.x < 0 || cpos.y < 0 || cpos.x >= Application::WindowWidth() || cpos.y >= Application::WindowHeight()) return;
+		float dx = m_Particles.posX[i] + m_Particles.velX[i] * dt - m_VerletRefX[i];
+		float dy = m_Particles.posY[i] + m_Particles.velY[i] * dt - m_VerletRefY[i];
+		return dx * dx + dy * dy > maxDisplacement * maxDisplacement;
+	},
+	[](bool a, bool b) { return a || b; });
+}
 
-		// Convert mouse position to texture position.
-		float xscale = Application::RenderWidth() / Application::WindowWidth();
-		float yscale = Application::RenderHeight() / Application::WindowHeight();
+void Game::BuildVerletLists(float dt)
+{
+	PROFILE_SCOPE("BuildVerletLists");
 
-		glm::vec2 cursorPos = glm::vec2(Input::CursorPosition().x, Input::CursorPosition().y) * glm::vec2(xscale, yscale);
+	for (int y = 0; y < GRID_RESOLUTION; y++) m_VerletNeighbours[y].clear();
 
-		// Convert cursor pos to grid coordinates.
-		int gx = GRID_RESOLUTION * cursorPos.x / Application::RenderWidth();
-		int gy = GRID_RESOLUTION * cursorPos.y / Application::RenderHeight();
+	// Every row writes its own list buffer and only the lists of its own particles, so all rows run at once.
+	if (!m_Settings.multithreadedCollisions)
+	{
+		for (int y = 0; y < GRID_RESOLUTION; y++)
+			for (int x = 0; x < GRID_RESOLUTION; x++) BuildCellVerletLists(x, y, dt);
+	}
+	else
+	{
+		ParallelFor(0, GRID_RESOLUTION, 1, [&](uint y)
+		{
+			for (int x = 0; x < GRID_RESOLUTION; x++) BuildCellVerletLists(x, y, dt);
+		});
+	}
 
-		int xmin = glm::max(0, gx - 5);
-		int xmax = glm::min(GRID_RESOLUTION - 1, gx + 6);
-		int ymin = glm::max(0, gy - 2);
-		int ymax = glm::min(GRID_RESOLUTION - 1, gy + 3);
+	m_VerletListsValid = true;
+}
+
+void Game::BuildCellVerletLists(int x, int y, float dt)
+{
+	int cell = x + y * GRID_RESOLUTION;
+	// Range of particles in the cell.
+	uint cellStart = m_CellStart[cell], cellEnd = m_CellStart[cell + 1];
+	if (cellStart == cellEnd) return;
 
-		// Apply forces to particles based on the cursor position.
-		for (int y = ymin; y < ymax; y++)
-			for (int x = xmin; x < xmax; x++)
+	int neighbours[4];
+	int nNeighbours = GetNeighbourCells(x, y, neighbours);
+
+	const float* posX = m_Particles.posX, * posY = m_Particles.posY;
+	const float* velX = m_Particles.velX, * velY = m_Particles.velY;
+	const float* radius = m_Particles.radius;
+	std::vector<uint>& lists = m_VerletNeighbours[y];
+
+	for (uint i = cellStart; i < cellEnd; i++)
+	{
+		// The lists are built from the same predicted positions the narrow phase tests.
+		uint p1 = m_CellParticles[i];
+		float px = posX[p1] + velX[p1] * dt, py = posY[p1] + velY[p1] * dt;
+		m_VerletRefX[p1] = px, m_VerletRefY[p1] = py;
+		m_VerletStart[p1] = (uint)lists.size();
+
+		// Keep the partners in the cell after this particle and in the neighbouring cells, the same pairs the grid tests.
+		auto gather = [&](uint first, uint last)
+		{
+			for (uint j = first; j < last; j++)
 			{
-				// Apply forces to particles in cell.
-				int cell = (x + y * GRID_RESOLUTION) * CELL_CAPACITY;
-				uint nParticles = m_Grid[cell];
-
-				for (uint i = 0; i < nParticles; i++)
-				{
-					Particle& p = m_Particles[m_Grid[cell + i + 1]];
-					glm::vec2 diff = p.pos - cursorPos;
-					float sqrdlength = glm::length2(diff);
-
-					// If we happen to exactly click on a particle, ignore it.
-					if (sqrdlength == 0.0f || sqrdlength > 128.0f * 128.0f) continue;
-
-					// Apply forces based on reciprocal distance.
-					float force = 25.0f * 128.0f * 128.0f / sqrdlength;
-					p.velocity += force * diff * dt;
-
-					float speed = glm::length(p.velocity);
-					if (speed > MAX_SPEED) p.velocity = (p.velocity / speed) * MAX_SPEED;
-				}
+				uint p2 = m_CellParticles[j];
+				float dx = px - (posX[p2] + velX[p2] * dt), dy = py - (posY[p2] + velY[p2] * dt);
+				float cutoff = radius[p1] + radius[p2] + m_Settings.verletSkin;
+				if (dx * dx + dy * dy <= cutoff * cutoff) lists.push_back(p2);
 			}
+		};
+		gather(i + 1, cellEnd);
+		for (int n = 0; n < nNeighbours; n++) gather(m_CellStart[neighbours[n]], m_CellStart[neighbours[n] + 1]);
+
+		m_VerletCount[p1] = (uint)lists.size() - m_VerletStart[p1];
+	}
+}
+
+int Game::GetNeighbourCells(int x, int y, int* neighbours) const
+{
+	// Neighbouring cells to check for collisions: right, below, below to the right and below to the left.
+	int nNeighbours = 0;
+	if (x < GRID_RESOLUTION - 2) neighbours[nNeighbours++] = x + 1 + y * GRID_RESOLUTION;
+	if (y < GRID_RESOLUTION - 2) neighbours[nNeighbours++] = x + (y + 1) * GRID_RESOLUTION;
+	if (x < GRID_RESOLUTION - 2 && y < GRID_RESOLUTION - 2) neighbours[nNeighbours++] = x + 1 + (y + 1) * GRID_RESOLUTION;
+	if (x > 0 && y < GRID_RESOLUTION - 2) neighbours[nNeighbours++] = x - 1 + (y + 1) * GRID_RESOLUTION;
+	return nNeighbours;
+}
+
+void Game::UpdateCellCollisions(int x, int y, float dt, std::vector<Contact>* contacts)
+{
+	int cell = x + y * GRID_RESOLUTION;
+	// Range of particles in the cell.
+	uint cellStart = m_CellStart[cell], cellEnd = m_CellStart[cell + 1];
+	if (cellStart == cellEnd) return;
+
+	// Use the Verlet lists built from this cell instead of the neighbouring cells.
+	if (m_Settings.verletLists)
+	{
+		const uint* lists = m_VerletNeighbours[y].data();
+		for (uint i = cellStart; i < cellEnd; i++)
+		{
+			uint p1 = m_CellParticles[i];
+			if (contacts) m_ContactKernel(m_Particles, p1, lists + m_VerletStart[p1], m_VerletCount[p1], dt, *contacts);
+			else m_NarrowPhase(m_Particles, p1, lists + m_VerletStart[p1], m_VerletCount[p1], dt);
+		}
+		return;
+	}
+
+	int neighbours[4];
+	int nNeighbours = GetNeighbourCells(x, y, neighbours);
+
+	// Count the particles in the cell and its neighbours.
+	uint nCandidates = cellEnd - cellStart;
+	for (int n = 0; n < nNeighbours; n++) nCandidates += m_CellStart[neighbours[n] + 1] - m_CellStart[neighbours[n]];
+
+	if (nCandidates <= MAX_CANDIDATES)
+	{
+		// Gather the particles of the cell followed by those of the neighbouring cells. Every particle in the cell is
+		// then tested against all entries after it in a single call, such that the narrow phase can test them in batches.
+		uint candidates[MAX_CANDIDATES], k = 0;
+		for (uint j = cellStart; j < cellEnd; j++) candidates[k++] = m_CellParticles[j];
+		for (int n = 0; n < nNeighbours; n++)
+			for (uint j = m_CellStart[neighbours[n]]; j < m_CellStart[neighbours[n] + 1]; j++) candidates[k++] = m_CellParticles[j];
+
+		if (contacts)
+			for (uint i = 0; i < cellEnd - cellStart; i++) m_ContactKernel(m_Particles, candidates[i], &candidates[i + 1], nCandidates - i - 1, dt, *contacts);
+		else if (m_NarrowPhaseBlock)
+		{
+			// Copy the candidates out once, such that the SIMD kernel loads its batches instead of gathering them.
+			ParticleBlock block;
+			GatherBlock(m_Particles, candidates, nCandidates, block);
+			m_NarrowPhaseBlock(block, nCandidates, cellEnd - cellStart, dt);
+			ScatterBlock(m_Particles, candidates, nCandidates, block);
+		}
+		else
+			for (uint i = 0; i < cellEnd - cellStart; i++) m_NarrowPhase(m_Particles, candidates[i], &candidates[i + 1], nCandidates - i - 1, dt);
+	}
+	else
+	{
+		// Overcrowded cells are tested range by range, straight from the grid.
+		for (uint i = cellStart; i < cellEnd; i++)
+		{
+			uint p1 = m_CellParticles[i];
+			if (contacts) m_ContactKernel(m_Particles, p1, &m_CellParticles[i + 1], cellEnd - i - 1, dt, *contacts);
+			else m_NarrowPhase(m_Particles, p1, &m_CellParticles[i + 1], cellEnd - i - 1, dt);
 
+			for (int n = 0; n < nNeighbours; n++)
+			{
+				const uint* range = &m_CellParticles[m_CellStart[neighbours[n]]];
+				uint rangeSize = m_CellStart[neighbours[n] + 1] - m_CellStart[neighbours[n]];
+				if (contacts) m_ContactKernel(m_Particles, p1, range, rangeSize, dt, *contacts);
+				else m_NarrowPhase(m_Particles, p1, range, rangeSize, dt);
+			}
+		}
 	}
 }
 
-bool Game::CheckCollision(const Particle& p1, const Particle& p2, float dt)
+void Game::HandleUserInput(float dt)
 {
-	glm::vec2 p1NextPos = p1.pos + p1.velocity * dt;
-	glm::vec2 p2NextPos = p2.pos + p2.velocity * dt;
+	PROFILE_SCOPE("HandleUserInput");
+
+	// Check if mouse is held down.
+	if (!m_Input.mouseDown) return;
+	glm::vec2 cursorPos = m_Input.cursor;
+
+	// Convert cursor pos to grid coordinates.
+	int gx = GRID_RESOLUTION * cursorPos.x / Application::RenderWidth();
+	int gy = GRID_RESOLUTION * cursorPos.y / Application::RenderHeight();
+
+	int xmin = glm::max(0, gx - 5);
+	int xmax = glm::min(GRID_RESOLUTION - 1, gx + 6);
+	int ymin = glm::max(0, gy - 2);
+	int ymax = glm::min(GRID_RESOLUTION - 1, gy + 3);
+
+	auto applyForce = [&](uint p)
+	{
+		glm::vec2 diff = glm::vec2(m_Particles.posX[p], m_Particles.posY[p]) - cursorPos;
+		float sqrdlength = glm::length2(diff);
+
+		// If we happen to exactly click on a particle, ignore it.
+		if (sqrdlength == 0.0f || sqrdlength > 128.0f * 128.0f) return;
+
+		// Apply forces based on reciprocal distance.
+		float force = 25.0f * 128.0f * 128.0f / sqrdlength;
+		glm::vec2 velocity = glm::vec2(m_Particles.velX[p], m_Particles.velY[p]) + force * diff * dt;
+
+		float speed = glm::length(velocity);
+		if (speed > MAX_SPEED) velocity = (velocity / speed) * MAX_SPEED;
+
+		m_Particles.velX[p] = velocity.x, m_Particles.velY[p] = velocity.y;
+	};
 
-	float distSquared = glm::length2(p1NextPos - p2NextPos);
+	// The grid is only rebuilt along with the Verlet lists, so particles may have left the cells it holds them in.
+	// Find the particles in the cells around the cursor by their current position instead.
+	if (m_Settings.verletLists)
+	{
+		uint cellWidth = Application::RenderWidth() / GRID_RESOLUTION;
+		uint cellHeight = Application::RenderHeight() / GRID_RESOLUTION;
+		ParallelFor(0, N_PARTICLES, 0, [&](uint p)
+		{
+			int x = (int)glm::min((uint)(m_Particles.posX[p] / cellWidth), GRID_RESOLUTION - 1u);
+			int y = (int)glm::min((uint)(m_Particles.posY[p] / cellHeight), GRID_RESOLUTION - 1u);
+			if (x >= xmin && x < xmax && y >= ymin && y < ymax) applyForce(p);
+		});
+		return;
+	}
 
-	return distSquared <= (p1.radius + p2.radius) * (p1.radius + p2.radius);
+	// Apply forces to particles based on the cursor position.
+	for (int y = ymin; y < ymax; y++)
+		for (int x = xmin; x < xmax; x++)
+		{
+			// Apply forces to particles in cell.
+			int cell = x + y * GRID_RESOLUTION;
+			for (uint i = m_CellStart[cell]; i < m_CellStart[cell + 1]; i++) applyForce(m_CellParticles[i]);
+		}
 }
 
-void Game::ResolveCollision(Particle& p1, Particle& p2)
+void Game::IntegrateParticles(float dt)
 {
-	// Normal
-	glm::vec2 normal = glm::normalize(p2.pos - p1.pos);
+	PROFILE_SCOPE("IntegrateParticles");
 
-	// Relative velocity
-	glm::vec2 rv = p2.velocity - p1.velocity;
+	float* posX = m_Particles.posX, * posY = m_Particles.posY;
+	float* velX = m_Particles.velX, * velY = m_Particles.velY;
+	const float* radius = m_Particles.radius;
+	const float width = (float)Application::RenderWidth(), height = (float)Application::RenderHeight();
 
-	// Velocity along the normal
-	float velAlongNormal = glm::dot(rv, normal);
+	ParallelFor(0, N_PARTICLES, 0, [&](uint i)
+	{
+		// Update particle position.
+		posX[i] += velX[i] * dt;
+		posY[i] += velY[i] * dt;
+
+		// Check if outside of boundary.
+		if (posX[i] - radius[i] < 0.0f) posX[i] = radius[i], velX[i] *= -1.0f;
+		if (posY[i] - radius[i] < 0.0f) posY[i] = radius[i], velY[i] *= -1.0f;
+		if (posX[i] + radius[i] >= width) posX[i] = width - radius[i] - 1.0f, velX[i] *= -1.0f;
+		if (posY[i] + radius[i] >= height) posY[i] = height - radius[i] - 1.0f, velY[i] *= -1.0f;
+	});
+}
 
-	// Do not resolve if velocities are separating
-	if (velAlongNormal > 0) return;
+#if !HEADLESS_BUILD
+void Game::TickOpenCL(float dt)
+{
+	// The particle state stays on the device and every stage only enqueues its kernels, which the device runs in
+	// order. Publishing waits for the device to finish the tick and reads the state back.
+	m_FrameGraph.Clear();
+	m_TaskStages.clear();
+	AddTask("Grid", FrameStage::GRID, RESOURCE_PARTICLES, RESOURCE_GRID | RESOURCE_PREVIOUS, [this] { m_clSimulation->BuildGrid(); });
+	AddTask("Collisions", FrameStage::COLLISIONS, RESOURCE_GRID, RESOURCE_PARTICLES, [this, dt] { m_clSimulation->Collide(dt); });
+	if (m_Input.mouseDown)
+		AddTask("Input", FrameStage::INPUT, RESOURCE_GRID, RESOURCE_PARTICLES, [this, dt] { m_clSimulation->ApplyInput(m_Input.cursor, dt); });
+	AddTask("Integrate", FrameStage::INTEGRATE, RESOURCE_PARTICLES, RESOURCE_PARTICLES, [this, dt] { m_clSimulation->Integrate(dt); });
+	AddTask("Publish", FrameStage::PUBLISH, RESOURCE_PARTICLES | RESOURCE_PREVIOUS, RESOURCE_PUBLISHED_SNAPSHOT, [this]
+	{
+		SimulationSnapshot& snapshot = m_Snapshots.Back();
+		m_clSimulation->ReadSnapshot(snapshot.prevX, snapshot.prevY, snapshot.posX, snapshot.posY, snapshot.radius, snapshot.color);
+	});
 
-	// Calculate impulse scalar
-	float j = -(1.0f + RESTITUTION) * velAlongNormal;
-	j /= 1 / p1.mass + 1 / p2.mass;
+	// The host is idle while the device steps, so the last draw is rasterized in the meantime.
+	if (!Application::ThreadedSimulation() && m_RasterPending)
+		AddTask("Raster", FrameStage::RASTER, RESOURCE_RENDER_SNAPSHOT, RESOURCE_SCREEN, [this] { RasterizeSnapshot(); });
 
-	// Apply impulse
-	glm::vec2 impulse = j * normal;
-	p1.velocity -= (1.0f / p1.mass) * impulse;
-	p2.velocity += (1.0f / p2.mass) * impulse;
+	m_FrameGraph.Execute();
 
-	// Cap velocity at a maximum speed.
-	float p1speed = glm::length(p1.velocity);
-	float p2speed = glm::length(p2.velocity);
+	// The tasks only time the enqueueing, the stages are timed on the device instead.
+	m_StageTimes[(int)FrameStage::GRID] = m_clSimulation->StageTime(clStage::GRID);
+	m_StageTimes[(int)FrameStage::COLLISIONS] = m_clSimulation->StageTime(clStage::COLLISIONS);
+	m_StageTimes[(int)FrameStage::INPUT] = m_clSimulation->StageTime(clStage::INPUT);
+	m_StageTimes[(int)FrameStage::INTEGRATE] = m_clSimulation->StageTime(clStage::INTEGRATE);
+	m_StageTimes[(int)FrameStage::PUBLISH] = m_clSimulation->StageTime(clStage::READBACK);
 
-	// Calculate overlap
-	float overlap = (p1.radius + p2.radius) - glm::length(p1.pos - p2.pos);
+	PublishSnapshot(dt);
+}
 
-	// Correct positions.
-	p1.pos -= overlap * 0.5f * normal;
-	p2.pos += overlap * 0.5f * normal;
+void Game::EnqueueOpenCLTick(float dt)
+{
+	m_clSimulation->BuildGrid();
+	m_clSimulation->Collide(dt);
+	if (m_Input.mouseDown) m_clSimulation->ApplyInput(m_Input.cursor, dt);
+	m_clSimulation->Integrate(dt);
 }
 
-void Game::DrawParticle(Particle& p)
+void Game::CompareOpenCLState()
 {
-	int radius = (int)p.radius;
-	int radSquared = radius * radius;
-	int cx = (int)p.pos.x, cy = (int)p.pos.y;
+	PROFILE_SCOPE("CompareOpenCLState");
 
-	int yStart = glm::max(cy - radius, 0);
-	int yEnd = glm::min((int)Application::RenderHeight() - 1, cy + radius);
-	int xStart = glm::max(cx - radius, 0);
-	int xEnd = glm::min((int)Application::RenderWidth() - 1, cx + radius);
+	m_clSimulation->Download(*m_clParticles);
 
-	// Particle speed.
-	glm::vec2 direction = glm::normalize(p.velocity);
-	uint color = 0x000000FF | ((uint)(direction.x * 127.0f + 128.0f) << 24) | ((uint)(direction.y * 127.0f + 128.0f) << 16);
+	float positionError = 0.0f, velocityError = 0.0f;
+	for (uint i = 0; i < N_PARTICLES; i++)
+	{
+		glm::vec2 dp = glm::vec2(m_clParticles->posX[i] - m_Particles.posX[i], m_clParticles->posY[i] - m_Particles.posY[i]);
+		glm::vec2 dv = glm::vec2(m_clParticles->velX[i] - m_Particles.velX[i], m_clParticles->velY[i] - m_Particles.velY[i]);
+		positionError = glm::max(positionError, glm::length(dp));
+		velocityError = glm::max(velocityError, glm::length(dv));
+	}
 
-	// Iterate over pixels and draw the circle.
-	for (int y = yStart; y < yEnd; y++)
-		for (int x = xStart; x < xEnd; x++)
-		{
-			// Check if the current pixel is within the circle.
-			int dx = x - cx, dy = y - cy;
+	m_clPositionError = positionError, m_clVelocityError = velocityError;
+	m_clMaxPositionError = glm::max(m_clMaxPositionError, positionError);
+	m_clMaxVelocityError = glm::max(m_clMaxVelocityError, velocityError);
+}
+
+void Game::BenchmarkGridBuild(uint iterations)
+{
+	// A queue of its own, such that the commands of the builder can be timed in isolation.
+	clContext* context = Application::CLcontext();
+	clCommandQueue* queue = new clCommandQueue(context, false, true);
+	clBuffer* posX = new clBuffer(context, sizeof(float) * N_PARTICLES, BufferFlags::READ_ONLY);
+	clBuffer* posY = new clBuffer(context, sizeof(float) * N_PARTICLES, BufferFlags::READ_ONLY);
+	clGridBuilder* builder = new clGridBuilder(context, N_PARTICLES, GRID_RESOLUTION);
+	posX->CopyToDevice(queue, m_Particles.posX, false);
+	posY->CopyToDevice(queue, m_Particles.posY, false);
+
+	// Warm up both, such that neither pays for touching its buffers for the first time.
+	UpdateParticleGrid();
+	builder->Build(queue, posX, posY, N_PARTICLES, Application::RenderWidth(), Application::RenderHeight());
+	queue->Synchronize();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint i = 0; i < iterations; i++) UpdateParticleGrid();
+	float hostTime = ElapsedMs(start, std::chrono::steady_clock::now()) / iterations;
 
-			if (dx * dx + dy * dy < radSquared) Application::Screen()->PlotPixel(color, x, y);
+	// The device time sums the commands of every build, the wall time includes enqueueing and waiting.
+	double deviceTime = 0.0;
+	start = std::chrono::steady_clock::now();
+	for (uint i = 0; i < iterations; i++)
+	{
+		std::vector<gpu_event> events;
+		builder->Build(queue, posX, posY, N_PARTICLES, Application::RenderWidth(), Application::RenderHeight(), &events);
+		queue->Synchronize();
+		for (gpu_event e : events)
+		{
+			deviceTime += GetGPUCommandExecutionTime(e);
+			CL_ERROR(clReleaseEvent(e), "Failed to release event.");
 		}
+	}
+	float wallTime = ElapsedMs(start, std::chrono::steady_clock::now()) / iterations;
+
+	// Both sorts are stable, so the grids must be identical.
+	std::vector<uint> cellStart(GRID_CELLS + 1), cellParticles(N_PARTICLES);
+	builder->CellStart()->CopyToHost(queue, cellStart.data());
+	builder->CellParticles()->CopyToHost(queue, cellParticles.data());
+	bool match = memcmp(cellStart.data(), m_CellStart, sizeof(uint) * (GRID_CELLS + 1)) == 0
+		&& memcmp(cellParticles.data(), m_CellParticles, sizeof(uint) * N_PARTICLES) == 0;
+
+	printf("{\n");
+	printf("\t\"iterations\": %u,\n", iterations);
+	printf("\t\"particles\": %u,\n", N_PARTICLES);
+	printf("\t\"cells\": %u,\n", GRID_CELLS);
+	printf("\t\"radix_passes\": %u,\n", builder->Passes());
+	printf("\t\"host_counting_sort_ms\": %.4f,\n", hostTime);
+	printf("\t\"device_radix_sort_ms\": %.4f,\n", deviceTime / iterations);
+	printf("\t\"device_radix_sort_wall_ms\": %.4f,\n", wallTime);
+	printf("\t\"match\": %s\n", match ? "true" : "false");
+	printf("}\n");
+
+	delete builder;
+	delete posX;
+	delete posY;
+	delete queue;
+}
+#endif
+
+float Game::TimeNarrowPhase(SimdLevel level, uint iterations, float dt)
+{
+	// Every pass starts from the current particles, which are restored afterwards.
+	std::vector<float> state(N_PARTICLES * 4);
+	memcpy(&state[0], m_Particles.posX, sizeof(float) * N_PARTICLES);
+	memcpy(&state[N_PARTICLES], m_Particles.posY, sizeof(float) * N_PARTICLES);
+	memcpy(&state[N_PARTICLES * 2], m_Particles.velX, sizeof(float) * N_PARTICLES);
+	memcpy(&state[N_PARTICLES * 3], m_Particles.velY, sizeof(float) * N_PARTICLES);
+
+	// The SIMD kernels are used by the single-phase pass over the grid.
+	SimulationSettings settings = m_Settings;
+	NarrowPhaseKernel narrowPhase = m_NarrowPhase;
+	NarrowPhaseBlockKernel narrowPhaseBlock = m_NarrowPhaseBlock;
+	m_Settings.verletLists = false, m_Settings.twoPhaseCollisions = false;
+	m_NarrowPhase = GetNarrowPhaseKernel(level), m_NarrowPhaseBlock = GetNarrowPhaseBlockKernel(level);
+	UpdateParticleGrid();
+
+	float time = 0.0f;
+	for (uint i = 0; i <= iterations; i++)
+	{
+		memcpy(m_Particles.posX, &state[0], sizeof(float) * N_PARTICLES);
+		memcpy(m_Particles.posY, &state[N_PARTICLES], sizeof(float) * N_PARTICLES);
+		memcpy(m_Particles.velX, &state[N_PARTICLES * 2], sizeof(float) * N_PARTICLES);
+		memcpy(m_Particles.velY, &state[N_PARTICLES * 3], sizeof(float) * N_PARTICLES);
+
+		// The first pass only warms up the caches.
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		UpdateParticleCollisions(dt);
+		if (i > 0) time += ElapsedMs(start, std::chrono::steady_clock::now());
+	}
+
+	memcpy(m_Particles.posX, &state[0], sizeof(float) * N_PARTICLES);
+	memcpy(m_Particles.posY, &state[N_PARTICLES], sizeof(float) * N_PARTICLES);
+	memcpy(m_Particles.velX, &state[N_PARTICLES * 2], sizeof(float) * N_PARTICLES);
+	memcpy(m_Particles.velY, &state[N_PARTICLES * 3], sizeof(float) * N_PARTICLES);
+	m_Settings = settings, m_NarrowPhase = narrowPhase, m_NarrowPhaseBlock = narrowPhaseBlock;
+
+	// The Verlet lists refer to the grid they were built with.
+	m_VerletListsValid = false;
+	return time / iterations;
+}
+
+void Game::WriteSnapshot(SimulationSnapshot& snapshot)
+{
+	PROFILE_SCOPE("WriteSnapshot");
+
+	ParallelFor(0, N_PARTICLES, 0, [&](uint i)
+	{
+		snapshot.prevX[i] = m_PrevPosX[i], snapshot.prevY[i] = m_PrevPosY[i];
+		snapshot.posX[i] = m_Particles.posX[i], snapshot.posY[i] = m_Particles.posY[i];
+		snapshot.radius[i] = m_Particles.radius[i];
+
+		// Particle speed.
+		glm::vec2 direction = glm::normalize(glm::vec2(m_Particles.velX[i], m_Particles.velY[i]));
+		snapshot.color[i] = 0x000000FF | ((uint)(direction.x * 127.0f + 128.0f) << 24) | ((uint)(direction.y * 127.0f + 128.0f) << 16);
+	});
+}
+
+void Game::PublishSnapshot(float dt)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	float tickTime = ElapsedMs(m_LastPublish, now);
+	if (tickTime > 0.0f) m_TickRate = m_TickRate * 0.95f + 1000.0f / tickTime * 0.05f;
+	m_LastPublish = now;
+
+	SimulationSnapshot& snapshot = m_Snapshots.Back();
+	snapshot.time = now, snapshot.dt = dt;
+
+	SimulationStats& stats = snapshot.stats;
+	memcpy(stats.stageTimes, m_StageTimes, sizeof(m_StageTimes));
+	stats.criticalPath = m_FrameGraph.CriticalPath();
+	stats.totalWork = m_FrameGraph.TotalWork();
+	stats.tickTime = m_FrameGraph.WallTime();
+	stats.taskCount = glm::min(m_FrameGraph.TaskCount(), (uint)MAX_FRAME_TASKS);
+	for (uint t = 0; t < stats.taskCount; t++) stats.taskNames[t] = m_FrameGraph.TaskName(t), stats.taskTimes[t] = m_FrameGraph.TaskTime(t);
+	stats.tickRate = m_TickRate;
+	stats.substeps = Application::Substeps();
+	stats.arenaPeak = JobManager::Arena().Peak();
+
+	stats.contactCount = m_ContactCount;
+	stats.avgContactGenerationTime = m_AvgContactGenerationTime, stats.avgContactResolutionTime = m_AvgContactResolutionTime;
+	stats.verletRebuildCount = m_VerletRebuildCount;
+	stats.verletRebuildRate = m_VerletRebuildRate, stats.avgVerletBuildTime = m_AvgVerletBuildTime;
+	stats.avgCollisionPassTime[0] = m_AvgCollisionPassTime[0], stats.avgCollisionPassTime[1] = m_AvgCollisionPassTime[1];
+	stats.avgNeighbourDistance = m_AvgNeighbourDistance, stats.neighbourMissRate = m_NeighbourMissRate;
+	stats.reorderCount = m_ReorderCount, stats.framesSinceReorder = m_FramesSinceReorder;
+	stats.clPositionError = m_clPositionError, stats.clVelocityError = m_clVelocityError;
+	stats.clMaxPositionError = m_clMaxPositionError, stats.clMaxVelocityError = m_clMaxVelocityError;
+#if !HEADLESS_BUILD
+	stats.clSpecialized = m_clSimulation && m_clSimulation->Specialized();
+#endif
+
+	m_Snapshots.Publish();
+}
+
+void Game::CaptureRenderSnapshot(float alpha)
+{
+	// Keeps the previous snapshot when nothing was published since, it is then drawn again with the new alpha.
+	m_Snapshots.Consume();
+	m_RenderAlpha = alpha;
+	m_RasterPending = true;
+}
+
+void Game::RasterizeSnapshot()
+{
+	PROFILE_SCOPE("RasterizeSnapshot");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const SimulationSnapshot& snapshot = m_Snapshots.Front();
+
+	// Clear the screen.
+	Application::Screen()->Clear();
+	// Render the particles.
+	if (m_BinnedRaster) RasterizeBinned(snapshot);
+	else for (uint i = 0; i < N_PARTICLES; i++) DrawParticle(snapshot, i);
+
+	m_RasterPending = false;
+	m_RasterTime = ElapsedMs(start, std::chrono::steady_clock::now());
+}
+
+void Game::RasterizeBinned(const SimulationSnapshot& snapshot)
+{
+	Surface* screen = Application::Screen();
+	const uint nTiles = m_RasterTilesX * m_RasterTilesY;
+	const uint tilesX = m_RasterTilesX;
+
+	// Compute the circles and count the particles overlapping every tile.
+	for (uint t = 0; t < nTiles; t++) m_TileCursor[t].store(0, std::memory_order_relaxed);
+	ParallelFor(0, N_PARTICLES, 0, [&](uint i)
+	{
+		const RasterCircle& c = m_RasterCircles[i] = ParticleCircle(snapshot, i);
+		if (c.xEnd <= c.xStart || c.yEnd <= c.yStart) return;
+
+		for (int ty = c.yStart / RASTER_TILE_SIZE; ty <= (c.yEnd - 1) / RASTER_TILE_SIZE; ty++)
+			for (int tx = c.xStart / RASTER_TILE_SIZE; tx <= (c.xEnd - 1) / RASTER_TILE_SIZE; tx++)
+				m_TileCursor[tx + ty * tilesX].fetch_add(1, std::memory_order_relaxed);
+	});
+
+	// Compute the start of every tile.
+	for (uint t = 0; t < nTiles; t++) m_TileStart[t] = m_TileCursor[t].load(std::memory_order_relaxed);
+	m_TileStart[nTiles] = ParallelScan(m_TileStart, m_TileStart, nTiles, 0, 0u, [](uint a, uint b) { return a + b; });
+	if (m_TileParticles.size() < m_TileStart[nTiles]) m_TileParticles.resize(m_TileStart[nTiles]);
+	for (uint t = 0; t < nTiles; t++) m_TileCursor[t].store(m_TileStart[t], std::memory_order_relaxed);
+
+	// Scatter the particles into the tiles they overlap.
+	uint* tileParticles = m_TileParticles.data();
+	ParallelFor(0, N_PARTICLES, 0, [&](uint i)
+	{
+		const RasterCircle& c = m_RasterCircles[i];
+		if (c.xEnd <= c.xStart || c.yEnd <= c.yStart) return;
+
+		for (int ty = c.yStart / RASTER_TILE_SIZE; ty <= (c.yEnd - 1) / RASTER_TILE_SIZE; ty++)
+			for (int tx = c.xStart / RASTER_TILE_SIZE; tx <= (c.xEnd - 1) / RASTER_TILE_SIZE; tx++)
+				tileParticles[m_TileCursor[tx + ty * tilesX].fetch_add(1, std::memory_order_relaxed)] = i;
+	});
+
+	// Every tile is written by a single job, so there is no contention on the pixels nor on the dirty tiles.
+	Color* pixels = screen->PixelBuffer();
+	const int width = (int)screen->GetWidth(), height = (int)screen->GetHeight();
+	ParallelFor(0, nTiles, 16, [&](uint t)
+	{
+		uint* begin = &tileParticles[m_TileStart[t]], * end = &tileParticles[m_TileStart[t + 1]];
+		if (begin == end) return;
+
+		// The scatter does not keep the particle order, which decides the colour where particles overlap.
+		std::sort(begin, end);
+
+		int x0 = (t % tilesX) * RASTER_TILE_SIZE, y0 = (t / tilesX) * RASTER_TILE_SIZE;
+		int x1 = glm::min(x0 + RASTER_TILE_SIZE, width), y1 = glm::min(y0 + RASTER_TILE_SIZE, height);
+
+		// Starts out black, like the cleared screen.
+		Color tile[RASTER_TILE_SIZE * RASTER_TILE_SIZE];
+		for (const uint* p = begin; p != end; p++) RasterizeCircle(m_RasterCircles[*p], x0, y0, x1, y1, tile, RASTER_TILE_SIZE);
+
+		for (int y = y0; y < y1; y++) memcpy(&pixels[x0 + y * width], &tile[(y - y0) * RASTER_TILE_SIZE], sizeof(Color) * (x1 - x0));
+		screen->MarkDirty(x0, y0, x1 - x0, y1 - y0);
+	});
+}
+
+RasterCircle Game::ParticleCircle(const SimulationSnapshot& snapshot, uint i) const
+{
+	RasterCircle c;
+	int radius = c.radius = (int)snapshot.radius[i];
+	c.radSquared = radius * radius;
+	c.cx = (int)glm::mix(snapshot.prevX[i], snapshot.posX[i], m_RenderAlpha);
+	c.cy = (int)glm::mix(snapshot.prevY[i], snapshot.posY[i], m_RenderAlpha);
+
+	c.yStart = glm::max(c.cy - radius, 0);
+	c.yEnd = glm::min((int)Application::RenderHeight() - 1, c.cy + radius);
+	c.xStart = glm::max(c.cx - radius, 0);
+	c.xEnd = glm::min((int)Application::RenderWidth() - 1, c.cx + radius);
+
+	c.color = snapshot.color[i];
+	return c;
+}
+
+void Game::DrawParticle(const SimulationSnapshot& snapshot, uint i)
+{
+	RasterCircle c = ParticleCircle(snapshot, i);
+	if (c.xEnd <= c.xStart || c.yEnd <= c.yStart) return;
+
+	// Write the pixels directly, the bounding box is marked once instead of every pixel.
+	Surface* screen = Application::Screen();
+	Color* pixels = screen->PixelBuffer();
+	uint width = screen->GetWidth();
+	screen->MarkDirty(c.xStart, c.yStart, c.xEnd - c.xStart, c.yEnd - c.yStart);
+
+	// The circle is already clipped to the screen.
+	RasterizeCircle(c, 0, 0, (int)width, (int)screen->GetHeight(), pixels, (int)width);
+}
+
+#if !HEADLESS_BUILD
+void Game::DrawInstanced()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const SimulationSnapshot& snapshot = m_Snapshots.Front();
+
+	if (!m_ParticleRenderer) m_ParticleRenderer = new ParticleRenderer(N_PARTICLES);
+	m_ParticleRenderer->Upload(snapshot.prevX, snapshot.prevY, snapshot.posX, snapshot.posY, snapshot.radius, snapshot.color);
+	m_ParticleRenderer->Draw(m_RenderAlpha, Application::RenderWidth(), Application::RenderHeight());
+
+	m_RasterPending = false;
+	m_RasterTime = ElapsedMs(start, std::chrono::steady_clock::now());
+}
+#endif
+
+SimulationSnapshot::SimulationSnapshot()
+{
+	prevX = new float[N_PARTICLES], prevY = new float[N_PARTICLES];
+	posX = new float[N_PARTICLES], posY = new float[N_PARTICLES];
+	radius = new float[N_PARTICLES];
+	color = new uint[N_PARTICLES];
+}
+
+SimulationSnapshot::~SimulationSnapshot()
+{
+	delete[] prevX;
+	delete[] prevY;
+	delete[] posX;
+	delete[] posY;
+	delete[] radius;
+	delete[] color;
 }
 
 
@@ -238,6 +848,18 @@ Game::Game()
 	// Resize the window.
 	Application::SetWindowSize(1024, 1024, true);
 
+	// Order the grid cells along a Z-order curve by de-interleaving the bits of the Morton codes.
+	for (uint m = 0; m < GRID_CELLS; m++)
+	{
+		uint gx = 0, gy = 0;
+		for (uint bit = 0; (1u << bit) < GRID_RESOLUTION; bit++)
+		{
+			gx |= ((m >> (2 * bit)) & 1u) << bit;
+			gy |= ((m >> (2 * bit + 1)) & 1u) << bit;
+		}
+		m_MortonCells[m] = gx + gy * GRID_RESOLUTION;
+	}
+
 	// Initialize seed for deterministic sim.
 	srand(0);
 
@@ -252,14 +874,120 @@ Game::Game()
 		float mass = radius * 4.0f;
 		uint color = (rand() % 255 << 24) | (rand() % 255 << 16) | (rand() % 255 << 8) | 255u;
 
-		m_Particles[i] = { pos, vel, mass, radius, color };
+		m_Particles.Set(i, pos, vel, mass, radius, color);
+		m_PrevPosX[i] = pos.x, m_PrevPosY[i] = pos.y;
+	}
+
+	// One bin per screen tile.
+	m_RasterTilesX = (Application::RenderWidth() + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	m_RasterTilesY = (Application::RenderHeight() + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	m_TileStart = new uint[m_RasterTilesX * m_RasterTilesY + 1];
+	m_TileCursor = new std::atomic<uint>[m_RasterTilesX * m_RasterTilesY];
+
+	// Start from the settings the application was configured with.
+	m_Settings.fixedTimeStep = Application::FixedTimeStep(), m_Settings.maxSubsteps = Application::MaxSubsteps();
+	m_Settings.workers = JobManager::NumWorkerThreads(), m_Settings.placement = JobManager::Placement();
+	if (Application::ValidateOpenCL())
+	{
+		ApplyOpenCLReferenceSettings(m_Settings);
+		m_NarrowPhase = GetNarrowPhaseKernel(m_Settings.simdLevel), m_ContactKernel = GetContactKernel(m_Settings.simdLevel);
+		m_NarrowPhaseBlock = GetNarrowPhaseBlockKernel(m_Settings.simdLevel);
 	}
+	m_GuiSettings = m_Settings;
 
+#if !HEADLESS_BUILD
+	// Hand the initial state to the OpenCL device, which keeps it from here on.
+	if (Application::OpenCLSimulation())
+	{
+		m_clSimulation = new clSimulation(Application::CLcontext(), N_PARTICLES, GRID_RESOLUTION, Application::RenderWidth(), Application::RenderHeight());
+		m_clSimulation->Upload(m_Particles);
+		if (Application::ValidateOpenCL()) m_clParticles = new ParticleStore(N_PARTICLES);
+	}
+#endif
+
+	// Hand the initial state to the renderer, no simulation thread is running yet.
+	m_LastPublish = std::chrono::steady_clock::now();
+	WriteSnapshot(m_Snapshots.Back());
+	PublishSnapshot(0.0f);
+	m_Snapshots.Consume();
 }
 
 Game::~Game()
 {
 	// Perform any saving operations and free allocated memory.
+	delete[] m_CellStart;
+	delete[] m_CellParticles;
+	delete[] m_ParticleCells;
+	delete[] m_MortonCells;
+	delete[] m_ReorderOrder;
+	delete[] m_ReorderRemap;
+	delete[] m_VerletStart;
+	delete[] m_VerletCount;
+	delete[] m_VerletRefX;
+	delete[] m_VerletRefY;
+	delete[] m_PrevPosX;
+	delete[] m_PrevPosY;
+	delete[] m_RasterCircles;
+#if !HEADLESS_BUILD
+	delete m_ParticleRenderer;
+	delete m_clSimulation;
+	delete m_clParticles;
+#endif
+	delete[] m_TileStart;
+	delete[] m_TileCursor;
+}
+
+void Game::AddTask(const char* name, FrameStage stage, uint reads, uint writes, std::function<void()> function)
+{
+	m_FrameGraph.AddTask(name, reads, writes, function);
+	m_TaskStages.push_back(stage);
+}
+
+#if !HEADLESS_BUILD
+void Game::PostInput()
+{
+	InputState input;
+	glm::ivec2 cpos = Input::CursorPosition();
+	input.mouseDown = Input::MouseLeftButtonDown() &&
+		!(cpos.x < 0 || cpos.y < 0 || cpos.x >= (int)Application::WindowWidth() || cpos.y >= (int)Application::WindowHeight());
+
+	// Convert mouse position to texture position.
+	float xscale = (float)Application::RenderWidth() / Application::WindowWidth();
+	float yscale = (float)Application::RenderHeight() / Application::WindowHeight();
+	input.cursor = glm::vec2(cpos.x, cpos.y) * glm::vec2(xscale, yscale);
+
+	// The queue only fills up when the simulation stalls, the input is then dropped.
+	m_InputQueue.Push(input);
+}
+#endif
+
+void Game::ApplyForwardedState()
+{
+	// Only the latest input and settings matter.
+	while (m_InputQueue.Pop(m_Input));
+
+	SimulationSettings settings;
+	bool changed = false;
+	while (m_SettingsQueue.Pop(settings)) changed = true;
+	if (!changed) return;
+
+	// The CPU simulation keeps the configuration the device is compared against.
+	if (Application::ValidateOpenCL()) ApplyOpenCLReferenceSettings(settings);
+
+	if (settings.verletSkin != m_Settings.verletSkin) m_VerletListsValid = false;
+	if (settings.simdLevel != m_Settings.simdLevel)
+	{
+		m_NarrowPhase = GetNarrowPhaseKernel(settings.simdLevel), m_ContactKernel = GetContactKernel(settings.simdLevel);
+		m_NarrowPhaseBlock = GetNarrowPhaseBlockKernel(settings.simdLevel);
+	}
+
+	// The simulation runs no jobs in between ticks, the render thread waits for the restart to finish.
+	if (settings.workers != m_Settings.workers || settings.placement != m_Settings.placement)
+		JobManager::Restart(settings.workers, settings.placement);
+	if (settings.fixedTimeStep != m_Settings.fixedTimeStep || settings.maxSubsteps != m_Settings.maxSubsteps)
+		Application::SetFixedTimeStep(settings.fixedTimeStep, settings.maxSubsteps);
+
+	m_Settings = settings;
 }
 
 void Game::Tick(float dt)
@@ -267,41 +995,151 @@ void Game::Tick(float dt)
 	// Update average frametime.
 	m_AvgFrameTime = 0.99f * m_AvgFrameTime + 0.01 * dt;
 
-	// Build the particle grid.
-	UpdateParticleGrid();
-	// Handle collisions using the grid.
-	UpdateParticleCollisions(dt);
+	ApplyForwardedState();
+
+#if !HEADLESS_BUILD
+	if (m_clSimulation && !Application::ValidateOpenCL())
+	{
+		TickOpenCL(dt);
+		return;
+	}
 
-	// Apply forces based on user input.
-	HandleUserInput(dt);
+	// When validating, the device repeats the tick from the same state alongside the CPU.
+	if (m_clSimulation)
+	{
+		m_clSimulation->Upload(m_Particles);
+		EnqueueOpenCLTick(dt);
+	}
+#endif
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	m_FramesSinceReorder++;
+
+	// With Verlet lists the grid is kept until the lists expire. The particles are not reordered in between,
+	// as that would invalidate the indices stored in the lists.
+	bool rebuild = !m_Settings.verletLists || VerletListsExpired(dt);
+	if (m_Settings.verletLists) m_VerletRebuildRate = m_VerletRebuildRate * 0.99f + (rebuild ? 0.01f : 0.0f);
 
-	// Update positions and heck collision with screen boundaries.
-	for (int i = 0; i < N_PARTICLES; i++)
+	// Every stage is a task, stages that do not share data run at the same time.
+	m_FrameGraph.Clear();
+	m_TaskStages.clear();
+	if (rebuild)
 	{
-		Particle& p = m_Particles[i];
+		// Build the particle grid.
+		AddTask("Grid", FrameStage::GRID, RESOURCE_PARTICLES, RESOURCE_GRID, [this] { UpdateParticleGrid(); });
+		// The reorder threshold needs the locality of the new grid, otherwise it is only measured for the debug window.
+		if (m_Settings.reorderEnabled || m_Settings.localityStats)
+			AddTask("LocalityStats", FrameStage::GRID, RESOURCE_GRID, RESOURCE_LOCALITY, [this] { UpdateLocalityStats(); });
+
+		// Restore memory locality periodically, or as soon as it degrades too much.
+		if (m_Settings.reorderEnabled)
+			AddTask("Reorder", FrameStage::GRID, RESOURCE_LOCALITY | RESOURCE_GRID | RESOURCE_PARTICLES, RESOURCE_GRID | RESOURCE_PARTICLES, [this]
+			{
+				if (m_FramesSinceReorder >= m_Settings.reorderInterval || m_NeighbourMissRate > m_Settings.reorderThreshold) ReorderParticles();
+			});
 
-		// Update particle position.
-		p.pos += p.velocity * dt;
+		if (m_Settings.verletLists) AddTask("VerletLists", FrameStage::GRID, RESOURCE_GRID | RESOURCE_PARTICLES, RESOURCE_VERLET, [this, dt] { BuildVerletLists(dt); });
+		else m_VerletListsValid = false;
+	}
 
-		// Check if outside of boundary.
-		if (p.pos.x - p.radius < 0.0f) p.pos.x = p.radius, p.velocity.x *= -1.0f;
-		if (p.pos.y - p.radius < 0.0f) p.pos.y = p.radius, p.velocity.y *= -1.0f;
-		if (p.pos.x + p.radius >= Application::RenderWidth()) p.pos.x = Application::RenderWidth() - p.radius - 1.0f, p.velocity.x *= -1.0f;
-		if (p.pos.y + p.radius >= Application::RenderHeight()) p.pos.y = Application::RenderHeight() - p.radius - 1.0f, p.velocity.y *= -1.0f;
+	// Keep the state at the start of this tick for interpolation. Building the grid and reordering do not move
+	// the particles, so the snapshot is taken after the particles have been reordered.
+	AddTask("PreviousPositions", FrameStage::GRID, RESOURCE_PARTICLES, RESOURCE_PREVIOUS, [this]
+	{
+		memcpy(m_PrevPosX, m_Particles.posX, sizeof(float) * N_PARTICLES);
+		memcpy(m_PrevPosY, m_Particles.posY, sizeof(float) * N_PARTICLES);
+	});
+
+	// Handle collisions using the grid.
+	AddTask("Collisions", FrameStage::COLLISIONS, RESOURCE_GRID | RESOURCE_VERLET, RESOURCE_PARTICLES, [this, dt] { UpdateParticleCollisions(dt); });
+	// Apply forces based on user input. With Verlet lists the grid may be stale, the input then finds the particles near
+	// the cursor by position, instead of rebuilding the grid every tick, which the lists refer to.
+	AddTask("Input", FrameStage::INPUT, RESOURCE_GRID, RESOURCE_PARTICLES, [this, dt] { HandleUserInput(dt); });
+	// Update positions and check collision with screen boundaries.
+	AddTask("Integrate", FrameStage::INTEGRATE, RESOURCE_PARTICLES, RESOURCE_PARTICLES, [this, dt] { IntegrateParticles(dt); });
+
+	// Copy the new state for the renderer.
+	AddTask("Publish", FrameStage::PUBLISH, RESOURCE_PARTICLES | RESOURCE_PREVIOUS, RESOURCE_PUBLISHED_SNAPSHOT, [this] { WriteSnapshot(m_Snapshots.Back()); });
+
+	// Rasterize the state captured by the last call to Draw, which shares no data with the simulation. With a
+	// simulation thread, the render thread rasterizes on its own.
+	if (!Application::ThreadedSimulation() && m_RasterPending)
+		AddTask("Raster", FrameStage::RASTER, RESOURCE_RENDER_SNAPSHOT, RESOURCE_SCREEN, [this] { RasterizeSnapshot(); });
+
+	std::chrono::steady_clock::time_point graphStart = std::chrono::steady_clock::now();
+	m_FrameGraph.Execute();
+
+	// The raster stage is timed by RasterizeSnapshot, as it does not run in every tick.
+	memset(m_StageTimes, 0, sizeof(m_StageTimes));
+	m_StageTimes[(int)FrameStage::GRID] = ElapsedMs(start, graphStart);
+	for (uint t = 0; t < m_FrameGraph.TaskCount(); t++)
+		if (m_TaskStages[t] != FrameStage::RASTER) m_StageTimes[(int)m_TaskStages[t]] += m_FrameGraph.TaskTime(t);
+
+	if (rebuild && m_Settings.verletLists)
+	{
+		m_VerletRebuildCount++;
+		m_AvgVerletBuildTime = m_AvgVerletBuildTime * 0.95f + m_StageTimes[(int)FrameStage::GRID] * 0.05f;
 	}
+
+	float collisionPassTime = m_StageTimes[(int)FrameStage::GRID] + m_StageTimes[(int)FrameStage::COLLISIONS];
+	m_AvgCollisionPassTime[m_Settings.verletLists] = m_AvgCollisionPassTime[m_Settings.verletLists] * 0.95f + collisionPassTime * 0.05f;
+
+#if !HEADLESS_BUILD
+	if (m_clSimulation) CompareOpenCLState();
+#endif
+
+	PublishSnapshot(dt);
 }
 
-void Game::Draw(float dt)
+void Game::Draw(float alpha)
 {
-	// Clear the screen.
-	Application::Screen()->Clear();
-	// Render the particles.
+	PROFILE_SCOPE("Draw");
+
+	if (Application::ThreadedSimulation())
+	{
+		// Interpolate by the time passed since the latest state was published, such that the screen trails the
+		// simulation by at most one step without ever waiting for it.
+		m_Snapshots.Consume();
+		const SimulationSnapshot& snapshot = m_Snapshots.Front();
+		float age = std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot.time).count();
+		m_RenderAlpha = snapshot.dt > 0.0f ? glm::clamp(age / snapshot.dt, 0.0f, 1.0f) : 1.0f;
+
+#if !HEADLESS_BUILD
+		if (m_RenderBackend == RenderBackend::INSTANCED)
+		{
+			DrawInstanced();
+			return;
+		}
+#endif
+		RasterizeSnapshot();
+		Application::Screen()->SyncPixels();
+		return;
+	}
+
+#if !HEADLESS_BUILD
+	// The GPU draws the current state right away, there is no work left to overlap with the next tick.
+	if (m_RenderBackend == RenderBackend::INSTANCED)
+	{
+		CaptureRenderSnapshot(alpha);
+		DrawInstanced();
+		return;
+	}
+#endif
 
-	for (int i = 0; i < N_PARTICLES; i++) DrawParticle(m_Particles[i]);
+	// Without pipelining, the current state is rasterized right away.
+	if (!m_PipelinedRaster) CaptureRenderSnapshot(alpha);
+
+	// The snapshot is normally rasterized by the next tick. When no tick ran since the last draw, it is rasterized here.
+	if (m_RasterPending) RasterizeSnapshot();
 
 	Application::Screen()->SyncPixels();
+
+	// With pipelining, the next tick rasterizes this state while it steps the simulation, so the screen lags one frame behind.
+	if (m_PipelinedRaster) CaptureRenderSnapshot(alpha);
 }
 
+#if !HEADLESS_BUILD
 void Game::RenderGUI(float dt)
 {
 	// GUI code goes here. 
@@ -316,9 +1154,135 @@ void Game::RenderGUI(float dt)
 	ImGui::Begin(windowTitle, &display, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_AlwaysAutoResize);
 	ImGui::SetWindowFontScale(1.25f);
 	ImGui::Text("Frame-time: %.1f", dt * 1000.0f);
+
+	// Settings are edited in a copy owned by this thread and forwarded to the simulation, statistics are read
+	// from the state that is being drawn.
+	SimulationSettings& settings = m_GuiSettings;
+	const SimulationStats& stats = m_Snapshots.Front().stats;
+	bool changed = false;
+
+	ImGui::Separator();
+	bool fixedTimeStep = settings.fixedTimeStep > 0.0f;
+	float timeStep = fixedTimeStep ? settings.fixedTimeStep * 1000.0f : 1000.0f / 60.0f;
+	int maxSubsteps = (int)settings.maxSubsteps;
+	bool timeStepChanged = ImGui::Checkbox("Fixed time step", &fixedTimeStep);
+	if (fixedTimeStep)
+	{
+		timeStepChanged |= ImGui::SliderFloat("Time step (ms)", &timeStep, 1.0f, 50.0f, "%.1f");
+		timeStepChanged |= ImGui::SliderInt("Max. substeps", &maxSubsteps, 1, 16);
+		ImGui::Text("Substeps: %u", stats.substeps);
+	}
+	if (timeStepChanged) settings.fixedTimeStep = fixedTimeStep ? timeStep * 0.001f : 0.0f, settings.maxSubsteps = (uint)maxSubsteps;
+	changed |= timeStepChanged;
+	if (Application::ThreadedSimulation()) ImGui::Text("Simulation rate: %.1f ticks/s", stats.tickRate);
+
+	ImGui::Separator();
+	// The backend is chosen at startup, the device ignores the collision settings below.
+	if (Application::ValidateOpenCL())
+	{
+		ImGui::Text("Simulation: OpenCL, validated against the CPU");
+		ImGui::Text("Max. error: %.4f px, %.4f px/s", stats.clPositionError, stats.clVelocityError);
+		ImGui::Text("Max. error overall: %.4f px, %.4f px/s", stats.clMaxPositionError, stats.clMaxVelocityError);
+	}
+	else ImGui::Text("Simulation: %s", Application::OpenCLSimulation() ? "OpenCL" : "CPU");
+	if (Application::OpenCLSimulation()) ImGui::Text("Kernels: %s", stats.clSpecialized ? "specialized" : "generic, specializing");
+	changed |= ImGui::Checkbox("Multithreaded collisions", &settings.multithreadedCollisions);
+
+	// The simulation restarts the job system in between two ticks.
+	static const int nLogicalCores = (int)DetectCpuTopology().size();
+	const char* placements[] = {
+		WorkerPlacementName(WorkerPlacement::NONE), WorkerPlacementName(WorkerPlacement::LOGICAL),
+		WorkerPlacementName(WorkerPlacement::PHYSICAL_FIRST), WorkerPlacementName(WorkerPlacement::PHYSICAL_ONLY) };
+	int nWorkers = (int)settings.workers;
+	int placement = (int)settings.placement;
+	bool restart = ImGui::SliderInt("Worker threads", &nWorkers, 1, glm::max(nLogicalCores * 2, 2));
+	restart |= ImGui::Combo("Worker placement", &placement, placements, IM_ARRAYSIZE(placements));
+	if (restart) settings.workers = (uint)nWorkers, settings.placement = (WorkerPlacement)placement;
+	changed |= restart;
+	ImGui::Text("Job arena peak: %.1f KB", stats.arenaPeak / 1024.0f);
+
+	ImGui::Separator();
+	// The render thread rasterizes on its own when the simulation has a thread.
+	const char* backends[] = { "CPU surface", "GPU instanced" };
+	int backend = (int)m_RenderBackend;
+	if (ImGui::Combo("Renderer", &backend, backends, IM_ARRAYSIZE(backends))) m_RenderBackend = (RenderBackend)backend;
+	if (m_RenderBackend == RenderBackend::SURFACE)
+	{
+		if (!Application::ThreadedSimulation())
+		{
+			ImGui::Checkbox("Pipelined raster (one frame behind)", &m_PipelinedRaster);
+			if (ImGui::IsItemHovered()) ImGui::SetTooltip("Rasterizes each frame during the next tick, the screen then shows the previous frame.");
+		}
+		ImGui::Checkbox("Binned raster", &m_BinnedRaster);
+		ImGui::Text("Raster: %.2f ms", m_RasterTime);
+		// Only the tiles drawn to are cleared and uploaded.
+		Surface* screen = Application::Screen();
+		ImGui::Text("Screen cleared: %.1f%%, uploaded: %.1f%%", screen->ClearCoverage() * 100.0f, screen->UploadCoverage() * 100.0f);
+		ImGui::Text("Upload: %.2f MB", screen->UploadCoverage() * screen->GetWidth() * screen->GetHeight() * sizeof(Color) / (1024.0f * 1024.0f));
+	}
+	else if (m_ParticleRenderer)
+	{
+		ImGui::Text("Upload and draw: %.2f ms", m_RasterTime);
+		ImGui::Text("Upload: %.2f MB", m_ParticleRenderer->UploadSize() / (1024.0f * 1024.0f));
+	}
+	// The critical path bounds the tick time, however many threads are available.
+	ImGui::Text("Critical path: %.2f ms", stats.criticalPath);
+	ImGui::Text("Total work: %.2f ms (parallelism %.2f)", stats.totalWork,
+		stats.criticalPath > 0.0f ? stats.totalWork / stats.criticalPath : 0.0f);
+	ImGui::Text("Tick: %.2f ms", stats.tickTime);
+	if (ImGui::TreeNode("Tasks"))
+	{
+		for (uint t = 0; t < stats.taskCount; t++) ImGui::Text("%s: %.2f ms", stats.taskNames[t], stats.taskTimes[t]);
+		ImGui::TreePop();
+	}
+
+	// Only offer the instruction sets supported by this machine.
+	const char* simdLevels[] = { SimdLevelName(SimdLevel::SCALAR), SimdLevelName(SimdLevel::SSE4), SimdLevelName(SimdLevel::AVX2) };
+	int simdLevel = (int)settings.simdLevel;
+	if (ImGui::Combo("Narrow phase", &simdLevel, simdLevels, (int)DetectSimdLevel() + 1))
+		settings.simdLevel = (SimdLevel)simdLevel, changed = true;
+
+	changed |= ImGui::Checkbox("Two-phase collisions", &settings.twoPhaseCollisions);
+	if (settings.twoPhaseCollisions)
+	{
+		ImGui::Text("Contacts: %u", stats.contactCount);
+		ImGui::Text("Contact generation: %.2f ms", stats.avgContactGenerationTime);
+		ImGui::Text("Contact resolution: %.2f ms", stats.avgContactResolutionTime);
+	}
+
+	ImGui::Separator();
+	changed |= ImGui::Checkbox("Verlet lists", &settings.verletLists);
+	// The lists are gathered from the neighbouring cells, so both radii plus the skin must stay below the cell width.
+	changed |= ImGui::SliderFloat("Verlet skin", &settings.verletSkin, 0.0f, 12.0f, "%.1f");
+	if (settings.verletLists)
+	{
+		ImGui::Text("Rebuild rate: %.1f%% (%i rebuilds)", stats.verletRebuildRate * 100.0f, stats.verletRebuildCount);
+		ImGui::Text("Rebuild time: %.2f ms", stats.avgVerletBuildTime);
+	}
+	// Only meaningful once both broad phases have been timed.
+	if (stats.avgCollisionPassTime[0] > 0.0f && stats.avgCollisionPassTime[1] > 0.0f)
+		ImGui::Text("Time saved: %.2f ms/frame", stats.avgCollisionPassTime[0] - stats.avgCollisionPassTime[1]);
+
+	ImGui::Separator();
+	changed |= ImGui::Checkbox("Spatial reordering", &settings.reorderEnabled);
+	changed |= ImGui::SliderInt("Reorder interval", &settings.reorderInterval, 1, 1000);
+	changed |= ImGui::SliderFloat("Reorder threshold", &settings.reorderThreshold, 0.0f, 1.0f, "%.2f");
+	changed |= ImGui::Checkbox("Locality statistics", &settings.localityStats);
+	if (settings.reorderEnabled || settings.localityStats)
+	{
+		ImGui::Text("Avg. neighbour index distance: %.1f", stats.avgNeighbourDistance);
+		ImGui::Text("Neighbour cache-line miss rate: %.1f%%", stats.neighbourMissRate * 100.0f);
+	}
+	ImGui::Text("Reorders: %i (last %i frames ago)", stats.reorderCount, stats.framesSinceReorder);
 	ImGui::End();
 
+	// Retried in the next frame when the simulation has not caught up with the queue.
+	if (changed || m_SettingsDirty) m_SettingsDirty = !m_SettingsQueue.Push(settings);
+
+	Profiler::RenderGUI();
+
 	// Render dear imgui into screen
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
+#endif
@@ -1,78 +1,547 @@
 #pragma once
 #include "Template/Application.h"
+#include "ParticleStore.h"
+#include "Collision.h"
+#include "TaskGraph.h"
+#include "Raster.h"
+#if !HEADLESS_BUILD
+#include "ParticleRenderer.h"
+#include "clSimulation.h"
+#endif
 
 #define N_PARTICLES					1024 * 50		// Number of particles in simulation.
 #define GRID_RESOLUTION				128				// Divide the particle area in 128 * 128 cells.
-#define CELL_CAPACITY				1024			// Maximum number of particles that we can store per cell.
+#define GRID_CELLS					(GRID_RESOLUTION * GRID_RESOLUTION)	// Total number of cells in the grid.
+#define MAX_FRAME_TASKS				16				// Number of task timings kept in the simulation statistics.
+#define RASTER_TILE_SIZE			SURFACE_TILE_SIZE	// Screen tiles rasterized by a single job, one dirty tile of the surface each.
 
+class Game;
 
-struct Particle
+/*
+* Stages of a frame that are timed separately.
+*/
+enum class FrameStage : int
+{
+	/* Building the grid, reordering the particles and rebuilding the Verlet lists. */
+	GRID = 0,
+	/* Broad and narrow phase. */
+	COLLISIONS,
+	/* Forces applied by the user. */
+	INPUT,
+	/* Position update and boundary checks. */
+	INTEGRATE,
+	/* Copying the particle state for the renderer. */
+	PUBLISH,
+	/* Clearing the screen, rasterizing the particles and syncing the pixels. */
+	RASTER,
+	COUNT
+};
+
+/*
+* Retrieves a human-readable name for a frame stage.
+*/
+const char* FrameStageName(FrameStage stage);
+
+/*
+* Ways of getting the particles on the screen.
+*/
+enum class RenderBackend : int
+{
+	/* Rasterizing on the CPU into the surface, which is uploaded as a texture. */
+	SURFACE = 0,
+	/* Drawing instanced quads on the GPU from the uploaded particle state. */
+	INSTANCED = 1
+};
+
+/*
+* Data shared by the stages of a frame, from which the task graph derives the order of the stages.
+*/
+enum FrameResource : uint
+{
+	/* Particle data. */
+	RESOURCE_PARTICLES = 1 << 0,
+	/* Particle grid. */
+	RESOURCE_GRID = 1 << 1,
+	/* Locality statistics of the grid. */
+	RESOURCE_LOCALITY = 1 << 2,
+	/* Verlet lists. */
+	RESOURCE_VERLET = 1 << 3,
+	/* Particle positions at the start of the tick. */
+	RESOURCE_PREVIOUS = 1 << 4,
+	/* Particle state being rasterized. */
+	RESOURCE_RENDER_SNAPSHOT = 1 << 5,
+	/* Pixels of the screen. */
+	RESOURCE_SCREEN = 1 << 6,
+	/* Particle state being published to the renderer. */
+	RESOURCE_PUBLISHED_SNAPSHOT = 1 << 7
+};
+
+/*
+* Mouse input forwarded from the render thread to the simulation.
+*/
+struct InputState
 {
+	/* Cursor position in render pixels. */
+	glm::vec2 cursor = glm::vec2(0.0f);
+	/* Set while the left mouse button is held down inside the window. */
+	bool mouseDown = false;
+};
+
+/*
+* Simulation settings edited in the debug window. The render thread keeps its own copy and forwards it to the
+* simulation whenever it changes, such that the simulation thread is the only one reading its copy.
+*/
+struct SimulationSettings
+{
+	/* Run the collision pass on the JobManager. */
+	bool multithreadedCollisions = true;
+	/* Instruction set used by the narrow phase, defaults to the widest one supported. */
+	SimdLevel simdLevel = DetectSimdLevel();
+	/*
+	* Split the collision pass into a contact generation stage, which only reads the particles and runs over
+	* all rows at once, followed by a contact resolution stage scheduled by colour class.
+	*/
+	bool twoPhaseCollisions = false;
+	/*
+	* Use persistent Verlet neighbour lists as broad phase. The lists keep every partner closer than
+	* both radii plus verletSkin and are only rebuilt, along with the grid, once some particle has
+	* moved more than half the skin since the last build.
+	*/
+	bool verletLists = false;
+	/* Extra distance around a particle covered by its Verlet list, in pixels. */
+	float verletSkin = 8.0f;
+	/* Periodically sorts the particles into Z-order (Morton) cell order to improve memory locality. */
+	bool reorderEnabled = true;
+	/* Number of frames between two reorder passes. */
+	int reorderInterval = 120;
+	/* Reorder early when the neighbour cache-line miss rate exceeds this threshold. */
+	float reorderThreshold = 0.25f;
+	/* Measures the locality of the particle order after every grid build, also while reordering is disabled. */
+	bool localityStats = false;
+	/* Fixed time step in seconds, 0 to follow the frame time, and the maximum number of steps per frame. */
+	float fixedTimeStep = 0.0f;
+	uint maxSubsteps = 4;
+	/* Number of worker threads of the JobManager and how they are pinned to cores. */
+	uint workers = 0;
+	WorkerPlacement placement = WorkerPlacement::PHYSICAL_FIRST;
+};
 
-	glm::vec2 pos;
-	glm::vec2 velocity;
+/*
+* Statistics of the last tick, published to the debug window along with the particles.
+*/
+struct SimulationStats
+{
+	float stageTimes[(int)FrameStage::COUNT] = {};
+	/* Task graph of the tick. */
+	float criticalPath = 0.0f, totalWork = 0.0f, tickTime = 0.0f;
+	uint taskCount = 0;
+	const char* taskNames[MAX_FRAME_TASKS] = {};
+	float taskTimes[MAX_FRAME_TASKS] = {};
+	/* Number of ticks per second, and the number of ticks taken in the last frame of the simulation. */
+	float tickRate = 0.0f;
+	uint substeps = 0;
+	size_t arenaPeak = 0;
 
-	float mass;
-	float radius;
+	uint contactCount = 0;
+	float avgContactGenerationTime = 0.0f, avgContactResolutionTime = 0.0f;
+	int verletRebuildCount = 0;
+	float verletRebuildRate = 0.0f, avgVerletBuildTime = 0.0f;
+	float avgCollisionPassTime[2] = { 0.0f, 0.0f };
+	float avgNeighbourDistance = 0.0f, neighbourMissRate = 0.0f;
+	int reorderCount = 0, framesSinceReorder = 0;
 
-	uint color;
+	/* Largest difference between the OpenCL and the CPU state in the last tick and in any tick so far. */
+	float clPositionError = 0.0f, clVelocityError = 0.0f;
+	float clMaxPositionError = 0.0f, clMaxVelocityError = 0.0f;
+	/* Whether the OpenCL simulation runs the kernels specialized for its configuration yet. */
+	bool clSpecialized = false;
 };
 
+/*
+* Particle state published by the simulation after every tick, holding everything needed to draw a frame.
+*/
+struct SimulationSnapshot
+{
+	SimulationSnapshot();
+	~SimulationSnapshot();
+	SimulationSnapshot(const SimulationSnapshot&) = delete;
+	SimulationSnapshot& operator=(const SimulationSnapshot&) = delete;
+
+	/* Positions at the start and the end of the tick. */
+	float* prevX, * prevY;
+	float* posX, * posY;
+	float* radius;
+	/* Color derived from the direction of the particle. */
+	uint* color;
+
+	/* Time at which the snapshot was published, and the time step of the tick. */
+	std::chrono::steady_clock::time_point time;
+	float dt = 0.0f;
+	SimulationStats stats;
+};
 
 /*
 * Implement your game logic in this class. The order of function calls is:
-* 1) Tick
-* 2) Draw
-* 3) RenderGUI
+* 1) PostInput
+* 2) Tick
+* 3) Draw
+* 4) RenderGUI
+* When the simulation runs on its own thread, Tick is called by that thread at its own rate and the other
+* functions by the render thread.
 */
 class Game
 {
 
 private:
-
 	/*
 	* Average time it takes to process a frame.
 	* For debugging purpose only.
 	*/
 	float m_AvgFrameTime = 0.0f;
+	/*
+	* Time spent in each stage of the last frame, in milliseconds. The raster stage is timed separately,
+	* as it runs on the render thread when the simulation has its own.
+	*/
+	float m_StageTimes[(int)FrameStage::COUNT] = {};
+	float m_RasterTime = 0.0f;
 
 	/*
-	* Accelleration structure for particle intersection.
+	* Accelleration structure for particle intersection, stored as a counting-sorted
+	* (CSR) grid. The particles in cell c are m_CellParticles[m_CellStart[c]] up to
+	* (but not including) m_CellParticles[m_CellStart[c + 1]].
+	*/
+	uint* m_CellStart = new uint[GRID_CELLS + 1];
+	/*
+	* Particle indices sorted by cell.
+	*/
+	uint* m_CellParticles = new uint[N_PARTICLES];
+	/*
+	* Cell index of each particle, cached between the histogram and scatter pass.
 	*/
-	uint* m_Grid = new uint[GRID_RESOLUTION * GRID_RESOLUTION * CELL_CAPACITY];
+	uint* m_ParticleCells = new uint[N_PARTICLES];
 
+	/*
+	* Number of frames since the last reorder pass, and the total number of reorder passes.
+	*/
+	int m_FramesSinceReorder = 0, m_ReorderCount = 0;
+	/*
+	* Average index distance between consecutive particles when walking the grid in Z-order. Serves as
+	* a cache-miss proxy for the neighbour loops; it is exactly 1 right after reordering.
+	*/
+	float m_AvgNeighbourDistance = 0.0f;
+	/*
+	* Fraction of consecutive particles in Z-order whose index distance exceeds a cache line.
+	*/
+	float m_NeighbourMissRate = 0.0f;
+	/*
+	* Grid cells in Z-order, m_MortonCells[k] is the row-major index of the cell with Morton code k.
+	*/
+	uint* m_MortonCells = new uint[GRID_CELLS];
+	/*
+	* Scratch buffers holding the new-to-old and old-to-new particle indices while reordering.
+	*/
+	uint* m_ReorderOrder = new uint[N_PARTICLES];
+	uint* m_ReorderRemap = new uint[N_PARTICLES];
+
+	/*
+	* Settings used by the simulation, only accessed by the thread running Tick.
+	*/
+	SimulationSettings m_Settings;
+	/*
+	* Settings edited in the debug window, only accessed by the render thread.
+	*/
+	SimulationSettings m_GuiSettings;
+	/*
+	* Set when m_GuiSettings changed but could not be forwarded yet.
+	*/
+	bool m_SettingsDirty = false;
+	/*
+	* Narrow-phase kernel matching the selected instruction set.
+	*/
+	NarrowPhaseKernel m_NarrowPhase = GetNarrowPhaseKernel(m_Settings.simdLevel);
+	/*
+	* Contact generation kernel matching the selected instruction set.
+	*/
+	ContactKernel m_ContactKernel = GetContactKernel(m_Settings.simdLevel);
+	/*
+	* Narrow-phase kernel over the particles of a cell and its neighbours, nullptr for the scalar narrow phase.
+	*/
+	NarrowPhaseBlockKernel m_NarrowPhaseBlock = GetNarrowPhaseBlockKernel(m_Settings.simdLevel);
+
+	/*
+	* Contacts generated this frame, bucketed by grid row and column colour (y * 3 + x % 3).
+	*/
+	std::vector<Contact> m_Contacts[GRID_RESOLUTION * 3];
+	/*
+	* Number of contacts generated in the last frame.
+	*/
+	uint m_ContactCount = 0;
+	/*
+	* Average time spent generating and resolving contacts, in milliseconds.
+	*/
+	float m_AvgContactGenerationTime = 0.0f, m_AvgContactResolutionTime = 0.0f;
+
+	/*
+	* Set when the Verlet lists match the current grid and particle order.
+	*/
+	bool m_VerletListsValid = false;
+	/*
+	* Verlet lists of the particles in each grid row, indexed by the particle's offset and count below.
+	*/
+	std::vector<uint> m_VerletNeighbours[GRID_RESOLUTION];
+	uint* m_VerletStart = new uint[N_PARTICLES];
+	uint* m_VerletCount = new uint[N_PARTICLES];
+	/*
+	* Predicted particle positions at the time the Verlet lists were built.
+	*/
+	float* m_VerletRefX = new float[N_PARTICLES];
+	float* m_VerletRefY = new float[N_PARTICLES];
+	/*
+	* Total number of Verlet list builds and the fraction of frames that rebuilt the lists.
+	*/
+	int m_VerletRebuildCount = 0;
+	float m_VerletRebuildRate = 0.0f;
+	/*
+	* Average time it takes to rebuild the grid and the Verlet lists, in milliseconds.
+	*/
+	float m_AvgVerletBuildTime = 0.0f;
+	/*
+	* Average time spent in the broad and narrow phase per frame in milliseconds, without and with Verlet lists.
+	*/
+	float m_AvgCollisionPassTime[2] = { 0.0f, 0.0f };
 	/*
 	* Particle data.
 	*/
-	Particle m_Particles[N_PARTICLES];
+	ParticleStore m_Particles = ParticleStore(N_PARTICLES);
+	/*
+	* Particle positions at the start of the last tick, used to interpolate between the last two states when drawing.
+	*/
+	float* m_PrevPosX = new float[N_PARTICLES];
+	float* m_PrevPosY = new float[N_PARTICLES];
+
+	/*
+	* Stages of the last tick, scheduled by the resources they share.
+	*/
+	TaskGraph m_FrameGraph;
+	/*
+	* Frame stage of every task in m_FrameGraph.
+	*/
+	std::vector<FrameStage> m_TaskStages;
+	/*
+	* States handed from the simulation to the renderer. The front buffer is the render snapshot.
+	*/
+	TripleBuffer<SimulationSnapshot> m_Snapshots;
+	/*
+	* Time at which the last snapshot was published.
+	*/
+	std::chrono::steady_clock::time_point m_LastPublish;
+	/*
+	* Number of ticks per second, averaged over several ticks.
+	*/
+	float m_TickRate = 0.0f;
+	/*
+	* Input and settings forwarded from the render thread, applied at the start of the next tick.
+	*/
+	SpscQueue<InputState, 64> m_InputQueue;
+	SpscQueue<SimulationSettings, 16> m_SettingsQueue;
+	/*
+	* Latest input received by the simulation.
+	*/
+	InputState m_Input;
+
+	/*
+	* Rasterize the state captured by Draw during the next tick, alongside the simulation. The screen then
+	* shows the state of the previous frame, so it is off by default. Only used when the simulation runs on
+	* the render thread.
+	*/
+	bool m_PipelinedRaster = false;
+	/*
+	* Set when the render snapshot has not been rasterized yet.
+	*/
+	bool m_RasterPending = false;
+	/*
+	* Interpolation factor used to rasterize the render snapshot.
+	*/
+	float m_RenderAlpha = 1.0f;
+	/*
+	* How the particles are drawn, may be switched at any time.
+	*/
+	RenderBackend m_RenderBackend = RenderBackend::SURFACE;
+#if !HEADLESS_BUILD
+	/*
+	* Draws the particles with the instanced backend, created on first use.
+	*/
+	ParticleRenderer* m_ParticleRenderer = nullptr;
+#endif
+	/*
+	* Rasterize the screen tiles in parallel, otherwise the particles are drawn one after another.
+	*/
+	bool m_BinnedRaster = true;
+	/*
+	* Circles of the particles being rasterized.
+	*/
+	RasterCircle* m_RasterCircles = new RasterCircle[N_PARTICLES];
+	/*
+	* Number of screen tiles in x and y-direction.
+	*/
+	uint m_RasterTilesX = 0, m_RasterTilesY = 0;
+	/*
+	* Particles overlapping every screen tile, stored like the particle grid: the particles of tile t are
+	* m_TileParticles[m_TileStart[t]] up to (but not including) m_TileParticles[m_TileStart[t + 1]].
+	*/
+	uint* m_TileStart = nullptr;
+	std::vector<uint> m_TileParticles;
+	/*
+	* Number of particles per tile while binning, and the next free entry of every tile while scattering.
+	*/
+	std::atomic<uint>* m_TileCursor = nullptr;
+
+#if !HEADLESS_BUILD
+	/*
+	* Simulation on the OpenCL device, only created when selected at startup. When validating, the CPU simulation
+	* stays authoritative and the device repeats every tick from the same state.
+	*/
+	clSimulation* m_clSimulation = nullptr;
+	/*
+	* Particle state read back from the device to compare against the CPU state.
+	*/
+	ParticleStore* m_clParticles = nullptr;
+#endif
+	/*
+	* Largest difference between the device and the CPU state in the last tick, and in any tick so far.
+	*/
+	float m_clPositionError = 0.0f, m_clVelocityError = 0.0f;
+	float m_clMaxPositionError = 0.0f, m_clMaxVelocityError = 0.0f;
 
 	/*
 	* Fill the particle grid.
 	*/
 	void UpdateParticleGrid();
 	/*
+	* Computes the average index distance between consecutive particles in the grid.
+	* Expects an up-to-date grid.
+	*/
+	void UpdateLocalityStats();
+	/*
+	* Sorts the particle data into Morton cell order and remaps the grid to the new indices.
+	* Expects an up-to-date grid.
+	*/
+	void ReorderParticles();
+	/*
 	* Checks for particle collisions and updates particles accordingly.
 	*/
 	void UpdateParticleCollisions(float dt);
+	/*
+	* Generates the contacts of all particles and resolves them afterwards.
+	*/
+	void UpdateParticleContacts(float dt);
+	/*
+	* Checks if a particle has moved too far for the Verlet lists to be valid.
+	*/
+	bool VerletListsExpired(float dt) const;
+	/*
+	* Rebuilds the Verlet lists of all particles. Expects an up-to-date grid.
+	*/
+	void BuildVerletLists(float dt);
+	/*
+	* Builds the Verlet lists of the particles in a single cell.
+	* @param[in] x, y			Cell coordinates.
+	*/
+	void BuildCellVerletLists(int x, int y, float dt);
+	/*
+	* Retrieves the neighbouring cells whose particles are tested against those of a cell.
+	* @param[in] x, y			Cell coordinates.
+	* @param[out] neighbours	Indices of up to four neighbouring cells.
+	* @return					Number of neighbouring cells.
+	*/
+	int GetNeighbourCells(int x, int y, int* neighbours) const;
+	/*
+	* Checks the particles of a single cell for collisions with each other and with the neighbouring cells.
+	* @param[in] x, y			Cell coordinates.
+	* @param[out] contacts		When set, contacts are appended to this buffer instead of being resolved.
+	*/
+	void UpdateCellCollisions(int x, int y, float dt, std::vector<Contact>* contacts = nullptr);
 
 	/*
 	* Apply forces to the particles based on user input.
 	*/
 	void HandleUserInput(float dt);
+	/*
+	* Moves the particles and bounces them off the screen boundaries.
+	*/
+	void IntegrateParticles(float dt);
+
+#if !HEADLESS_BUILD
+	/*
+	* Steps the simulation on the OpenCL device, the particle state stays on the device and is only read back to draw it.
+	*/
+	void TickOpenCL(float dt);
+	/*
+	* Enqueues all stages of a tick on the OpenCL device.
+	*/
+	void EnqueueOpenCLTick(float dt);
+	/*
+	* Reads the state back from the OpenCL device and compares it against the CPU state.
+	*/
+	void CompareOpenCLState();
+#endif
 
 	/*
-	* Checks if two particles collide.
+	* Adds a frame stage to m_FrameGraph.
+	* @param[in] name			Name of the task, must be a string literal.
+	* @param[in] stage			Stage the time of the task counts towards.
+	* @param[in] reads			Resources read by the task.
+	* @param[in] writes			Resources written by the task.
 	*/
-	bool CheckCollision(const Particle& p1, const Particle& p2, float dt);
+	void AddTask(const char* name, FrameStage stage, uint reads, uint writes, std::function<void()> function);
+
 	/*
-	* Resolve collision between two particles.
+	* Applies the input and settings forwarded by the render thread.
 	*/
-	void ResolveCollision(Particle& p1, Particle& p2);
+	void ApplyForwardedState();
+	/*
+	* Copies the particle state into a snapshot.
+	*/
+	void WriteSnapshot(SimulationSnapshot& snapshot);
+	/*
+	* Fills in the statistics of the back buffer and publishes it.
+	* @param[in] dt				Time step of the tick.
+	*/
+	void PublishSnapshot(float dt);
 
 	/*
-	* Draws a particle on the screen.
+	* Swaps in the latest published state to rasterize.
+	* @param[in] alpha			Interpolation factor between the previous and current particle position.
+	*/
+	void CaptureRenderSnapshot(float alpha);
+	/*
+	* Clears the screen and rasterizes the render snapshot.
+	*/
+	void RasterizeSnapshot();
+	/*
+	* Bins the particles into screen tiles and rasterizes every tile on its own job, into memory local to the job.
+	* The particles of a tile are drawn in order, such that the result matches drawing them one after another.
+	* @param[in] snapshot		Particle state.
+	*/
+	void RasterizeBinned(const SimulationSnapshot& snapshot);
+	/*
+	* Computes the circle of a particle at the current interpolation factor.
+	* @param[in] snapshot		Particle state.
+	* @param[in] i				Index of the particle.
+	*/
+	RasterCircle ParticleCircle(const SimulationSnapshot& snapshot, uint i) const;
+	/*
+	* Draws a particle of a snapshot on the screen.
+	* @param[in] snapshot		Particle state.
+	* @param[in] i				Index of the particle.
+	*/
+	void DrawParticle(const SimulationSnapshot& snapshot, uint i);
+#if !HEADLESS_BUILD
+	/*
+	* Uploads the render snapshot and draws it with the instanced backend.
 	*/
-	void DrawParticle(Particle& p);
+	void DrawInstanced();
+#endif
 
 public:
 	/*
@@ -84,6 +553,12 @@ public:
 	*/
 	~Game();
 
+#if !HEADLESS_BUILD
+	/*
+	* Forwards the input of this frame to the simulation. Called by the render thread.
+	*/
+	void PostInput();
+#endif
 	/*
 	* Use the Tick function to implement your game logic.
 	* @param[in] dt				Time since previous Tick call in seconds.
@@ -91,13 +566,88 @@ public:
 	void Tick(float dt);
 	/*
 	* Use the draw function to implement any non-gui related rendering.
-	* @param[in] dt				Time since previous call in seconds.
+	* @param[in] alpha			Fraction of a time step that passed since the last Tick, used to interpolate between the last two states.
+	*							Ignored when the simulation runs on its own thread, the age of the latest state is used instead.
 	*/
-	void Draw(float dt);
+	void Draw(float alpha = 1.0f);
+#if !HEADLESS_BUILD
 	/*
 	* Use the render gui function to implement any gui related rendering using ImGui.
 	* @param[in] dt				Time since previous call in seconds.
 	*/
 	void RenderGUI(float dt);
+#endif
+	/*
+	* Retrieve whether the particles are drawn to the surface, which should then be rendered after Draw.
+	*/
+	bool DrawsToSurface() const { return m_RenderBackend == RenderBackend::SURFACE; }
+	/*
+	* Select how the surface is rasterized, as in the debug window.
+	* @param[in] binned			Rasterize the particles per tile on the JobManager instead of one by one.
+	* @param[in] pipelined		Rasterize the state of the last draw during the next tick instead of right away.
+	*/
+	void SetRasterMode(bool binned, bool pipelined) { m_BinnedRaster = binned, m_PipelinedRaster = pipelined; }
+	/*
+	* Replace the settings of the simulation, as the debug window does. They are applied at the start of the next Tick.
+	* @param[in] settings		New settings.
+	*/
+	void SetSettings(const SimulationSettings& settings) { m_SettingsQueue.Push(settings); }
+	/*
+	* Retrieve the settings used by the simulation. Only safe to call from the thread running Tick.
+	*/
+	const SimulationSettings& Settings() const { return m_Settings; }
+
+	/*
+	* Retrieve the particles. Only safe to call from the thread running Tick.
+	*/
+	const ParticleStore& Particles() const { return m_Particles; }
+	/*
+	* Retrieve the positions of the particles at the start of the last tick, after they were sorted into the grid.
+	*/
+	const float* PreviousPositionsX() const { return m_PrevPosX; }
+	const float* PreviousPositionsY() const { return m_PrevPosY; }
+	/*
+	* Retrieve the grid of the last tick, built from the positions at the start of that tick or, with Verlet lists,
+	* of the tick that last rebuilt the lists. See m_CellStart and m_CellParticles.
+	*/
+	const uint* CellStart() const { return m_CellStart; }
+	const uint* CellParticles() const { return m_CellParticles; }
+
+	/*
+	* Retrieve the time spent in a stage of the last frame.
+	* @param[in] stage			Frame stage.
+	* @returns					Time in milliseconds.
+	*/
+	float StageTime(FrameStage stage) const { return stage == FrameStage::RASTER ? m_RasterTime : m_StageTimes[(int)stage]; }
+	/*
+	* Retrieve the length of the longest chain of dependent stages in the last tick.
+	* @returns					Time in milliseconds.
+	*/
+	float CriticalPath() const { return m_FrameGraph.CriticalPath(); }
+	/*
+	* Retrieve the largest difference in position and velocity between the OpenCL and the CPU simulation over all
+	* ticks so far. Only measured when validating the OpenCL simulation.
+	*/
+	float MaxPositionError() const { return m_clMaxPositionError; }
+	float MaxVelocityError() const { return m_clMaxVelocityError; }
+
+	/*
+	* Times the collision pass over the grid with the narrow phase of the given instruction set, each pass starting
+	* from the current particles, which are left unchanged.
+	* @param[in] level			Instruction set, should not exceed DetectSimdLevel().
+	* @param[in] iterations		Number of timed passes.
+	* @param[in] dt				Time step used to predict the particle positions.
+	* @returns					Average time of a pass in milliseconds.
+	*/
+	float TimeNarrowPhase(SimdLevel level, uint iterations, float dt);
+
+#if !HEADLESS_BUILD
+	/*
+	* Times the host counting sort that fills the grid against the radix sort of clGridBuilder on the initial
+	* particles, checks that both give the same grid and prints the results as JSON.
+	* @param[in] iterations		Number of grids built by each.
+	*/
+	void BenchmarkGridBuild(uint iterations);
+#endif
 };
 
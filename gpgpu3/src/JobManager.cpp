@@ -0,0 +1,396 @@
+#include "stdfax.h"
+#include "JobManager.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() std::this_thread::yield()
+#endif
+
+/* --- Static variable declarations. --- */
+bool JobManager::m_Initialized = false;
+bool JobManager::m_Terminating = false;
+unsigned int JobManager::m_NumWorkerThreads = 0;
+WorkerPlacement JobManager::m_Placement = WorkerPlacement::NONE;
+WorkerThread* JobManager::m_ThreadPool = nullptr;
+JobDeque* JobManager::m_Deques = nullptr;
+std::atomic<unsigned int> JobManager::m_Slots = 0;
+JobArena JobManager::m_Arenas[JOB_MAX_SUBMITTERS];
+std::atomic<unsigned int> JobManager::m_QueuedJobs = 0;
+std::atomic<unsigned int> JobManager::m_SleepingWorkers = 0;
+std::mutex JobManager::m_WakeMutex;
+std::condition_variable JobManager::m_WakeCondition;
+std::shared_mutex JobManager::m_RestartMutex;
+
+#define NO_DEQUE (~0u)
+
+/* Deque owned by the calling thread, NO_DEQUE until a submitter takes a slot. */
+static thread_local unsigned int t_Deque = NO_DEQUE;
+/* Arena of the running job, or of the submitter slot outside of jobs. */
+static thread_local JobArena* t_Arena = nullptr;
+/* State of the random number generator used to pick victims. */
+static thread_local unsigned int t_RandomState = 0;
+/* Set while the calling thread runs jobs, always for the worker threads. */
+static thread_local bool t_Executing = false;
+/* Set while the calling thread holds a JobBatch. */
+static thread_local bool t_InBatch = false;
+
+/*
+* Submitter slot of the calling thread, freed when the thread exits.
+*/
+struct SubmitterSlot {
+	~SubmitterSlot() { if (index != NO_DEQUE) JobManager::ReleaseSlot(index); }
+	unsigned int index = NO_DEQUE;
+};
+static thread_local SubmitterSlot t_Slot;
+
+std::vector<LogicalCore> DetectCpuTopology() {
+	std::vector<LogicalCore> cores;
+
+#ifdef _WIN32
+	// Every processor core entry is a physical core, its mask holds the logical cores.
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length)) {
+		unsigned int physicalCore = 0;
+		for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry : info) {
+			if (entry.Relationship != RelationProcessorCore) continue;
+			unsigned int smtIndex = 0;
+			for (unsigned int bit = 0; bit < sizeof(ULONG_PTR) * 8; bit++)
+				if (entry.ProcessorMask & ((ULONG_PTR)1 << bit)) cores.push_back({ bit, physicalCore, smtIndex++ });
+			physicalCore++;
+		}
+	}
+#else
+	// Logical cores sharing a package and core id are SMT siblings. Cores outside the affinity mask of the process are skipped.
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::map<std::pair<int, int>, std::pair<unsigned int, unsigned int>> physicalCores;	// (package, core) -> (index, siblings)
+	long nConfigured = sysconf(_SC_NPROCESSORS_CONF);
+	for (unsigned int cpu = 0; cpu < (unsigned int)glm::max(nConfigured, 1L); cpu++) {
+		if (restricted && !CPU_ISSET(cpu, &allowed)) continue;
+
+		std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+		std::ifstream coreFile(path + "core_id"), packageFile(path + "physical_package_id");
+		int core = (int)cpu, package = 0;
+		if (coreFile.is_open()) coreFile >> core;
+		if (packageFile.is_open()) packageFile >> package;
+
+		auto physical = physicalCores.insert({ { package, core }, { (unsigned int)physicalCores.size(), 0u } }).first;
+		cores.push_back({ cpu, physical->second.first, physical->second.second++ });
+	}
+#endif
+
+	if (cores.empty())
+		for (unsigned int i = 0; i < glm::max(std::thread::hardware_concurrency(), 1u); i++) cores.push_back({ i, i, 0 });
+
+	std::sort(cores.begin(), cores.end(), [](const LogicalCore& a, const LogicalCore& b) { return a.id < b.id; });
+	return cores;
+}
+
+const char* WorkerPlacementName(WorkerPlacement placement) {
+	switch (placement) {
+	case WorkerPlacement::NONE: return "Unpinned";
+	case WorkerPlacement::LOGICAL: return "Logical cores";
+	case WorkerPlacement::PHYSICAL_FIRST: return "Physical cores first";
+	case WorkerPlacement::PHYSICAL_ONLY: return "Physical cores only";
+	default: return "Unknown";
+	}
+}
+
+JobArena::JobArena(size_t capacity) : m_Memory(new char[capacity]), m_Capacity(capacity), m_Offset(0) {}
+
+JobArena::~JobArena() {
+	delete[] m_Memory;
+}
+
+void* JobArena::Allocate(size_t size, size_t alignment) {
+	size_t offset = m_Offset.load(std::memory_order_relaxed), aligned;
+	do {
+		aligned = (offset + alignment - 1) & ~(alignment - 1);
+		if (aligned + size > m_Capacity) FATAL_ERROR("Job arena exhausted, increase JOB_ARENA_SIZE (%zu bytes).", m_Capacity);
+	} while (!m_Offset.compare_exchange_weak(offset, aligned + size, std::memory_order_relaxed));
+
+	return m_Memory + aligned;
+}
+
+void JobArena::Reset() {
+	m_Peak = glm::max(m_Peak, m_Offset.load(std::memory_order_relaxed));
+	m_Offset.store(0, std::memory_order_relaxed);
+}
+
+JobDeque::JobDeque() : m_Top(0), m_Bottom(0), m_Buffer(new Buffer(256)) {}
+
+JobDeque::~JobDeque() {
+	delete m_Buffer.load();
+	for (Buffer* buffer : m_Retired) delete buffer;
+}
+
+void JobDeque::Push(Job* job) {
+	int64_t b = m_Bottom.load(std::memory_order_relaxed);
+	int64_t t = m_Top.load(std::memory_order_acquire);
+	Buffer* buffer = m_Buffer.load(std::memory_order_relaxed);
+
+	// Grow the buffer when it is full.
+	if (b - t > buffer->capacity - 1) {
+		Buffer* grown = new Buffer(buffer->capacity * 2);
+		for (int64_t i = t; i < b; i++) grown->Put(i, buffer->Get(i));
+		m_Retired.push_back(buffer);
+		m_Buffer.store(grown, std::memory_order_release);
+		buffer = grown;
+	}
+
+	// Publish the job, and the data it refers to, to the thieves.
+	buffer->Put(b, job);
+	m_Bottom.store(b + 1, std::memory_order_release);
+}
+
+Job* JobDeque::Take() {
+	int64_t b = m_Bottom.load(std::memory_order_relaxed) - 1;
+	Buffer* buffer = m_Buffer.load(std::memory_order_relaxed);
+	m_Bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = m_Top.load(std::memory_order_relaxed);
+
+	// Empty.
+	if (t > b) {
+		m_Bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = buffer->Get(b);
+	if (t == b) {
+		// Last job, race the thieves for it.
+		if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) job = nullptr;
+		m_Bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* JobDeque::Steal() {
+	int64_t t = m_Top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = m_Bottom.load(std::memory_order_acquire);
+	if (t >= b) return nullptr;
+
+	Job* job = m_Buffer.load(std::memory_order_acquire)->Get(t);
+	if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+	return job;
+}
+
+void JobManager::Initialize(unsigned int numWorkers, WorkerPlacement placement) {
+	if (m_Initialized) return;
+
+	// Order in which the workers are pinned to logical cores.
+	std::vector<LogicalCore> cores = DetectCpuTopology();
+	if (placement == WorkerPlacement::PHYSICAL_FIRST || placement == WorkerPlacement::PHYSICAL_ONLY)
+		std::stable_sort(cores.begin(), cores.end(), [](const LogicalCore& a, const LogicalCore& b) { return a.smtIndex < b.smtIndex; });
+	if (placement == WorkerPlacement::PHYSICAL_ONLY)
+		cores.erase(std::remove_if(cores.begin(), cores.end(), [](const LogicalCore& c) { return c.smtIndex > 0; }), cores.end());
+
+	// The main thread runs jobs as well, so it takes one of the cores by default.
+	m_NumWorkerThreads = numWorkers > 0 ? numWorkers : glm::max((unsigned int)cores.size(), 2u) - 1;
+	m_Placement = placement;
+
+	// The submitters keep their slots, and with that their deques, across restarts.
+	m_Deques = new JobDeque[JOB_MAX_SUBMITTERS + m_NumWorkerThreads];
+	m_QueuedJobs = 0, m_SleepingWorkers = 0;
+	m_Terminating = false;
+
+	// Initialize the worker threads. With more workers than cores, the cores are assigned round-robin.
+	m_ThreadPool = new WorkerThread[m_NumWorkerThreads];
+	for (unsigned int t = 0; t < m_NumWorkerThreads; t++)
+		m_ThreadPool[t].Initialize(t, placement == WorkerPlacement::NONE ? -1 : (int)cores[t % cores.size()].id);
+
+	m_Initialized = true;
+}
+
+void JobManager::Terminate() {
+	if (!JobManager::m_Initialized) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_WakeMutex);
+		m_Terminating = true;
+	}
+	m_WakeCondition.notify_all();
+	for (unsigned int t = 0; t < m_NumWorkerThreads; t++) m_ThreadPool[t].m_Thread.join();
+
+	delete[] m_ThreadPool;
+	delete[] m_Deques;
+	m_ThreadPool = nullptr, m_Deques = nullptr;
+
+	m_Initialized = false;
+}
+
+void JobManager::Restart(unsigned int numWorkers, WorkerPlacement placement) {
+	// Keep other threads from queueing jobs while there are no workers.
+	std::unique_lock<std::shared_mutex> lock(m_RestartMutex);
+	Terminate();
+	Initialize(numWorkers, placement);
+}
+
+unsigned int JobManager::AcquireSlot() {
+	unsigned int slots = m_Slots.load(std::memory_order_relaxed);
+	while (true) {
+		if (slots == (1u << JOB_MAX_SUBMITTERS) - 1) FATAL_ERROR("More than %d threads queue jobs, increase JOB_MAX_SUBMITTERS.", JOB_MAX_SUBMITTERS);
+		unsigned int slot = 0;
+		while (slots & (1u << slot)) slot++;
+		if (m_Slots.compare_exchange_weak(slots, slots | (1u << slot), std::memory_order_acquire, std::memory_order_relaxed)) return slot;
+	}
+}
+
+void JobManager::ReleaseSlot(unsigned int slot) {
+	// The next thread taking the slot starts with an empty arena.
+	m_Arenas[slot].Reset();
+	m_Slots.fetch_and(~(1u << slot), std::memory_order_release);
+}
+
+unsigned int JobManager::ThreadDeque() {
+	if (t_Deque != NO_DEQUE) return t_Deque;
+
+	t_Slot.index = AcquireSlot();
+	t_Deque = t_Slot.index, t_Arena = &m_Arenas[t_Slot.index];
+	t_RandomState = t_Slot.index + 1;
+	return t_Deque;
+}
+
+JobArena& JobManager::ThreadArena() {
+	if (!t_Arena) ThreadDeque();
+	return *t_Arena;
+}
+
+void JobManager::QueueJob(Job* job) {
+	// Jobs go to the deque of the queueing thread and take the arena of the batch along.
+	job->m_Arena = &ThreadArena();
+	m_QueuedJobs.fetch_add(1, std::memory_order_seq_cst);
+	m_Deques[ThreadDeque()].Push(job);
+
+	// Wake a worker if any are asleep. Taking the lock makes sure that a worker that has not found this job
+	// is waiting on the condition when notified, the job count and the sleeping workers are ordered such
+	// that a worker going to sleep either sees the job or is seen here.
+	if (m_SleepingWorkers.load(std::memory_order_seq_cst) > 0) {
+		{ std::lock_guard<std::mutex> lock(m_WakeMutex); }
+		m_WakeCondition.notify_one();
+	}
+}
+
+Job* JobManager::StealJob(unsigned int deque) {
+	unsigned int nDeques = JOB_MAX_SUBMITTERS + m_NumWorkerThreads;
+
+	// Start at a random victim and try every other deque once.
+	t_RandomState ^= t_RandomState << 13, t_RandomState ^= t_RandomState >> 17, t_RandomState ^= t_RandomState << 5;
+	unsigned int victim = t_RandomState % nDeques;
+	for (unsigned int i = 0; i < nDeques; i++, victim = (victim + 1) % nDeques) {
+		if (victim == deque) continue;
+		if (Job* job = m_Deques[victim].Steal()) return job;
+	}
+	return nullptr;
+}
+
+bool JobManager::RunJob(unsigned int deque) {
+	// Submitters leave the jobs of other submitters to the workers.
+	Job* job = m_Deques[deque].Take();
+	if (!job && deque >= JOB_MAX_SUBMITTERS) job = StealJob(deque);
+	if (!job) return false;
+	m_QueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+	// The jobs queued by this job belong to the same batch.
+	JobArena* arena = t_Arena;
+	bool executing = t_Executing;
+	t_Arena = job->m_Arena, t_Executing = true;
+	{
+		PROFILE_SCOPE("Job");
+		job->Execute();
+	}
+	t_Arena = arena, t_Executing = executing;
+	return true;
+}
+
+void JobManager::RunJobs(unsigned int deque) {
+	// Spin for a while before going to sleep, as the next jobs tend to follow shortly.
+	for (unsigned int idle = 0; idle < JOB_IDLE_SPINS; ) {
+		if (RunJob(deque)) idle = 0;
+		else idle++, CPU_RELAX();
+	}
+}
+
+void JobManager::Wait(const std::atomic<unsigned int>& counter) {
+	// Keep this thread busy until the jobs it waits on have finished.
+	unsigned int deque = ThreadDeque();
+	while (counter.load(std::memory_order_acquire) > 0)
+		if (!RunJob(deque)) CPU_RELAX();
+}
+
+void JobManager::NewFrame() {
+	ThreadArena().Reset();
+}
+
+JobBatch::JobBatch() : m_Owner(!t_Executing && !t_InBatch) {
+	if (!m_Owner) return;
+
+	JobManager::m_RestartMutex.lock_shared();
+	t_InBatch = true;
+}
+
+JobBatch::~JobBatch() {
+	if (!m_Owner) return;
+
+	t_InBatch = false;
+	JobManager::m_RestartMutex.unlock_shared();
+}
+
+void WorkerThread::Initialize(unsigned int index, int lCoreID) {
+	// Set before the thread starts, as it names itself after its core.
+	m_Index = index, m_LogicalCoreID = lCoreID;
+	m_Thread = std::thread(&WorkerThread::Run, this);
+	if (lCoreID < 0) return;
+
+	// Pin thread to a single core.
+#ifdef _WIN32
+	SetThreadAffinityMask((HANDLE)m_Thread.native_handle(), (DWORD_PTR)(1) << lCoreID);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(lCoreID, &set);
+	pthread_setaffinity_np(m_Thread.native_handle(), sizeof(cpu_set_t), &set);
+#endif
+}
+
+void WorkerThread::Run() {
+	std::string name = "Worker " + std::to_string(m_Index);
+	if (m_LogicalCoreID >= 0) name += " (core " + std::to_string(m_LogicalCoreID) + ")";
+	Profiler::SetThreadName(name.c_str());
+	t_Deque = JOB_MAX_SUBMITTERS + m_Index, t_RandomState = t_Deque + 1;
+	t_Executing = true;
+
+	while (true) {
+		{
+			// Sleep until jobs are queued.
+			std::unique_lock<std::mutex> lock(JobManager::m_WakeMutex);
+			JobManager::m_SleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+			JobManager::m_WakeCondition.wait(lock, [] { return JobManager::m_QueuedJobs.load(std::memory_order_seq_cst) > 0 || JobManager::m_Terminating; });
+			JobManager::m_SleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+			if (JobManager::m_Terminating) return;
+		}
+
+		{
+			// Time from waking up until no jobs are left, the gaps between jobs are scheduling overhead.
+			PROFILE_SCOPE("Worker");
+			JobManager::RunJobs(t_Deque);
+		}
+	}
+}
@@ -0,0 +1,449 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <type_traits>
+
+class JobArena;
+
+class Job {
+
+public:
+	virtual void Execute() = 0;
+
+private:
+	/* Befriend the JobManager. */
+	friend class JobManager;
+	/* Arena of the thread that queued the batch, which the jobs this job queues allocate from as well. */
+	JobArena* m_Arena = nullptr;
+};
+
+/*
+* Chase-Lev work-stealing deque. Only the owning thread pushes and takes jobs at the bottom, any other
+* thread may steal jobs from the top. The buffer grows when full, so there is no limit on the number of jobs.
+*/
+class JobDeque {
+
+public:
+	JobDeque();
+	~JobDeque();
+
+	/* Adds a job at the bottom. Owner only.
+	* @param[in] job		Pointer to a valid Job object.
+	*/
+	void Push(Job* job);
+	/* Takes the most recently pushed job. Owner only.
+	* @returns		A job, or nullptr if the deque is empty.
+	*/
+	Job* Take();
+	/* Steals the oldest job. Safe to call from any thread.
+	* @returns		A job, or nullptr if the deque is empty or another thread won the race.
+	*/
+	Job* Steal();
+
+private:
+	/* Circular array of jobs. */
+	struct Buffer {
+		Buffer(int64_t capacity) : capacity(capacity), jobs(new std::atomic<Job*>[capacity]) {}
+		~Buffer() { delete[] jobs; }
+
+		Job* Get(int64_t i) { return jobs[i & (capacity - 1)].load(std::memory_order_relaxed); }
+		void Put(int64_t i, Job* job) { jobs[i & (capacity - 1)].store(job, std::memory_order_relaxed); }
+
+		int64_t capacity;
+		std::atomic<Job*>* jobs;
+	};
+
+	/* Index of the oldest and one past the newest job. */
+	std::atomic<int64_t> m_Top, m_Bottom;
+	std::atomic<Buffer*> m_Buffer;
+	/* Buffers replaced by a larger one, thieves may still read from them so they live as long as the deque. */
+	std::vector<Buffer*> m_Retired;
+};
+
+#define JOB_ARENA_SIZE (1 << 20)	// Bytes available to the jobs of a single frame.
+#define JOB_MIN_GRAIN 256			// Minimum number of iterations per job when the grain size is chosen automatically.
+#define JOBS_PER_THREAD 4			// Number of jobs per thread a loop is split into when the grain size is chosen automatically.
+#define JOB_MAX_SUBMITTERS 8		// Maximum number of threads outside the job system that queue jobs at the same time.
+#define JOB_IDLE_SPINS 1024			// Number of times a worker looks for a job before it goes to sleep.
+
+/*
+* Linear allocator for jobs and their scratch data. Nothing is freed individually, the whole arena is reset
+* once per frame, so the data-parallel loops below never touch the heap.
+*/
+class JobArena {
+
+public:
+	/* Initializes the JobArena.
+	* @param[in] capacity		Size of the arena in bytes.
+	*/
+	JobArena(size_t capacity = JOB_ARENA_SIZE);
+	~JobArena();
+
+	/* Allocates uninitialized memory. Safe to call from any thread.
+	* @param[in] size			Size of the allocation in bytes.
+	* @param[in] alignment		Alignment of the allocation, must be a power of two.
+	* @returns					Pointer to the allocation, valid until the next call to Reset().
+	*/
+	void* Allocate(size_t size, size_t alignment);
+	/* Frees all allocations. No job may be running. */
+	void Reset();
+
+	/* Retrieve the largest number of bytes allocated in between two resets. */
+	size_t Peak() const { return m_Peak; }
+
+private:
+	char* m_Memory;
+	size_t m_Capacity;
+	/* Offset of the first free byte. */
+	std::atomic<size_t> m_Offset;
+	size_t m_Peak = 0;
+};
+
+/*
+* A logical core (hardware thread) and the physical core it belongs to.
+*/
+struct LogicalCore {
+	/* OS index of the logical core, as used for the affinity mask. */
+	unsigned int id;
+	/* Index of the physical core. */
+	unsigned int physicalCore;
+	/* Index among the logical cores of the same physical core, 0 for the first hardware thread. */
+	unsigned int smtIndex;
+};
+
+/*
+* Detects the logical cores of the system and how they map to physical cores. Falls back to one
+* physical core per logical core when the topology cannot be read.
+* @returns		Logical cores, sorted by id.
+*/
+std::vector<LogicalCore> DetectCpuTopology();
+
+/*
+* How the worker threads are pinned to cores.
+*/
+enum class WorkerPlacement {
+	/* Do not pin the workers, the OS schedules them. */
+	NONE = 0,
+	/* One worker per logical core, in logical core order. */
+	LOGICAL,
+	/* Use the first hardware thread of every physical core before using their SMT siblings. */
+	PHYSICAL_FIRST,
+	/* At most one worker per physical core, SMT siblings stay idle. */
+	PHYSICAL_ONLY
+};
+
+/*
+* Retrieves a human-readable name for a worker placement.
+*/
+const char* WorkerPlacementName(WorkerPlacement placement);
+
+class WorkerThread {
+
+public:
+	/* Initializes the WorkerThread.
+	* @param[in] index			Index of the worker, its deque follows the deques of the submitters.
+	* @param[in] lCoreID		ID of the logical core to which the thread is pinned, -1 to leave it unpinned.
+	*/
+	void Initialize(unsigned int index, int lCoreID);
+	/* Starts the thread's main-loop. */
+	void Run();
+
+private:
+	/* Befriend the JobManager. */
+	friend class JobManager;
+	/* Index of the worker. */
+	unsigned int m_Index;
+	/* ID of the logical core on which the thread is processed, -1 if not pinned. */
+	int m_LogicalCoreID;
+	/* The thread object. */
+	std::thread m_Thread;
+};
+
+/*
+* Job manager (Singleton) who manages the multithreaded job-system.
+* Every worker owns a work-stealing deque, as does every thread outside the job system that queues jobs (a
+* submitter). A submitter takes one of JOB_MAX_SUBMITTERS slots on first use, with its own deque and job arena,
+* so submitters never wait on each other. Jobs go to the deque of the thread that queues them. Workers steal
+* from a random other deque when theirs runs dry, and sleep once no jobs are left. A submitter only runs the
+* jobs on its own deque, so it never ends up running a long job of another submitter.
+* Based on Jacco Bikker's template (https://github.com/jbikker/tmpl8).
+*/
+class JobManager {
+
+public:
+	/* Initializes the JobManager. Returns if previously initialized.
+	* @param[in] numWorkers		Number of worker threads, 0 for one less than the number of cores the placement uses,
+	*							since the main thread runs jobs as well.
+	* @param[in] placement		How the workers are pinned to cores.
+	*/
+	static void Initialize(unsigned int numWorkers = 0, WorkerPlacement placement = WorkerPlacement::PHYSICAL_FIRST);
+	/* Terminates the JobManager and joins the worker threads. Returns if not previously initialized. */
+	static void Terminate();
+	/* Restarts the JobManager with a different number of workers or placement. May be called from any thread
+	* that is not running a job or holding a JobBatch, it waits until the batches of the other threads have
+	* finished, after which these wait until the restart has finished before starting a new batch.
+	*/
+	static void Restart(unsigned int numWorkers, WorkerPlacement placement);
+
+	/* Retrieve the number of worker threads. */
+	static unsigned int NumWorkerThreads() { return m_NumWorkerThreads; }
+	/* Retrieve how the worker threads are pinned to cores. */
+	static WorkerPlacement Placement() { return m_Placement; }
+
+	/* Add a new Job to the Job pool.
+	* @param[in] job		Pointer to a valid Job object.
+	*/
+	static void QueueJob(Job* job);
+
+	/* Waits until the given counter reaches zero. The calling thread runs the jobs on its own deque in the meantime,
+	* a worker steals jobs as well, so jobs may wait on the jobs they queued.
+	* @param[in] counter	Counter decremented by the jobs that are waited on.
+	*/
+	static void Wait(const std::atomic<unsigned int>& counter);
+
+	/* Marks the start of a new frame and frees all memory allocated from the job arena of the calling thread.
+	* None of the jobs the calling thread queued may be running. The arenas of other threads are left alone. */
+	static void NewFrame();
+	/* Allocates uninitialized memory from the job arena of the calling thread, or of the thread that queued the
+	* running job, which lives until the next call to NewFrame() on that thread.
+	* @param[in] count		Number of objects.
+	* @returns				Pointer to the first object.
+	*/
+	template <typename T>
+	static T* Allocate(unsigned int count = 1) { return (T*)ThreadArena().Allocate(sizeof(T) * count, alignof(T)); }
+	/* Retrieve the job arena of the calling thread. */
+	static const JobArena& Arena() { return ThreadArena(); }
+
+private:
+	/* Befriend the worker threads, the batch lock and the slot release on thread exit. */
+	friend class WorkerThread;
+	friend class JobBatch;
+	friend struct SubmitterSlot;
+
+	/* Runs a single job from the caller's deque, a worker steals one from another deque when its own is empty.
+	* @param[in] deque		Index of the deque owned by the calling thread.
+	* @returns				False if no job was found.
+	*/
+	static bool RunJob(unsigned int deque);
+	/* Runs and steals jobs until none have been found for JOB_IDLE_SPINS attempts. Workers only.
+	* @param[in] deque		Index of the deque owned by the calling thread.
+	*/
+	static void RunJobs(unsigned int deque);
+	/* Steals a job from a random deque other than the caller's.
+	* @param[in] deque		Index of the deque owned by the calling thread.
+	* @returns				A job, or nullptr if none was found.
+	*/
+	static Job* StealJob(unsigned int deque);
+	/* Retrieve the deque owned by the calling thread, taking a submitter slot on first use. */
+	static unsigned int ThreadDeque();
+	/* Retrieve the arena the calling thread allocates from, taking a submitter slot on first use. */
+	static JobArena& ThreadArena();
+	/* Takes a free submitter slot for the calling thread. */
+	static unsigned int AcquireSlot();
+	/* Frees the slot of a thread that exits.
+	* @param[in] slot		Index of the slot.
+	*/
+	static void ReleaseSlot(unsigned int slot);
+
+	/* True if Initialize() was called. */
+	static bool m_Initialized;
+	/* Number of worker-threads. */
+	static unsigned int m_NumWorkerThreads;
+	/* How the worker threads are pinned to cores. */
+	static WorkerPlacement m_Placement;
+	/* Pool of worker threads. */
+	static WorkerThread* m_ThreadPool;
+	/* One deque per submitter slot, followed by one deque per worker thread. */
+	static JobDeque* m_Deques;
+
+	/* Bit s is set while submitter slot s is taken. */
+	static std::atomic<unsigned int> m_Slots;
+	/* Memory of the jobs queued by every submitter slot. */
+	static JobArena m_Arenas[JOB_MAX_SUBMITTERS];
+
+	/* Number of jobs queued that no thread has taken yet. */
+	static std::atomic<unsigned int> m_QueuedJobs;
+	/* Number of worker threads that are asleep, or about to be. */
+	static std::atomic<unsigned int> m_SleepingWorkers;
+
+	/* Parking of the worker threads while no jobs are queued. */
+	static std::mutex m_WakeMutex;
+	static std::condition_variable m_WakeCondition;
+	/* Set to let the worker threads exit. */
+	static bool m_Terminating;
+	/* Held shared by every JobBatch and exclusively by Restart(). */
+	static std::shared_mutex m_RestartMutex;
+};
+
+/*
+* Keeps Restart() from replacing the workers while a thread outside the job system queues jobs and waits on them.
+* The batches of different threads run at the same time, each on the deque of its own thread. Does nothing when
+* created from within a job or when the thread already holds a batch. A thread that never restarts the JobManager
+* while another uses it may queue and wait on jobs without a batch.
+*/
+class JobBatch {
+
+public:
+	JobBatch();
+	~JobBatch();
+	JobBatch(const JobBatch&) = delete;
+	JobBatch& operator=(const JobBatch&) = delete;
+
+private:
+	/* True if this batch took the shared lock. */
+	bool m_Owner;
+};
+
+/*
+* Job processing a contiguous chunk of a data-parallel loop.
+*/
+template <typename Body>
+class ChunkJob : public Job {
+
+public:
+	ChunkJob(const Body* body, unsigned int chunk, unsigned int first, unsigned int last, std::atomic<unsigned int>* pending)
+		: m_Body(body), m_Chunk(chunk), m_First(first), m_Last(last), m_Pending(pending) {}
+
+	void Execute() override {
+		(*m_Body)(m_Chunk, m_First, m_Last);
+		m_Pending->fetch_sub(1, std::memory_order_release);
+	}
+
+private:
+	/* Owned by the caller, which waits until all chunks have finished. */
+	const Body* m_Body;
+	unsigned int m_Chunk, m_First, m_Last;
+	std::atomic<unsigned int>* m_Pending;
+};
+
+/*
+* Retrieve the number of iterations per job.
+* @param[in] count			Number of iterations of the loop.
+* @param[in] grain			Requested number of iterations per job, 0 to split the loop into a few jobs per thread
+*							(but no fewer than JOB_MIN_GRAIN iterations each) so that stealing can balance uneven work.
+*/
+inline unsigned int JobGrainSize(unsigned int count, unsigned int grain) {
+	if (grain > 0) return grain;
+	unsigned int nJobs = (JobManager::NumWorkerThreads() + 1) * JOBS_PER_THREAD;
+	return glm::max((count + nJobs - 1) / nJobs, (unsigned int)JOB_MIN_GRAIN);
+}
+
+/*
+* Splits [first, last) into chunks of grain iterations, calls body(chunk, begin, end) for every chunk on the
+* JobManager and waits until all chunks have finished. A single chunk runs on the calling thread.
+* @returns					Number of chunks.
+*/
+template <typename Body>
+unsigned int ParallelChunks(unsigned int first, unsigned int last, unsigned int grain, const Body& body) {
+	if (last <= first) return 0;
+	JobBatch batch;
+	unsigned int nChunks = (last - first + grain - 1) / grain;
+	if (nChunks == 1) {
+		body(0u, first, last);
+		return 1;
+	}
+
+	std::atomic<unsigned int> pending(nChunks);
+	ChunkJob<Body>* jobs = JobManager::Allocate<ChunkJob<Body>>(nChunks);
+	for (unsigned int c = 0; c < nChunks; c++) {
+		unsigned int begin = first + c * grain;
+		JobManager::QueueJob(new (&jobs[c]) ChunkJob<Body>(&body, c, begin, glm::min(begin + grain, last), &pending));
+	}
+	JobManager::Wait(pending);
+	return nChunks;
+}
+
+/*
+* Calls body(i) for every i in [first, last) on the JobManager and waits until all iterations have finished.
+* @param[in] grain			Number of iterations per job, 0 to choose automatically.
+*/
+template <typename Body>
+void ParallelFor(unsigned int first, unsigned int last, unsigned int grain, const Body& body) {
+	auto chunk = [&body](unsigned int, unsigned int begin, unsigned int end) {
+		for (unsigned int i = begin; i < end; i++) body(i);
+	};
+	JobBatch batch;
+	ParallelChunks(first, last, JobGrainSize(last - first, grain), chunk);
+}
+
+/*
+* Combines map(i) for every i in [first, last) on the JobManager. Every chunk is reduced on its own, after which
+* the partial results are combined in order, so the result only depends on the grain size.
+* @param[in] grain			Number of iterations per job, 0 to choose automatically.
+* @param[in] identity		Identity of combine.
+* @param[in] map			Value of a single iteration, T map(unsigned int i).
+* @param[in] combine		Associative operator, T combine(T a, T b).
+* @returns					Combined value, identity for an empty range.
+*/
+template <typename T, typename Map, typename Combine>
+T ParallelReduce(unsigned int first, unsigned int last, unsigned int grain, T identity, const Map& map, const Combine& combine) {
+	static_assert(std::is_trivially_destructible<T>::value, "Partial results live in the job arena and are never destroyed.");
+	if (last <= first) return identity;
+
+	JobBatch batch;
+	grain = JobGrainSize(last - first, grain);
+	T* partials = JobManager::Allocate<T>((last - first + grain - 1) / grain);
+	auto chunk = [&](unsigned int c, unsigned int begin, unsigned int end) {
+		T value = identity;
+		for (unsigned int i = begin; i < end; i++) value = combine(value, map(i));
+		partials[c] = value;
+	};
+	unsigned int nChunks = ParallelChunks(first, last, grain, chunk);
+
+	T result = identity;
+	for (unsigned int c = 0; c < nChunks; c++) result = combine(result, partials[c]);
+	return result;
+}
+
+/*
+* Exclusive scan on the JobManager: output[i] is the combination of input[0] up to (but not including) input[i].
+* The chunks are reduced in parallel, the chunk totals are scanned on the calling thread, after which every chunk
+* scans its own elements starting from its total. Input and output may be the same array.
+* @param[in] count			Number of elements.
+* @param[in] grain			Number of elements per job, 0 to choose automatically.
+* @param[in] identity		Identity of combine.
+* @param[in] combine		Associative operator, T combine(T a, T b).
+* @returns					Combination of all elements.
+*/
+template <typename T, typename Combine>
+T ParallelScan(const T* input, T* output, unsigned int count, unsigned int grain, T identity, const Combine& combine) {
+	static_assert(std::is_trivially_destructible<T>::value, "Partial results live in the job arena and are never destroyed.");
+	if (count == 0) return identity;
+
+	JobBatch batch;
+	grain = JobGrainSize(count, grain);
+	unsigned int nChunks = (count + grain - 1) / grain;
+	T* offsets = JobManager::Allocate<T>(nChunks);
+
+	// Reduce every chunk.
+	ParallelChunks(0u, count, grain, [&](unsigned int c, unsigned int begin, unsigned int end) {
+		T value = identity;
+		for (unsigned int i = begin; i < end; i++) value = combine(value, input[i]);
+		offsets[c] = value;
+	});
+
+	// Scan the chunk totals.
+	T total = identity;
+	for (unsigned int c = 0; c < nChunks; c++) {
+		T value = offsets[c];
+		offsets[c] = total;
+		total = combine(total, value);
+	}
+
+	// Scan every chunk, reading each element before it is overwritten.
+	ParallelChunks(0u, count, grain, [&](unsigned int c, unsigned int begin, unsigned int end) {
+		T value = offsets[c];
+		for (unsigned int i = begin; i < end; i++) {
+			T element = input[i];
+			output[i] = value;
+			value = combine(value, element);
+		}
+	});
+
+	return total;
+}
@@ -0,0 +1,72 @@
+#include "stdfax.h"
+#include "ParticleRenderer.h"
+#include "Profiler.h"
+
+ParticleRenderer::ParticleRenderer(uint count) : m_Count(count)
+{
+	m_Shader = new GLshader("particle_circle.vert", "particle_circle.frag");
+
+	m_CornerBuffer = new GLbuffer(GL_ARRAY_BUFFER, sizeof(c_Corners));
+	m_CornerBuffer->Write(sizeof(c_Corners), c_Corners, GL_STATIC_DRAW);
+	m_IndexBuffer = new GLbuffer(GL_ELEMENT_ARRAY_BUFFER, sizeof(c_Indices));
+	m_IndexBuffer->Write(sizeof(c_Indices), c_Indices, GL_STATIC_DRAW);
+
+	m_PrevX = new GLbuffer(GL_ARRAY_BUFFER, sizeof(float) * count);
+	m_PrevY = new GLbuffer(GL_ARRAY_BUFFER, sizeof(float) * count);
+	m_PosX = new GLbuffer(GL_ARRAY_BUFFER, sizeof(float) * count);
+	m_PosY = new GLbuffer(GL_ARRAY_BUFFER, sizeof(float) * count);
+	m_Radius = new GLbuffer(GL_ARRAY_BUFFER, sizeof(float) * count);
+	m_Color = new GLbuffer(GL_ARRAY_BUFFER, sizeof(uint) * count);
+
+	// The quad advances every vertex, the particle state once per instance.
+	m_Shader->SetBufferFloat2(m_CornerBuffer, 0);
+	m_Shader->SetBufferFloat1(m_PrevX, 1);
+	m_Shader->SetBufferFloat1(m_PrevY, 2);
+	m_Shader->SetBufferFloat1(m_PosX, 3);
+	m_Shader->SetBufferFloat1(m_PosY, 4);
+	m_Shader->SetBufferFloat1(m_Radius, 5);
+	m_Shader->SetBufferColor(m_Color, 6);
+	for (uint idx = 1; idx <= 6; idx++) m_Shader->SetDivisor(idx, 1);
+}
+
+ParticleRenderer::~ParticleRenderer()
+{
+	delete m_CornerBuffer;
+	delete m_IndexBuffer;
+	delete m_PrevX;
+	delete m_PrevY;
+	delete m_PosX;
+	delete m_PosY;
+	delete m_Radius;
+	delete m_Color;
+	delete m_Shader;
+}
+
+void ParticleRenderer::Upload(const float* prevX, const float* prevY, const float* posX, const float* posY, const float* radius, const uint* color)
+{
+	PROFILE_SCOPE("UploadParticles");
+
+	size_t size = sizeof(float) * m_Count;
+	m_PrevX->Write(size, prevX, GL_STREAM_DRAW);
+	m_PrevY->Write(size, prevY, GL_STREAM_DRAW);
+	m_PosX->Write(size, posX, GL_STREAM_DRAW);
+	m_PosY->Write(size, posY, GL_STREAM_DRAW);
+	m_Radius->Write(size, radius, GL_STREAM_DRAW);
+	m_Color->Write(sizeof(uint) * m_Count, color, GL_STREAM_DRAW);
+}
+
+void ParticleRenderer::Draw(float alpha, uint width, uint height)
+{
+	PROFILE_SCOPE("DrawParticles");
+
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	m_Shader->SetUniformFloat("alpha", alpha);
+	m_Shader->SetUniformVec2("renderSize", glm::vec2((float)width, (float)height));
+
+	// Instances are drawn in order, so overlapping particles end up with the same colour as on the CPU.
+	m_Shader->Activate();
+	m_Shader->DrawTrianglesInstanced(6, m_Count, m_IndexBuffer, GL_UNSIGNED_INT);
+	m_Shader->Deactivate();
+}
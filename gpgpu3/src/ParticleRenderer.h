@@ -0,0 +1,62 @@
+#pragma once
+#include "Template/Shader.h"
+
+/*
+* Draws the particles on the GPU as instanced quads, cut to circles by the fragment shader. Only the particle
+* state is uploaded every frame, instead of all pixels of the surface. The circles cover exactly the pixels the
+* CPU rasterizer fills, when the window has the size of the surface.
+*/
+class ParticleRenderer
+{
+public:
+	/*
+	* Creates the shader and the buffers. Requires an OpenGL context.
+	* @param[in] count			Number of particles.
+	*/
+	ParticleRenderer(uint count);
+	~ParticleRenderer();
+
+	/*
+	* Streams the particle state to the GPU. The buffers are orphaned, so the previous draw is not waited for.
+	* @param[in] prevX, prevY	Positions at the start of the tick.
+	* @param[in] posX, posY		Positions at the end of the tick.
+	* @param[in] radius			Radii in pixels.
+	* @param[in] color			Colors packed as 0xRRGGBBAA.
+	*/
+	void Upload(const float* prevX, const float* prevY, const float* posX, const float* posY, const float* radius, const uint* color);
+	/*
+	* Clears the default framebuffer to black, like the cleared surface, and draws the uploaded particles.
+	* @param[in] alpha			Interpolation factor between the previous and the current positions.
+	* @param[in] width, height	Size of the surface the positions refer to.
+	*/
+	void Draw(float alpha, uint width, uint height);
+
+	/*
+	* Retrieve the number of bytes uploaded per frame.
+	*/
+	size_t UploadSize() const { return m_Count * (5 * sizeof(float) + sizeof(uint)); }
+
+private:
+	uint m_Count;
+
+	GLshader* m_Shader = nullptr;
+	/* Corners and indices of the quad every particle is drawn with. */
+	GLbuffer* m_CornerBuffer = nullptr;
+	GLbuffer* m_IndexBuffer = nullptr;
+	/* Particle state, one buffer per array of the snapshot. */
+	GLbuffer* m_PrevX = nullptr, * m_PrevY = nullptr;
+	GLbuffer* m_PosX = nullptr, * m_PosY = nullptr;
+	GLbuffer* m_Radius = nullptr;
+	GLbuffer* m_Color = nullptr;
+
+	const GLfloat c_Corners[8] = {
+		0.0f, 0.0f,
+		1.0f, 0.0f,
+		1.0f, 1.0f,
+		0.0f, 1.0f
+	};
+
+	const GLuint c_Indices[6] = {
+		0, 1, 2, 2, 3, 0
+	};
+};
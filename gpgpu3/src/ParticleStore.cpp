@@ -0,0 +1,92 @@
+#include "stdfax.h"
+#include "ParticleStore.h"
+
+#include <cstdlib>
+
+#define PARTICLE_ALIGNMENT 64
+
+/*
+* Allocates an array of floats aligned to PARTICLE_ALIGNMENT.
+*/
+static float* AllocateArray(uint count)
+{
+#ifdef _WIN32
+	return (float*)_aligned_malloc(sizeof(float) * count, PARTICLE_ALIGNMENT);
+#else
+	// The size has to be a multiple of the alignment.
+	size_t size = (sizeof(float) * count + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1);
+	return (float*)std::aligned_alloc(PARTICLE_ALIGNMENT, glm::max(size, (size_t)PARTICLE_ALIGNMENT));
+#endif
+}
+
+/*
+* Frees an array allocated by AllocateArray.
+*/
+static void FreeArray(float* data)
+{
+#ifdef _WIN32
+	_aligned_free(data);
+#else
+	std::free(data);
+#endif
+}
+
+/*
+* Gathers an array into the scratch array according to the given permutation and swaps the two, the scratch
+* array then holds the old data.
+*/
+template <typename T> static void PermuteArray(T*& data, T*& scratch, const uint* order, uint count)
+{
+	for (uint k = 0; k < count; k++) scratch[k] = data[order[k]];
+	std::swap(data, scratch);
+}
+
+ParticleStore::ParticleStore(uint capacity) : count(capacity)
+{
+	posX = AllocateArray(capacity);
+	posY = AllocateArray(capacity);
+	velX = AllocateArray(capacity);
+	velY = AllocateArray(capacity);
+	radius = AllocateArray(capacity);
+	invMass = AllocateArray(capacity);
+	m_Scratch = AllocateArray(capacity);
+
+	cold = new ParticleColdData[capacity];
+	m_ColdScratch = new ParticleColdData[capacity];
+}
+
+ParticleStore::~ParticleStore()
+{
+	FreeArray(posX);
+	FreeArray(posY);
+	FreeArray(velX);
+	FreeArray(velY);
+	FreeArray(radius);
+	FreeArray(invMass);
+	FreeArray(m_Scratch);
+
+	delete[] cold;
+	delete[] m_ColdScratch;
+}
+
+void ParticleStore::Set(uint idx, glm::vec2 pos, glm::vec2 velocity, float mass, float radius, uint color)
+{
+	posX[idx] = pos.x, posY[idx] = pos.y;
+	velX[idx] = velocity.x, velY[idx] = velocity.y;
+	this->radius[idx] = radius;
+	invMass[idx] = 1.0f / mass;
+
+	cold[idx] = { mass, color };
+}
+
+void ParticleStore::Permute(const uint* order)
+{
+	// A single scratch array is passed on from one attribute to the next.
+	PermuteArray(posX, m_Scratch, order, count);
+	PermuteArray(posY, m_Scratch, order, count);
+	PermuteArray(velX, m_Scratch, order, count);
+	PermuteArray(velY, m_Scratch, order, count);
+	PermuteArray(radius, m_Scratch, order, count);
+	PermuteArray(invMass, m_Scratch, order, count);
+	PermuteArray(cold, m_ColdScratch, order, count);
+}
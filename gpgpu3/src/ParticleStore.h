@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+* Data of a particle that is rarely accessed by the simulation.
+*/
+struct ParticleColdData
+{
+	float mass;
+	uint color;
+};
+
+/*
+* Structure-of-arrays particle storage. Every hot attribute is stored in its own cache-line
+* aligned array so that loops only pull in the data they actually use, cold data is kept separately.
+*/
+struct ParticleStore
+{
+	/*
+	* Allocates storage for the given number of particles.
+	* @param[in] capacity		Number of particles.
+	*/
+	ParticleStore(uint capacity);
+	~ParticleStore();
+	/* The store owns its arrays. */
+	ParticleStore(const ParticleStore&) = delete;
+	ParticleStore& operator=(const ParticleStore&) = delete;
+
+	/*
+	* Initializes a single particle.
+	* @param[in] idx			Index of the particle.
+	* @param[in] pos			Position in pixels.
+	* @param[in] velocity		Velocity in pixels per second.
+	* @param[in] mass			Particle mass, must be larger than zero.
+	* @param[in] radius			Radius in pixels.
+	* @param[in] color			Particle color.
+	*/
+	void Set(uint idx, glm::vec2 pos, glm::vec2 velocity, float mass, float radius, uint color);
+	/*
+	* Reorders all particles such that the particle at index k is moved from index order[k]. The arrays are swapped
+	* with scratch arrays of the store, so pointers to them do not stay valid.
+	* @param[in] order			Permutation of the particle indices, of size count.
+	*/
+	void Permute(const uint* order);
+
+	/* Number of particles in the store. */
+	uint count;
+
+	/* Hot data. */
+	float* posX;
+	float* posY;
+	float* velX;
+	float* velY;
+	float* radius;
+	float* invMass;
+
+	/* Cold data. */
+	ParticleColdData* cold;
+
+private:
+	/* Arrays Permute gathers into, which then take the place of the arrays they were gathered from. */
+	float* m_Scratch;
+	ParticleColdData* m_ColdScratch;
+};
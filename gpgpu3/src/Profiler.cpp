@@ -0,0 +1,444 @@
+#include "stdfax.h"
+#include "Profiler.h"
+#include "Template/IOUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#define PROFILER_TIMELINE_WIDTH 800.0f
+#define PROFILER_LABEL_WIDTH 100.0f
+#define PROFILER_LANE_HEIGHT 18.0f
+#define PROFILER_TRACE_DIRECTORY "traces"
+
+/*
+* Events recorded by a single thread.
+*/
+struct ProfileThread
+{
+	std::string name;
+	/* Ring buffer of events, ordered by end time. */
+	ProfileEvent events[PROFILER_RING_SIZE];
+	/* Total number of events written. Only the owning thread writes events, and publishes each by incrementing this. */
+	std::atomic<uint> count{ 0 };
+	/* Number of scopes currently open. */
+	uint depth = 0;
+	/* Fraction of the frame the thread spent in top-level scopes, averaged over several frames. */
+	float utilisation = 0.0f;
+	/* Deepest nesting level in the last frame. */
+	uint maxDepth = 0;
+	/* True if the thread was named, false if it got a generic name. */
+	bool named = false;
+	/* True once the thread exited, the buffer may then be taken over by a new thread. */
+	bool released = false;
+	/* True if the thread is running or recorded events in the last frame, only those are shown in the overlay. */
+	bool shown = true;
+};
+
+/*
+* Per-frame durations of a single scope.
+*/
+struct ProfileHistory
+{
+	float samples[PROFILER_HISTORY];
+	uint count = 0;
+};
+
+static const std::chrono::steady_clock::time_point s_Epoch = std::chrono::steady_clock::now();
+
+/* Event buffers of all threads that recorded an event. A buffer is never freed, instead the buffers of exited threads are
+reused by new threads, so there are as many as threads running at once. */
+static std::mutex s_ThreadsMutex;
+static std::vector<ProfileThread*> s_Threads;
+static thread_local ProfileThread* t_Thread = nullptr;
+
+/*
+* Releases the event buffer of a thread when it exits.
+*/
+struct ProfileThreadRelease
+{
+	~ProfileThreadRelease()
+	{
+		std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+		if (thread) thread->released = true;
+		t_Thread = nullptr;
+	}
+	ProfileThread* thread = nullptr;
+};
+static thread_local ProfileThreadRelease t_Release;
+
+/* Start of the current frame and the range of the last completed frame. */
+static ulong s_FrameStart = 0, s_LastFrameStart = 0, s_LastFrameEnd = 0;
+/* Events of the last completed frame, with the index of the thread that recorded them. */
+static std::vector<std::pair<uint, ProfileEvent>> s_LastFrameEvents;
+/* Rolling per-frame durations of every scope, in milliseconds. */
+static std::map<std::string, ProfileHistory> s_History;
+
+/* Number of completed frames. */
+static uint s_FrameIndex = 0;
+/* Frame time in milliseconds above which a trace is exported, 0 if disarmed. */
+static float s_TraceTrigger = 0.0f;
+/* Path of the last exported trace. */
+static std::string s_LastTrace;
+
+/*
+* Assigns an event buffer to the calling thread. A released buffer of the same name is continued, such that restarted
+* threads keep their lane and events, otherwise any released buffer is cleared and taken over before a new one is created.
+* @param[in] name			Thread name, nullptr for a generic name.
+*/
+static ProfileThread* AcquireThread(const char* name)
+{
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	ProfileThread* thread = nullptr;
+	for (ProfileThread* released : s_Threads)
+	{
+		if (!released->released) continue;
+		if (name ? released->named && released->name == name : !released->named)
+		{
+			thread = released;
+			break;
+		}
+		if (!thread) thread = released;
+	}
+
+	if (!thread)
+	{
+		thread = new ProfileThread();
+		thread->name = "Thread " + std::to_string(s_Threads.size());
+		s_Threads.push_back(thread);
+	}
+	else if (name ? !thread->named || thread->name != name : thread->named)
+	{
+		// The events belong to another thread, drop them. Readers hold the lock, so none is reading them.
+		thread->count.store(0, std::memory_order_relaxed);
+		thread->utilisation = 0.0f;
+		if (!name) thread->name = "Thread " + std::to_string(std::find(s_Threads.begin(), s_Threads.end(), thread) - s_Threads.begin());
+	}
+
+	if (name) thread->name = name;
+	thread->named = name != nullptr;
+	thread->released = false;
+	thread->depth = 0;
+	t_Thread = t_Release.thread = thread;
+	return thread;
+}
+
+/*
+* Retrieves the event buffer of the calling thread, registering the thread on first use.
+*/
+static ProfileThread* GetThread()
+{
+	if (t_Thread) return t_Thread;
+	return AcquireThread(nullptr);
+}
+
+/*
+* Reads an event of a thread without stopping it from recording.
+* @param[in] index			Index of the event, below the count of the thread.
+* @param[out] event		Copy of the event.
+* @returns					False if the thread overwrote the event in the meantime, the copy is then invalid.
+*/
+static bool ReadEvent(const ProfileThread* thread, uint index, ProfileEvent& event)
+{
+	event = thread->events[index % PROFILER_RING_SIZE];
+
+	// While the count is c, the thread may be writing event c, which takes the slot of event c - PROFILER_RING_SIZE.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return thread->count.load(std::memory_order_relaxed) - index < PROFILER_RING_SIZE;
+}
+
+/*
+* Copies the latest events of a thread, oldest first, without stopping it from recording. The copy is retried
+* with half the window as long as the thread overwrote part of it in the meantime.
+* @param[in] window			Maximum number of events.
+* @param[out] events		Copy of the events.
+*/
+static void CopyEvents(const ProfileThread* thread, uint window, std::vector<ProfileEvent>& events)
+{
+	for (;;)
+	{
+		uint count = thread->count.load(std::memory_order_acquire);
+		uint n = glm::min(glm::min(count, window), (uint)PROFILER_RING_SIZE);
+		events.resize(n);
+		for (uint k = 0; k < n; k++) events[k] = thread->events[(count - n + k) % PROFILER_RING_SIZE];
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (thread->count.load(std::memory_order_relaxed) - (count - n) < PROFILER_RING_SIZE) return;
+		window = n / 2;
+	}
+}
+
+#if !HEADLESS_BUILD
+/*
+* Computes a percentile of the samples in a history.
+*/
+static float Percentile(const ProfileHistory& history, float p)
+{
+	uint n = glm::min(history.count, (uint)PROFILER_HISTORY);
+	float sorted[PROFILER_HISTORY];
+	std::copy(history.samples, history.samples + n, sorted);
+	std::sort(sorted, sorted + n);
+	return sorted[(uint)(p * (n - 1) + 0.5f)];
+}
+
+/*
+* Derives a stable color from a scope name.
+*/
+static ImU32 ScopeColor(const char* name)
+{
+	uint hash = 2166136261u;
+	for (const char* c = name; *c; c++) hash = (hash ^ (uchar)*c) * 16777619u;
+	return ImColor::HSV((hash % 360) / 360.0f, 0.55f, 0.8f);
+}
+#endif
+
+void Profiler::SetThreadName(const char* name)
+{
+	if (!t_Thread)
+	{
+		AcquireThread(name);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	t_Thread->name = name;
+	t_Thread->named = true;
+}
+
+ulong Profiler::Now()
+{
+	return (ulong)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count();
+}
+
+ulong Profiler::BeginScope()
+{
+	GetThread()->depth++;
+	return Now();
+}
+
+void Profiler::EndScope(const char* name, ulong start)
+{
+	ulong end = Now();
+	ProfileThread* thread = GetThread();
+	thread->depth--;
+
+	// Single writer: the slot is only overwritten after the previous count is visible, and the event is
+	// published by the new count. Readers detect events overwritten while they copied them by the count.
+	uint count = thread->count.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	thread->events[count % PROFILER_RING_SIZE] = { name, start, end, thread->depth };
+	thread->count.store(count + 1, std::memory_order_release);
+}
+
+void Profiler::NewFrame()
+{
+#if PROFILER_ENABLED
+	ulong now = Now();
+
+	if (s_FrameStart > 0)
+	{
+		s_LastFrameStart = s_FrameStart, s_LastFrameEnd = now;
+		s_LastFrameEvents.clear();
+		float frameTime = (float)(now - s_FrameStart);
+
+		// Total time spent in every scope during the frame.
+		std::map<std::string, float> totals;
+
+		std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+		for (uint t = 0; t < s_Threads.size(); t++)
+		{
+			ProfileThread* thread = s_Threads[t];
+			uint count = thread->count.load(std::memory_order_acquire);
+			uint n = glm::min(count, (uint)PROFILER_RING_SIZE);
+
+			// Walk back from the newest event. The events are ordered by end time, so we can stop at the first one
+			// that ended before the frame started, or that the thread already overwrote.
+			ulong busy = 0;
+			thread->maxDepth = 0;
+			thread->shown = !thread->released;
+			for (uint k = 0; k < n; k++)
+			{
+				ProfileEvent e;
+				if (!ReadEvent(thread, count - 1 - k, e) || e.end <= s_FrameStart) break;
+				thread->shown = true;
+
+				// Clip scopes that started in the previous frame.
+				e.start = glm::max(e.start, s_FrameStart), e.end = glm::min(e.end, now);
+				s_LastFrameEvents.push_back({ t, e });
+
+				totals[e.name] += (e.end - e.start) * 1e-6f;
+				if (e.depth == 0) busy += e.end - e.start;
+				thread->maxDepth = glm::max(thread->maxDepth, e.depth);
+			}
+
+			thread->utilisation = thread->utilisation * 0.9f + (float)busy / frameTime * 0.1f;
+		}
+
+		for (auto& total : totals)
+		{
+			ProfileHistory& history = s_History[total.first];
+			history.samples[history.count++ % PROFILER_HISTORY] = total.second;
+		}
+	}
+
+	s_FrameStart = now;
+	s_FrameIndex++;
+#endif
+
+	// Capture the slow frame while its events are still in the ring buffers.
+	if (s_TraceTrigger > 0.0f && (s_LastFrameEnd - s_LastFrameStart) * 1e-6f > s_TraceTrigger)
+	{
+		std::string path = std::string(PROFILER_TRACE_DIRECTORY) + "/frame_" + std::to_string(s_FrameIndex) + ".json";
+		if (ExportTrace(path.c_str())) s_TraceTrigger = 0.0f;
+	}
+}
+
+bool Profiler::ExportTrace(const char* path)
+{
+	std::string trace = "{\"traceEvents\":[\n";
+	char line[512];
+	std::vector<ProfileEvent> events;
+
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	for (uint t = 0; t < s_Threads.size(); t++)
+	{
+		ProfileThread* thread = s_Threads[t];
+		snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n", t, thread->name.c_str());
+		trace += line;
+
+		CopyEvents(thread, PROFILER_RING_SIZE, events);
+
+		// Oldest event first, each scope is written as a complete event with its begin time and duration in microseconds.
+		for (const ProfileEvent& e : events)
+		{
+			snprintf(line, sizeof(line), "{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f},\n",
+				e.name, t, e.start * 1e-3, (e.end - e.start) * 1e-3);
+			trace += line;
+		}
+	}
+	// Close with the frame counter, which also avoids a trailing comma.
+	snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":0,\"args\":{\"name\":\"gpgpu3 (frame %u)\"}}\n]}\n", s_FrameIndex);
+	trace += line;
+
+	// Replace any previous trace with the same name.
+	std::string directory = std::string(path).substr(0, std::string(path).find_last_of("/\\") + 1);
+	if (!directory.empty() && !fio::DirectoryExists(directory.c_str())) fio::CreateDirectoryRecursively(directory.c_str());
+	fio::DeleteExistingFile(path);
+
+	fio::FileHandle file = fio::CreateNewFile(path, fio::io_share_mode::share_read, fio::io_flags_and_attributes::flag_sequential_scan);
+	if (!file)
+	{
+		fio::PrintLastIOError();
+		return false;
+	}
+
+	int written = fio::WriteToFile(file, (void*)trace.data(), (ulong)trace.size());
+	fio::CloseFileHandle(file);
+	if (written) s_LastTrace = path;
+	printf("Profiler: %s trace %s\n", written ? "exported" : "failed to export", path);
+	return written != 0;
+}
+
+void Profiler::SetTraceTrigger(float frameTime)
+{
+	s_TraceTrigger = glm::max(frameTime, 0.0f);
+}
+
+#if !HEADLESS_BUILD
+void Profiler::RenderGUI()
+{
+	ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+#if !PROFILER_ENABLED
+	ImGui::Text("Profiling is compiled out, set PROFILER_ENABLED to enable it.");
+#else
+	float frameTime = (float)(s_LastFrameEnd - s_LastFrameStart);
+	ImGui::Text("Last frame: %.2f ms", frameTime * 1e-6f);
+
+	// Trace export, either right away or on the next frame that exceeds the threshold.
+	static float threshold = 50.0f;
+	if (ImGui::Button("Export trace"))
+		ExportTrace((std::string(PROFILER_TRACE_DIRECTORY) + "/frame_" + std::to_string(s_FrameIndex) + ".json").c_str());
+	ImGui::SameLine();
+	bool armed = s_TraceTrigger > 0.0f;
+	if (ImGui::Checkbox("On frame time >", &armed)) SetTraceTrigger(armed ? threshold : 0.0f);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(120.0f);
+	if (ImGui::SliderFloat("ms", &threshold, 1.0f, 500.0f, "%.0f") && armed) SetTraceTrigger(threshold);
+	if (!s_LastTrace.empty()) ImGui::Text("Last trace: %s", s_LastTrace.c_str());
+
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+
+	// Timeline of the last frame, every thread gets a lane per nesting level.
+	if (frameTime > 0.0f)
+	{
+		ImDrawList* drawList = ImGui::GetWindowDrawList();
+		ImVec2 origin = ImGui::GetCursorScreenPos();
+		float x = origin.x + PROFILER_LABEL_WIDTH;
+
+		std::vector<float> threadY(s_Threads.size());
+		float y = origin.y;
+		for (uint t = 0; t < s_Threads.size(); t++)
+		{
+			threadY[t] = y;
+			if (!s_Threads[t]->shown) continue;
+			drawList->AddText(ImVec2(origin.x, y), IM_COL32(200, 200, 200, 255), s_Threads[t]->name.c_str());
+			y += (s_Threads[t]->maxDepth + 1) * PROFILER_LANE_HEIGHT + 2.0f;
+		}
+
+		for (const std::pair<uint, ProfileEvent>& entry : s_LastFrameEvents)
+		{
+			const ProfileEvent& e = entry.second;
+			float top = threadY[entry.first] + e.depth * PROFILER_LANE_HEIGHT;
+			ImVec2 min = ImVec2(x + (e.start - s_LastFrameStart) / frameTime * PROFILER_TIMELINE_WIDTH, top);
+			ImVec2 max = ImVec2(x + (e.end - s_LastFrameStart) / frameTime * PROFILER_TIMELINE_WIDTH, top + PROFILER_LANE_HEIGHT - 1.0f);
+			max.x = glm::max(max.x, min.x + 1.0f);
+
+			drawList->AddRectFilled(min, max, ScopeColor(e.name));
+			if (max.x - min.x > 40.0f)
+			{
+				ImVec4 clip = ImVec4(min.x, min.y, max.x, max.y);
+				drawList->AddText(ImGui::GetFont(), ImGui::GetFontSize(), ImVec2(min.x + 2.0f, min.y), IM_COL32_BLACK, e.name, nullptr, 0.0f, &clip);
+			}
+			if (ImGui::IsMouseHoveringRect(min, max)) ImGui::SetTooltip("%s: %.3f ms", e.name, (e.end - e.start) * 1e-6f);
+		}
+
+		ImGui::Dummy(ImVec2(PROFILER_LABEL_WIDTH + PROFILER_TIMELINE_WIDTH, y - origin.y));
+	}
+
+	// Rolling percentiles of the time spent per frame in every scope.
+	ImGui::Separator();
+	if (ImGui::BeginTable("ProfilerStages", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+	{
+		ImGui::TableSetupColumn("Scope");
+		ImGui::TableSetupColumn("p50 (ms)");
+		ImGui::TableSetupColumn("p95 (ms)");
+		ImGui::TableSetupColumn("p99 (ms)");
+		ImGui::TableHeadersRow();
+
+		for (const auto& history : s_History)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("%s", history.first.c_str());
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", Percentile(history.second, 0.50f));
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", Percentile(history.second, 0.95f));
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", Percentile(history.second, 0.99f));
+		}
+		ImGui::EndTable();
+	}
+
+	// Fraction of the frame every thread spent inside a scope.
+	ImGui::Separator();
+	for (ProfileThread* thread : s_Threads)
+	{
+		if (!thread->shown) continue;
+		ImGui::ProgressBar(glm::clamp(thread->utilisation, 0.0f, 1.0f), ImVec2(200.0f, 0.0f));
+		ImGui::SameLine();
+		ImGui::Text("%s", thread->name.c_str());
+	}
+#endif
+
+	ImGui::End();
+}
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+* Set to 0 to compile all profiling scopes out.
+*/
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#define PROFILER_RING_SIZE (1 << 16)	// Number of events kept per thread, this is also the window of an exported trace.
+#define PROFILER_HISTORY 256			// Number of frames used for the rolling statistics.
+
+/*
+* A single timed scope, recorded by the thread that executed it.
+*/
+struct ProfileEvent
+{
+	/* Name of the scope, must be a string literal. */
+	const char* name;
+	/* Start and end time in nanoseconds since the profiler started. */
+	ulong start, end;
+	/* Number of scopes this scope is nested in. */
+	uint depth;
+};
+
+/*
+* Profiler (Singleton) collecting scope timings from all threads. Every thread writes to its own ring
+* buffer, which keeps the latest PROFILER_RING_SIZE events. Once full, every new event overwrites the
+* oldest one. Recording takes no lock: the thread writes the event and then publishes it by incrementing
+* the event count of its buffer. The main thread may read the buffers while other threads, like the
+* simulation thread, keep recording, and uses the count to drop the events overwritten during the read.
+* The buffer of an exited thread is taken over by the next new thread, preferably one of the same name.
+*/
+class Profiler
+{
+public:
+	/*
+	* Names the calling thread in the overlay.
+	* @param[in] name			Thread name.
+	*/
+	static void SetThreadName(const char* name);
+	/*
+	* Marks the start of a new frame and updates the statistics of the frame that just ended.
+	*/
+	static void NewFrame();
+#if !HEADLESS_BUILD
+	/*
+	* Renders the profiler window. Should be called in between ImGui::NewFrame and ImGui::Render.
+	*/
+	static void RenderGUI();
+#endif
+
+	/*
+	* Writes all events still in the ring buffers to a Chrome trace-event JSON file, which can be opened
+	* in chrome://tracing or Perfetto.
+	* @param[in] path			Path of the file, an existing file is overwritten.
+	* @returns					True if the file was written.
+	*/
+	static bool ExportTrace(const char* path);
+	/*
+	* Exports a trace as soon as a frame takes longer than the given time. The trigger disarms after firing.
+	* @param[in] frameTime		Frame time threshold in milliseconds, 0 to disarm.
+	*/
+	static void SetTraceTrigger(float frameTime);
+
+	/*
+	* Retrieve the current time.
+	* @returns					Nanoseconds since the profiler started.
+	*/
+	static ulong Now();
+	/*
+	* Opens a scope on the calling thread.
+	* @returns					Start time of the scope.
+	*/
+	static ulong BeginScope();
+	/*
+	* Closes the innermost scope of the calling thread and records it.
+	* @param[in] name			Name of the scope.
+	* @param[in] start			Start time returned by BeginScope.
+	*/
+	static void EndScope(const char* name, ulong start);
+};
+
+/*
+* Times the scope it is declared in.
+*/
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name) : m_Name(name), m_Start(Profiler::BeginScope()) {}
+	~ProfileScope() { Profiler::EndScope(m_Name, m_Start); }
+
+private:
+	const char* m_Name;
+	ulong m_Start;
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+/* Times the enclosing scope under the given name. */
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
@@ -0,0 +1,83 @@
+#include "stdfax.h"
+#include "Raster.h"
+
+#include <immintrin.h>
+
+/*
+* Span tables of all radii up to MAX_SPAN_RADIUS, stored back to back.
+*/
+struct SpanTables
+{
+	SpanTables()
+	{
+		int offset = 0;
+		for (int r = 0; r <= MAX_SPAN_RADIUS; r++)
+		{
+			start[r] = offset;
+			for (int dy = -r; dy <= r; dy++)
+			{
+				// Grow the span for as long as its next pixel passes the circle test.
+				int h = -1;
+				while ((h + 1) * (h + 1) + dy * dy < r * r) h++;
+				spans[offset++] = h;
+			}
+		}
+	}
+
+	/* Radius r has 2r + 1 rows, so all tables together have (MAX_SPAN_RADIUS + 1)^2 rows. */
+	int spans[(MAX_SPAN_RADIUS + 1) * (MAX_SPAN_RADIUS + 1)];
+	int start[MAX_SPAN_RADIUS + 1];
+};
+
+const int* CircleSpans(int radius)
+{
+	// Built on first use, the initialization of a local static is thread-safe.
+	static const SpanTables s_Tables;
+	if (radius < 0 || radius > MAX_SPAN_RADIUS) return nullptr;
+	return &s_Tables.spans[s_Tables.start[radius]];
+}
+
+void FillSpan(Color* pixels, int count, Color color)
+{
+	if (count < 4)
+	{
+		for (int x = 0; x < count; x++) pixels[x] = color;
+		return;
+	}
+
+	int value;
+	memcpy(&value, &color, sizeof(value));
+	__m128i fill = _mm_set1_epi32(value);
+
+	// SSE2 is part of x64, so four pixels are stored at once without a dispatch. The last store overlaps
+	// the previous one instead of finishing the span pixel by pixel.
+	int x = 0;
+	for (; x + 4 <= count; x += 4) _mm_storeu_si128((__m128i*)&pixels[x], fill);
+	if (x < count) _mm_storeu_si128((__m128i*)&pixels[count - 4], fill);
+}
+
+void RasterizeCircle(const RasterCircle& c, int x0, int y0, int x1, int y1, Color* pixels, int stride)
+{
+	int yStart = glm::max(c.yStart, y0), yEnd = glm::min(c.yEnd, y1);
+	int xStart = glm::max(c.xStart, x0), xEnd = glm::min(c.xEnd, x1);
+
+	const int* spans = CircleSpans(c.radius);
+	if (!spans)
+	{
+		for (int y = yStart; y < yEnd; y++)
+			for (int x = xStart; x < xEnd; x++)
+			{
+				int dx = x - c.cx, dy = y - c.cy;
+				if (dx * dx + dy * dy < c.radSquared) pixels[(x - x0) + (y - y0) * stride] = c.color;
+			}
+		return;
+	}
+
+	// The rows lie within [cy - radius, cy + radius), so every row has an entry in the table.
+	for (int y = yStart; y < yEnd; y++)
+	{
+		int h = spans[y - c.cy + c.radius];
+		int left = glm::max(c.cx - h, xStart), right = glm::min(c.cx + h + 1, xEnd);
+		if (left < right) FillSpan(&pixels[(left - x0) + (y - y0) * stride], right - left, c.color);
+	}
+}
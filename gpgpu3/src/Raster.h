@@ -0,0 +1,40 @@
+#pragma once
+
+#define MAX_SPAN_RADIUS 64		// Largest radius with a precomputed span table, larger circles are tested per pixel.
+
+/*
+* Circle covered by a particle on the screen.
+*/
+struct RasterCircle
+{
+	/* Centre, radius and squared radius in pixels. */
+	int cx, cy, radius, radSquared;
+	/* Pixels that are tested against the circle, the ends are exclusive. Empty when the particle is off-screen. */
+	int xStart, yStart, xEnd, yEnd;
+	Color color;
+};
+
+/*
+* Retrieves the span table of a circle, holding for every row dy in [-radius, radius] at index dy + radius the
+* largest offset h for which the pixels [cx - h, cx + h] lie inside the circle, or -1 when the row is empty.
+* These are exactly the pixels passing dx * dx + dy * dy < radius * radius.
+* @param[in] radius			Radius in pixels.
+* @returns					Span table, or nullptr when the radius exceeds MAX_SPAN_RADIUS.
+*/
+const int* CircleSpans(int radius);
+/*
+* Fills a row of pixels with a single colour.
+* @param[out] pixels		First pixel of the row.
+* @param[in] count			Number of pixels.
+* @param[in] color			Colour to fill with.
+*/
+void FillSpan(Color* pixels, int count, Color color);
+/*
+* Draws a circle clipped against a rectangle of pixels, one span per row.
+* @param[in] c				Circle to draw.
+* @param[in] x0, y0			Inclusive start of the rectangle.
+* @param[in] x1, y1			Exclusive end of the rectangle.
+* @param[out] pixels		Pixel buffer covering the rectangle, pixels[0] is at (x0, y0).
+* @param[in] stride			Number of pixels per row of the buffer.
+*/
+void RasterizeCircle(const RasterCircle& c, int x0, int y0, int x1, int y1, Color* pixels, int stride);
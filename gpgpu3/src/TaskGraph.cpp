@@ -0,0 +1,98 @@
+#include "stdfax.h"
+#include "TaskGraph.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+TaskGraph::~TaskGraph()
+{
+	delete[] m_Pending;
+}
+
+void TaskGraph::Clear()
+{
+	m_Tasks.clear();
+	m_Finish.clear();
+}
+
+uint TaskGraph::AddTask(const char* name, uint reads, uint writes, std::function<void()> function)
+{
+	uint index = (uint)m_Tasks.size();
+	Task task = { name, reads, writes, function, {}, 0, 0.0f };
+
+	// Tasks are added in program order, so every conflict with an earlier task becomes a dependency.
+	for (uint t = 0; t < index; t++)
+	{
+		const Task& earlier = m_Tasks[t];
+		if ((reads & earlier.writes) || (writes & earlier.reads) || (writes & earlier.writes))
+		{
+			m_Tasks[t].successors.push_back(index);
+			task.predecessors++;
+		}
+	}
+
+	m_Tasks.push_back(std::move(task));
+	m_Finish.push_back(0.0f);
+	return index;
+}
+
+void TaskGraph::Execute()
+{
+	uint nTasks = (uint)m_Tasks.size();
+	if (nTasks == 0) return;
+	JobBatch batch;
+
+	if (nTasks > m_PendingCapacity)
+	{
+		delete[] m_Pending;
+		m_Pending = new std::atomic<uint>[nTasks];
+		m_PendingCapacity = nTasks;
+	}
+
+	m_Jobs.resize(nTasks);
+	for (uint t = 0; t < nTasks; t++)
+	{
+		m_Jobs[t].graph = this, m_Jobs[t].task = t;
+		m_Pending[t].store(m_Tasks[t].predecessors, std::memory_order_relaxed);
+	}
+	m_Remaining.store(nTasks, std::memory_order_relaxed);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Start with the tasks without dependencies, the others are queued by the last task they depend on.
+	for (uint t = 0; t < nTasks; t++)
+		if (m_Tasks[t].predecessors == 0) JobManager::QueueJob(&m_Jobs[t]);
+	JobManager::Wait(m_Remaining);
+
+	m_WallTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Dependencies always point to later tasks, so a single pass in order finds the longest chain.
+	std::fill(m_Finish.begin(), m_Finish.end(), 0.0f);
+	m_CriticalPath = 0.0f, m_TotalWork = 0.0f;
+	for (uint t = 0; t < nTasks; t++)
+	{
+		// Until here, m_Finish[t] holds the latest finish of the predecessors.
+		m_Finish[t] += m_Tasks[t].time;
+		for (uint s : m_Tasks[t].successors) m_Finish[s] = glm::max(m_Finish[s], m_Finish[t]);
+
+		m_CriticalPath = glm::max(m_CriticalPath, m_Finish[t]);
+		m_TotalWork += m_Tasks[t].time;
+	}
+}
+
+void TaskGraph::TaskJob::Execute()
+{
+	Task& t = graph->m_Tasks[task];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE(t.name);
+		t.function();
+	}
+	t.time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	for (uint s : t.successors)
+		if (graph->m_Pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1) JobManager::QueueJob(&graph->m_Jobs[s]);
+
+	graph->m_Remaining.fetch_sub(1, std::memory_order_release);
+}
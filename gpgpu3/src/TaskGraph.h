@@ -0,0 +1,97 @@
+#pragma once
+#include <functional>
+#include <chrono>
+
+/*
+* Graph of the tasks of a single frame, executed on the JobManager. Every task declares the resources it reads
+* and writes as a bit mask, and runs after all earlier tasks it conflicts with: those writing a resource it reads
+* or writes, and those reading a resource it writes. Tasks that do not conflict run at the same time.
+*/
+class TaskGraph
+{
+public:
+	TaskGraph() = default;
+	~TaskGraph();
+
+	/*
+	* Removes all tasks, such that the graph can be rebuilt for the next frame.
+	*/
+	void Clear();
+	/*
+	* Adds a task that runs after all previously added tasks it conflicts with.
+	* @param[in] name			Name of the task, must be a string literal.
+	* @param[in] reads			Resources read by the task.
+	* @param[in] writes			Resources written by the task.
+	* @param[in] function		Work performed by the task, may use the data-parallel loops of the JobManager.
+	* @returns					Index of the task.
+	*/
+	uint AddTask(const char* name, uint reads, uint writes, std::function<void()> function);
+	/*
+	* Runs all tasks and waits until they have finished.
+	*/
+	void Execute();
+
+	/*
+	* Retrieve the number of tasks.
+	*/
+	uint TaskCount() const { return (uint)m_Tasks.size(); }
+	/*
+	* Retrieve the name of a task.
+	*/
+	const char* TaskName(uint task) const { return m_Tasks[task].name; }
+	/*
+	* Retrieve the time a task took in the last execution, in milliseconds.
+	*/
+	float TaskTime(uint task) const { return m_Tasks[task].time; }
+	/*
+	* Retrieve the length of the longest chain of dependent tasks in the last execution, in milliseconds.
+	* This is the shortest time the graph can take, no matter the number of threads.
+	*/
+	float CriticalPath() const { return m_CriticalPath; }
+	/*
+	* Retrieve the sum of all task times in the last execution, in milliseconds.
+	*/
+	float TotalWork() const { return m_TotalWork; }
+	/*
+	* Retrieve the time from the start until the end of the last execution, in milliseconds.
+	*/
+	float WallTime() const { return m_WallTime; }
+
+private:
+	/*
+	* Runs a task and queues the successors that have become ready.
+	*/
+	class TaskJob : public Job
+	{
+	public:
+		void Execute() override;
+
+		TaskGraph* graph = nullptr;
+		uint task = 0;
+	};
+
+	struct Task
+	{
+		const char* name;
+		uint reads, writes;
+		std::function<void()> function;
+		/* Tasks that run after this one. */
+		std::vector<uint> successors;
+		/* Number of tasks this one runs after. */
+		uint predecessors = 0;
+		/* Duration of the last execution in milliseconds. */
+		float time = 0.0f;
+	};
+
+	std::vector<Task> m_Tasks;
+	std::vector<TaskJob> m_Jobs;
+	/* Finish time of every task on the critical path, kept such that rebuilding the graph every frame does not allocate. */
+	std::vector<float> m_Finish;
+	/* Number of predecessors of every task that have not finished yet. */
+	std::atomic<uint>* m_Pending = nullptr;
+	uint m_PendingCapacity = 0;
+	/* Number of tasks that have not finished yet. */
+	std::atomic<uint> m_Remaining = 0;
+
+	float m_CriticalPath = 0.0f, m_TotalWork = 0.0f, m_WallTime = 0.0f;
+};
@@ -1,7 +1,10 @@
 #include "stdfax.h"
 #include "Application.h"
 #include "Game.h"
+#include "Profiler.h"
 #include <chrono>
+#include <cfloat>
+#include <thread>
 
 
 // Initialize static member-variables. 
@@ -10,20 +13,24 @@ uint Application::s_RenderHeight = 0;
 uint Application::s_WindowWidth = 0;
 uint Application::s_WindowHeight = 0;
 
+float Application::s_FixedTimeStep = 1.0f / 60.0f;
+float Application::s_MaxFrameTime = 0.25f;
+uint Application::s_MaxSubsteps = 4;
+uint Application::s_Substeps = 0;
+
 bool Application::s_Initialized = false;
-GLFWwindow* Application::s_Window = nullptr;
+bool Application::s_Headless = false;
+bool Application::s_ThreadedSimulation = true;
+bool Application::s_OpenCLSimulation = false;
+bool Application::s_ValidateOpenCL = false;
 Surface* Application::s_RenderSurface = nullptr;
+#if !HEADLESS_BUILD
+GLFWwindow* Application::s_Window = nullptr;
 clContext* Application::s_clContext = nullptr;
+#endif
 
 
-int main() {
-	Application::Initialize(4096, 4096);
-	Application::Run();
-
-	return 0;
-}
-
-
+#if !HEADLESS_BUILD
 void Application::Initialize(uint width, uint height)
 {
 	if (s_Initialized) return;
@@ -38,6 +45,7 @@ void Application::Initialize(uint width, uint height)
 	Application::InitOpenCL();
 	Input::Initialize(Application::Window());
 	JobManager::Initialize();
+	Profiler::SetThreadName("Main");
 
 	s_RenderSurface = new Surface(s_RenderWidth, s_RenderHeight);
 
@@ -45,7 +53,29 @@ void Application::Initialize(uint width, uint height)
 	s_Initialized = true;
 
 }
+#endif
+
+void Application::InitializeHeadless(uint width, uint height)
+{
+	if (s_Initialized) return;
 
+	s_RenderWidth = width, s_WindowWidth = width;
+	s_RenderHeight = height, s_WindowHeight = height;
+
+	s_Headless = true;
+
+	// Only the job system is needed to run the simulation, and OpenCL when it runs on the device.
+	JobManager::Initialize();
+#if !HEADLESS_BUILD
+	if (s_OpenCLSimulation) Application::InitOpenCL();
+#endif
+
+	s_RenderSurface = new Surface(s_RenderWidth, s_RenderHeight, true);
+
+	s_Initialized = true;
+}
+
+#if !HEADLESS_BUILD
 void Application::Run()
 {
 	// Initialize with some default width and height if the app was not yet intialized.
@@ -54,25 +84,48 @@ void Application::Run()
 	// Initialize the game. 
 	Game* game = new Game();
 
+	// From here on the simulation shares the job system with the render thread.
+	std::atomic<bool> running = true;
+	std::thread simulation;
+	if (ThreadedSimulation()) simulation = std::thread(&Application::RunSimulation, game, &running);
+
 	// Variables for computing time passed per frame.
 	std::chrono::system_clock::time_point tp = std::chrono::system_clock::now();
 	std::chrono::system_clock::time_point tc = std::chrono::system_clock::now();
 	float dt = std::chrono::duration<float>(tc - tp).count() + 0.00001f;
+	// Simulation time that has not been stepped yet.
+	float accumulator = 0.0f;
 
 	while (!Input::KeyPressed(Key::Escape) && !glfwWindowShouldClose(Application::Window())) {
 		// Compute the time passed since last loop.
 		float dt = std::chrono::duration<float>(tc - tp).count() + 0.00001f;
 		tp = tc; tc = std::chrono::system_clock::now();
+		Profiler::NewFrame();
+		JobManager::NewFrame();
+		PROFILE_SCOPE("Frame");
 
 		glClearColor(0.102f, 0.117f, 0.141f, 0.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		game->Tick(dt);
-		game->Draw(dt);
+		game->PostInput();
+
+		// Fraction of a step between the last two simulation states.
+		float alpha = 1.0f;
+		if (!ThreadedSimulation())
+		{
+			if (s_FixedTimeStep > 0.0f) alpha = StepFixedTime(accumulator, dt, [game](float fixedStep) { game->Tick(fixedStep); });
+			else
+			{
+				game->Tick(dt);
+				accumulator = 0.0f, s_Substeps = 1;
+			}
+		}
 
+		game->Draw(alpha);
 
-		// Render our render-target.
-		Application::Screen()->Draw();
+
+		// Render our render-target, unless the particles were drawn straight to the window.
+		if (game->DrawsToSurface()) Application::Screen()->Draw();
 
 		game->RenderGUI(dt);
 
@@ -83,6 +136,119 @@ void Application::Run()
 		glfwPollEvents();
 	}
 
+	if (simulation.joinable())
+	{
+		running = false;
+		simulation.join();
+	}
+
+	delete game;
+}
+#endif
+
+void Application::RunSimulation(Game* game, const std::atomic<bool>* running)
+{
+	Profiler::SetThreadName("Simulation");
+
+	std::chrono::steady_clock::time_point tp = std::chrono::steady_clock::now();
+	// Simulation time that has not been stepped yet.
+	float accumulator = 0.0f;
+
+	while (running->load(std::memory_order_relaxed))
+	{
+		std::chrono::steady_clock::time_point tc = std::chrono::steady_clock::now();
+		float dt = std::chrono::duration<float>(tc - tp).count() + 0.00001f;
+		tp = tc;
+		JobManager::NewFrame();
+
+		// Without a fixed time step, the simulation ticks back to back with the time the last tick took.
+		float step = s_FixedTimeStep;
+		if (step <= 0.0f)
+		{
+			game->Tick(glm::min(dt, s_MaxFrameTime));
+			accumulator = 0.0f, s_Substeps = 1;
+			continue;
+		}
+
+		StepFixedTime(accumulator, dt, [game](float fixedStep) { game->Tick(fixedStep); });
+
+		// Sleep until the next step is due. Sleeps tend to overshoot, so the last two milliseconds are yielded.
+		float wait = step - accumulator - std::chrono::duration<float>(std::chrono::steady_clock::now() - tc).count();
+		if (wait > 0.002f) std::this_thread::sleep_for(std::chrono::duration<float>(wait - 0.002f));
+		else std::this_thread::yield();
+	}
+}
+
+void Application::RunHeadless(uint frames)
+{
+	if (!s_Initialized) InitializeHeadless(1024, 1024);
+
+	Game* game = new Game();
+
+	// Every frame advances the simulation by exactly one step, such that runs are reproducible.
+	float dt = s_FixedTimeStep > 0.0f ? s_FixedTimeStep : 1.0f / 60.0f;
+
+	const int nStages = (int)FrameStage::COUNT;
+	double total[nStages + 1] = {}, minimum[nStages + 1], maximum[nStages + 1] = {};
+	double criticalPath = 0.0;
+	for (int s = 0; s <= nStages; s++) minimum[s] = DBL_MAX;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint f = 0; f < frames; f++)
+	{
+		JobManager::NewFrame();
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+		game->Tick(dt);
+		criticalPath += game->CriticalPath();
+		game->Draw();
+		double frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+
+		// The last entry holds the time of the entire frame.
+		for (int s = 0; s <= nStages; s++)
+		{
+			double t = s < nStages ? game->StageTime((FrameStage)s) : frameTime;
+			total[s] += t, minimum[s] = glm::min(minimum[s], t), maximum[s] = glm::max(maximum[s], t);
+		}
+	}
+	double runTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	printf("{\n");
+	printf("\t\"frames\": %u,\n", frames);
+	printf("\t\"particles\": %u,\n", N_PARTICLES);
+	printf("\t\"workers\": %u,\n\t\"placement\": \"%s\",\n", JobManager::NumWorkerThreads(), WorkerPlacementName(JobManager::Placement()));
+	printf("\t\"width\": %u,\n\t\"height\": %u,\n", s_RenderWidth, s_RenderHeight);
+	printf("\t\"dt\": %f,\n", dt);
+	printf("\t\"backend\": \"%s\",\n", s_ValidateOpenCL ? "opencl-validate" : s_OpenCLSimulation ? "opencl" : "cpu");
+	if (s_ValidateOpenCL)
+		printf("\t\"max_position_error\": %f,\n\t\"max_velocity_error\": %f,\n", game->MaxPositionError(), game->MaxVelocityError());
+	printf("\t\"total_ms\": %.3f,\n", runTime);
+	printf("\t\"critical_path_ms\": %.4f,\n", criticalPath / frames);
+	// The collision pass on the final particles, scalar against the widest instruction set. The particles are
+	// only on the host while it simulates.
+	if (!s_OpenCLSimulation || s_ValidateOpenCL)
+	{
+		SimdLevel simd = DetectSimdLevel();
+		float scalarTime = game->TimeNarrowPhase(SimdLevel::SCALAR, 20, dt), simdTime = game->TimeNarrowPhase(simd, 20, dt);
+		printf("\t\"narrow_phase\": { \"simd\": \"%s\", \"scalar_ms\": %.4f, \"simd_ms\": %.4f, \"speedup\": %.2f },\n",
+			SimdLevelName(simd), scalarTime, simdTime, scalarTime / simdTime);
+	}
+	printf("\t\"stages\": {\n");
+	for (int s = 0; s <= nStages; s++)
+		printf("\t\t\"%s\": { \"avg_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+			s < nStages ? FrameStageName((FrameStage)s) : "frame", total[s] / frames, minimum[s], maximum[s], s < nStages ? "," : "");
+	printf("\t}\n}\n");
+
+	delete game;
+}
+
+#if !HEADLESS_BUILD
+void Application::RunGridBenchmark(uint iterations)
+{
+	if (!s_Initialized) InitializeHeadless(1024, 1024);
+	if (!s_clContext) Application::InitOpenCL();
+
+	Game* game = new Game();
+	game->BenchmarkGridBuild(iterations);
 	delete game;
 }
 
@@ -90,16 +256,19 @@ GLFWwindow* Application::Window()
 {
 	return s_Window;
 }
+#endif
 
 Surface* Application::Screen()
 {
 	return s_RenderSurface;
 }
 
+#if !HEADLESS_BUILD
 clContext* Application::CLcontext()
 {
 	return s_clContext;
 }
+#endif
 
 uint Application::WindowWidth()
 {
@@ -121,15 +290,95 @@ uint Application::RenderHeight()
 	return s_RenderHeight;
 }
 
+float Application::FixedTimeStep()
+{
+	return s_FixedTimeStep;
+}
+
+uint Application::MaxSubsteps()
+{
+	return s_MaxSubsteps;
+}
+
+uint Application::Substeps()
+{
+	return s_Substeps;
+}
+
+void Application::SetFixedTimeStep(float step, uint maxSubsteps, float maxFrameTime)
+{
+	s_FixedTimeStep = glm::max(step, 0.0f);
+	s_MaxSubsteps = glm::max(maxSubsteps, 1u);
+	s_MaxFrameTime = maxFrameTime;
+}
+
+float Application::StepFixedTime(float& accumulator, float dt, const std::function<void(float)>& tick)
+{
+	// A tick may change the time step, the steps of this frame use the one it started with.
+	float step = s_FixedTimeStep;
+
+	// Clamp the frame time, such that a slow frame does not cause even more steps in the next one.
+	accumulator += glm::min(dt, s_MaxFrameTime);
+
+	s_Substeps = 0;
+	while (accumulator >= step && s_Substeps < s_MaxSubsteps)
+	{
+		tick(step);
+		accumulator -= step, s_Substeps++;
+	}
+
+	// Drop the time that did not fit in the maximum number of steps.
+	if (accumulator >= step) accumulator = glm::mod(accumulator, step);
+	return accumulator / step;
+}
+
 void Application::ResizeRenderSize(unsigned int width, unsigned int height)
 {
 	delete s_RenderSurface;
-	s_RenderSurface = new Surface(width, height);
+	s_RenderSurface = new Surface(width, height, s_Headless);
 	s_RenderWidth = width, s_RenderHeight = height;
 }
 
-void Application::SetWindowSize(unsigned int width, unsigned int height, bool resetAspectRatio)
+bool Application::Headless()
+{
+	return s_Headless;
+}
+
+bool Application::ThreadedSimulation()
+{
+	return s_ThreadedSimulation && !s_Headless;
+}
+
+void Application::SetThreadedSimulation(bool threaded)
+{
+	s_ThreadedSimulation = threaded;
+}
+
+bool Application::OpenCLSimulation()
 {
+	return s_OpenCLSimulation;
+}
+
+bool Application::ValidateOpenCL()
+{
+	return s_OpenCLSimulation && s_ValidateOpenCL;
+}
+
+void Application::SetOpenCLSimulation(bool opencl, bool validate)
+{
+	s_OpenCLSimulation = opencl, s_ValidateOpenCL = validate;
+}
+
+void Application::SetWindowSize(unsigned int width, unsigned int height, [[maybe_unused]] bool resetAspectRatio)
+{
+	// Without a window there is nothing to resize.
+	if (s_Headless)
+	{
+		s_WindowWidth = width, s_WindowHeight = height;
+		return;
+	}
+
+#if !HEADLESS_BUILD
 	// Set aspect ratio.
 	if (resetAspectRatio) glfwSetWindowAspectRatio(s_Window, width, height);
 	// Set window size.
@@ -139,8 +388,10 @@ void Application::SetWindowSize(unsigned int width, unsigned int height, bool re
 	int w, h; glfwGetWindowSize(s_Window, &w, &h);
 
 	s_WindowWidth = (uint)w, s_WindowHeight = (uint)h;
+#endif
 }
 
+#if !HEADLESS_BUILD
 void Application::InitGLFW()
 {
 	// Initialize glfw.
@@ -195,7 +446,8 @@ void Application::InitImGui()
 
 void Application::InitOpenCL()
 {
-	s_clContext = new clContext(true);
+	// Without a window there is no OpenGL context to share with.
+	s_clContext = new clContext(!s_Headless);
 }
 
 void Application::WINDOW_RESIZE_CALLBACK(GLFWwindow* window, int width, int height)
@@ -206,4 +458,5 @@ void Application::WINDOW_RESIZE_CALLBACK(GLFWwindow* window, int width, int heig
 	// Resize the viewport.
 	glViewport(0, 0, width, height);
 	s_WindowWidth = width, s_WindowHeight = height;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -1,34 +1,94 @@
 #pragma once
 #include "Surface.h"
+#if !HEADLESS_BUILD
 #include "Input.h"
+#endif
+#include <functional>
+
+class Game;
 
 class Application
 {
 public:
+#if !HEADLESS_BUILD
 	/*
 	* Initialize the Game singleton.
 	* @param[in] width			Window and render width.
 	* @param[in] height			Window and render height.
 	*/
 	static void Initialize(uint width, uint height);
+#endif
+	/*
+	* Initialize the application without a window or OpenGL. The game renders into the memory of a
+	* headless surface only. OpenCL is only initialized for the OpenCL simulation.
+	* @param[in] width			Render width.
+	* @param[in] height			Render height.
+	*/
+	static void InitializeHeadless(uint width, uint height);
+#if !HEADLESS_BUILD
 	/*
 	* Start the application main-loop.
 	*/
 	static void Run();
+#endif
+	/*
+	* Run the game for a fixed number of frames without a window and print the timings of every frame stage as JSON.
+	* @param[in] frames			Number of frames to run.
+	*/
+	static void RunHeadless(uint frames);
+#if !HEADLESS_BUILD
+	/*
+	* Build the particle grid on the host and on the OpenCL device without a window and print the timings of both as JSON.
+	* @param[in] iterations		Number of grids built by each.
+	*/
+	static void RunGridBenchmark(uint iterations);
+#endif
+
+	/*
+	* Checks if the application runs without a window.
+	*/
+	static bool Headless();
+	/*
+	* Checks if the simulation runs on its own thread, decoupled from the frame rate. Never the case without a window.
+	*/
+	static bool ThreadedSimulation();
+	/*
+	* Run the simulation on its own thread or tick it once per frame on the main thread. Must be set before Run.
+	*/
+	static void SetThreadedSimulation(bool threaded);
+	/*
+	* Checks if the simulation runs on the OpenCL device.
+	*/
+	static bool OpenCLSimulation();
+	/*
+	* Checks if every tick of the OpenCL simulation is compared against the CPU simulation, which then remains
+	* the one that is drawn.
+	*/
+	static bool ValidateOpenCL();
+	/*
+	* Run the simulation on the OpenCL device instead of the CPU. Must be set before initializing.
+	* @param[in] opencl			Step the particles with OpenCL kernels.
+	* @param[in] validate		Step the CPU simulation as well and compare both after every tick.
+	*/
+	static void SetOpenCLSimulation(bool opencl, bool validate = false);
 
+#if !HEADLESS_BUILD
 	/*
 	* Retrieve the active GLFW window.
 	*/
 	static GLFWwindow* Window();
+#endif
 	/*
 	* Retrieve the active render-surface.
 	*/
 	static Surface* Screen();
+#if !HEADLESS_BUILD
 	/*
 	* Retrieve the global cl context.
 	* @returns		Valid cl context object.
 	*/
 	static clContext* CLcontext();
+#endif
 
 	/*
 	* Retrieve the window's width.
@@ -66,11 +126,44 @@ public:
 	*/
 	static void SetWindowSize(unsigned int width, unsigned int height, bool resetAspectRatio = false);
 
+	/*
+	* Retrieve the fixed simulation time step.
+	* @returns		Time step in seconds, 0 if the simulation follows the frame time.
+	*/
+	static float FixedTimeStep();
+	/*
+	* Retrieve the maximum number of simulation steps per frame.
+	*/
+	static uint MaxSubsteps();
+	/*
+	* Retrieve the number of simulation steps taken in the last frame.
+	*/
+	static uint Substeps();
+	/*
+	* Set up the fixed time step simulation.
+	* @param[in] step			Time step in seconds, 0 to tick the simulation once per frame with the frame time.
+	* @param[in] maxSubsteps	Maximum number of simulation steps per frame.
+	* @param[in] maxFrameTime	Frame time is clamped to this value in seconds, to keep slow frames from piling up.
+	*/
+	static void SetFixedTimeStep(float step, uint maxSubsteps = 4, float maxFrameTime = 0.25f);
+	/*
+	* Advances the simulation time by the time of a frame and takes a step for every fixed time step that has passed,
+	* at most the maximum number of steps. The frame time is clamped, and the time left over after the maximum number of
+	* steps is dropped, except for the fraction of a step. Requires a fixed time step.
+	* @param[in] accumulator	Simulation time that has not been stepped yet, in seconds. Updated with the time left.
+	* @param[in] dt				Frame time in seconds.
+	* @param[in] tick			Takes a single step, receives the time step.
+	* @returns					Fraction of a step left, used to interpolate between the last two states.
+	*/
+	static float StepFixedTime(float& accumulator, float dt, const std::function<void(float)>& tick);
+
 private:
+#if !HEADLESS_BUILD
 	/*
 	* Global OpenCL context.
 	*/
 	static clContext* s_clContext;
+#endif
 
 	/*
 	* Window size.
@@ -81,20 +174,51 @@ private:
 	*/
 	static uint s_RenderWidth, s_RenderHeight;
 
+	/*
+	* Fixed simulation time step and frame time clamp in seconds.
+	*/
+	static float s_FixedTimeStep, s_MaxFrameTime;
+	/*
+	* Maximum number of simulation steps per frame and the number of steps taken in the last frame.
+	*/
+	static uint s_MaxSubsteps, s_Substeps;
+
 	/*
 	* Boolean indicating if the Game class has been intialized yet.
 	*/
 	static bool s_Initialized;
+	/*
+	* Boolean indicating if the application runs without a window and OpenGL.
+	*/
+	static bool s_Headless;
+	/*
+	* Boolean indicating if the simulation runs on its own thread.
+	*/
+	static bool s_ThreadedSimulation;
+	/*
+	* Booleans indicating if the simulation runs on the OpenCL device, and if it is compared against the CPU.
+	*/
+	static bool s_OpenCLSimulation, s_ValidateOpenCL;
 
+#if !HEADLESS_BUILD
 	/*
 	* Active window.
 	*/
 	static GLFWwindow* s_Window;
+#endif
 	/*
 	* Surface used for drawing to the window.
 	*/
 	static Surface* s_RenderSurface;
 
+	/*
+	* Main-loop of the simulation thread, ticks the game until running is cleared.
+	* @param[in] game			Game to simulate.
+	* @param[in] running		Cleared by the main thread to stop the simulation.
+	*/
+	static void RunSimulation(Game* game, const std::atomic<bool>* running);
+
+#if !HEADLESS_BUILD
 	/*
 	* Initialize OpenGL and GLFW.
 	*/
@@ -115,4 +239,5 @@ private:
 	* @param[in] height			New window height.
 	*/
 	static void WINDOW_RESIZE_CALLBACK(GLFWwindow* window, int width, int height);
+#endif
 };
\ No newline at end of file
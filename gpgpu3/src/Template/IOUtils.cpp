@@ -1,8 +1,14 @@
 #include "stdfax.h"
 #include "IOUtils.h"
 #include <stdio.h>
+#ifdef _WIN32
 #include <strsafe.h>
 #include <tchar.h>
+#else
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#endif
 #include <algorithm>
 
 
@@ -20,6 +26,7 @@ namespace fio
 	}
 
 
+#ifdef _WIN32
 	FileHandle CreateNewFile(const char* path, io_share_mode share_mode, io_flags_and_attributes attr_flgs)
 	{
 		FileHandle hFile = CreateFileA((LPCSTR)path, GENERIC_READ | GENERIC_WRITE, (DWORD)share_mode, NULL, CREATE_NEW, (DWORD)attr_flgs, NULL);
@@ -108,6 +115,82 @@ namespace fio
 		return CreateDirectoryA(path, NULL);
 	}
 
+#else
+	FileHandle CreateNewFile(const char* path, io_share_mode, io_flags_and_attributes)
+	{
+		// Fails if the file exists, like CREATE_NEW.
+		return fopen(path, "w+bx");
+	}
+
+	FileHandle OpenFileReadOnly(const char* path, io_share_mode, io_flags_and_attributes)
+	{
+		return fopen(path, "rb");
+	}
+
+	FileHandle OpenFileWriteOnly(const char* path, io_share_mode, io_flags_and_attributes)
+	{
+		// A stream opened for writing only would create or truncate the file.
+		return fopen(path, "r+b");
+	}
+
+	FileHandle OpenFileReadWrite(const char* path, io_share_mode, io_flags_and_attributes)
+	{
+		return fopen(path, "r+b");
+	}
+
+
+	int CloseFileHandle(FileHandle file)
+	{
+		return fclose(file) == 0;
+	}
+
+	int DeleteExistingFile(const char* path)
+	{
+		return remove(path) == 0;
+	}
+
+	void SetFilePtrPos(FileHandle file, ulong pos)
+	{
+		fseek(file, (long)pos, SEEK_SET);
+	}
+
+
+	int WriteToFile(FileHandle file, void* buffer, ulong nBytes)
+	{
+		return fwrite(buffer, 1, nBytes, file) == nBytes;
+	}
+
+	int WriteToFile(FileHandle file, void* buffer, ulong nBytes, ulong& nBytesWritten)
+	{
+		nBytesWritten = fwrite(buffer, 1, nBytes, file);
+		return !ferror(file);
+	}
+
+	int ReadFromFile(FileHandle file, void* buffer, ulong nBytes)
+	{
+		return fread(buffer, 1, nBytes, file) == nBytes;
+	}
+
+	int ReadFromFile(FileHandle file, void* buffer, ulong nBytes, ulong& nBytesRead)
+	{
+		nBytesRead = fread(buffer, 1, nBytes, file);
+		return !ferror(file);
+	}
+
+
+	int FileSize(FileHandle file)
+	{
+		struct stat info;
+		if (fstat(fileno(file), &info) != 0) return 0;
+		return (int)info.st_size;
+	}
+
+	bool CreateNewDirectory(const char* path)
+	{
+		return mkdir(path, 0755) == 0;
+	}
+#endif
+
 	bool CreateDirectoryRecursively(const char* path)
 	{
 
@@ -118,7 +201,8 @@ namespace fio
 			int current = glm::min(p.find('\\', pos), p.find('/', pos));
 			std::string sub = p.substr(0, current);
 
-			if (!fio::DirectoryExists(sub.c_str()))
+			// An absolute path starts with an empty component.
+			if (!sub.empty() && !fio::DirectoryExists(sub.c_str()))
 				if (!fio::CreateNewDirectory(sub.c_str()))
 					return false;
 
@@ -134,14 +218,22 @@ namespace fio
 	// https://stackoverflow.com/questions/8233842/how-to-check-if-directory-exist-using-c-and-winapi
 	bool DirectoryExists(const char* path)
 	{
+#ifndef _WIN32
+		struct stat info;
+		return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+#else
 		DWORD ftyp = GetFileAttributesA(path);
 		if (ftyp == INVALID_FILE_ATTRIBUTES) return false;  //something is wrong with your path!
 		if (ftyp & FILE_ATTRIBUTE_DIRECTORY) return true;   // this is a directory!
 		return false;    // this is not a directory
+#endif
 	}
 
 	void PrintLastIOError()
 	{
+#ifndef _WIN32
+		std::cout << "Error: " << strerror(errno) << std::endl;
+#else
 
 		DWORD errorMessageID = GetLastError();
 
@@ -159,5 +251,6 @@ namespace fio
 		LocalFree(messageBuffer);
 
 		std::cout << "Error: " << message << std::endl;
+#endif
 	}
 }
\ No newline at end of file
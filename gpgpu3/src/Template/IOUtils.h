@@ -1,15 +1,32 @@
 #pragma once
 #include "stdfax.h"
+#include <cstdio>
 
 /*
 * Namespace fio (file io).
 */
 namespace fio
 {
+#ifdef _WIN32
 	/*
 	* Our own definition for a file pointer.
 	*/
 	typedef HANDLE FileHandle;
+#else
+	/*
+	* Our own definition for a file pointer, a C stream without Win32.
+	*/
+	typedef FILE* FileHandle;
+	typedef uint32_t DWORD;
+
+	/*
+	* Win32 values of the share modes and attributes, which are ignored without Win32.
+	*/
+	constexpr DWORD FILE_SHARE_READ = 0x1, FILE_SHARE_WRITE = 0x2, FILE_SHARE_DELETE = 0x4;
+	constexpr DWORD FILE_ATTRIBUTE_HIDDEN = 0x2, FILE_ATTRIBUTE_NORMAL = 0x80;
+	constexpr DWORD FILE_FLAG_WRITE_THROUGH = 0x80000000, FILE_FLAG_OVERLAPPED = 0x40000000, FILE_FLAG_RANDOM_ACCESS = 0x10000000;
+	constexpr DWORD FILE_FLAG_SEQUENTIAL_SCAN = 0x08000000, FILE_FLAG_DELETE_ON_CLOSE = 0x04000000;
+#endif
 
 	enum class io_share_mode : DWORD
 	{
@@ -87,7 +87,7 @@ void GLbuffer::Write(size_t size, const void* src, GLenum usage) {
 }
 void GLbuffer::Write(size_t size, size_t offset, const void* src) {
 	glBindBuffer(m_Type, m_Buffer);
-	glBufferSubData(m_Buffer, offset, size, src);
+	glBufferSubData(m_Type, offset, size, src);
 	glBindBuffer(m_Type, 0);
 }
 
@@ -120,14 +120,18 @@ void GLshader::SetBufferFloat1(GLbuffer* buffer, uint idx, size_t stride) {
 	glDisableVertexAttribArray(idx);
 }
 void GLshader::SetBufferFloat2(GLbuffer* buffer, uint idx, size_t stride) {
-	buffer->Bind();
+	glBindVertexArray(m_VAO);
 	glEnableVertexAttribArray(idx);
+	buffer->Bind();
 	glVertexAttribPointer(idx, 2, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glBindVertexArray(0);
 }
 void GLshader::SetBufferFloat3(GLbuffer* buffer, uint idx, size_t stride) {
-	buffer->Bind();
+	glBindVertexArray(m_VAO);
 	glEnableVertexAttribArray(idx);
+	buffer->Bind();
 	glVertexAttribPointer(idx, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glBindVertexArray(0);
 }
 void GLshader::SetBufferFloat4(GLbuffer* buffer, uint idx, size_t stride) {
 	glBindVertexArray(m_VAO);
@@ -204,6 +208,20 @@ void GLshader::SetBufferUint4(GLbuffer* buffer, uint idx, size_t stride) {
 	glDisableVertexAttribArray(idx);
 }
 
+void GLshader::SetBufferColor(GLbuffer* buffer, uint idx, size_t stride) {
+	glBindVertexArray(m_VAO);
+	glEnableVertexAttribArray(idx);
+	buffer->Bind();
+	glVertexAttribPointer(idx, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)0);
+	glBindVertexArray(0);
+}
+
+void GLshader::SetDivisor(uint idx, uint divisor) {
+	glBindVertexArray(m_VAO);
+	glVertexAttribDivisor(idx, divisor);
+	glBindVertexArray(0);
+}
+
 void GLshader::SetUniformFloat(const char* name, float val) {
 	glUseProgram(m_Program);
 	glUniform1f(glGetUniformLocation(m_Program, name), val);
@@ -269,6 +287,11 @@ void GLshader::DrawTriangles(size_t count, GLbuffer* indexBuffer, GLenum idxType
 	indexBuffer->Bind();									// Bind index buffer.
 	glDrawElements(GL_TRIANGLES, count, idxType, NULL);		// Draw call.
 }
+void GLshader::DrawTrianglesInstanced(size_t count, size_t instances, GLbuffer* indexBuffer, GLenum idxType) {
+
+	indexBuffer->Bind();															// Bind index buffer.
+	glDrawElementsInstanced(GL_TRIANGLES, count, idxType, NULL, instances);			// Draw call.
+}
 
 #pragma endregion
 
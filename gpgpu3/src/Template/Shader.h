@@ -73,6 +73,15 @@ public:
 	void SetBufferUint3(GLbuffer* buffer, uint idx, size_t stride = 0);
 	void SetBufferUint4(GLbuffer* buffer, uint idx, size_t stride = 0);
 
+	/*
+	* Binds a buffer of colours, four bytes each, read as a normalized vec4.
+	*/
+	void SetBufferColor(GLbuffer* buffer, uint idx, size_t stride = 0);
+	/*
+	* Sets the number of instances an attribute is advanced after, 0 to advance it every vertex.
+	*/
+	void SetDivisor(uint idx, uint divisor);
+
 	void SetUniformFloat(const char* name, float val);
 	void SetUniformVec2(const char* name, glm::vec2 val);
 	void SetUniformVec3(const char* name, glm::vec3 val);
@@ -88,6 +97,7 @@ public:
 
 	void DrawLines(size_t count, GLbuffer* indexBuffer, GLenum idxType);
 	void DrawTriangles(size_t count, GLbuffer* indexBuffer, GLenum idxType);
+	void DrawTrianglesInstanced(size_t count, size_t instances, GLbuffer* indexBuffer, GLenum idxType);
 
 	static void Finish() { glFinish(); }
 
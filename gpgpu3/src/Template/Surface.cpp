@@ -1,12 +1,34 @@
 #include "stdfax.h"
 #include "Surface.h"
+#include "Profiler.h"
 
+#include <algorithm>
 
-Surface::Surface(unsigned int width, unsigned int height)
-	: m_Width(width), m_Height(height) {
 
-	m_Pixels = (Color*)malloc(sizeof(Color) * width * height);
+Surface::Surface(unsigned int width, unsigned int height, bool headless)
+	: m_Width(width), m_Height(height), m_Headless(headless || HEADLESS_BUILD) {
 
+	// The initial content is undefined, so every tile starts out dirty.
+	m_TilesX = (width + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+	m_TilesY = (height + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+	unsigned int nTiles = m_TilesX * m_TilesY;
+	for (unsigned int b = 0; b < SURFACE_PBO_COUNT; b++)
+	{
+		m_PixelTiles[b] = new unsigned char[nTiles];
+		memset(m_PixelTiles[b], 1, nTiles);
+	}
+	m_TextureTiles = new unsigned char[nTiles];
+	m_UploadTiles = new unsigned char[nTiles];
+	memset(m_TextureTiles, 1, nTiles);
+	m_DirtyTiles = m_PixelTiles[0];
+
+	if (m_Headless)
+	{
+		m_Pixels = (Color*)malloc(sizeof(Color) * width * height);
+		return;
+	}
+
+#if !HEADLESS_BUILD
 	// Create our render texture.
 	glGenTextures(1, &m_RenderTexture);
 	glBindTexture(GL_TEXTURE_2D, m_RenderTexture);
@@ -15,9 +37,33 @@ Surface::Surface(unsigned int width, unsigned int height)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	// Match the uploaded format, such that the driver does not have to convert the pixels.
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
 
 	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Create the pixel buffers the texture is uploaded from.
+	GLsizeiptr size = sizeof(Color) * width * height;
+	bool persistent = GLEW_ARB_buffer_storage;
+	glGenBuffers(SURFACE_PBO_COUNT, m_PixelBuffers);
+	for (unsigned int b = 0; b < SURFACE_PBO_COUNT; b++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_PixelBuffers[b]);
+		if (persistent)
+		{
+			// Client storage keeps the buffer in cached system memory, which suits the scattered writes of the rasterizer.
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags | GL_CLIENT_STORAGE_BIT);
+			m_MappedPixels[b] = (Color*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+			if (!m_MappedPixels[b]) FATAL_ERROR("Failed to map pixel buffer.");
+		}
+		else glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// Render straight into the mapped memory when possible.
+	m_Pixels = persistent ? m_MappedPixels[0] : (Color*)malloc(size);
+
 	// Initialize our shader.
 	m_Shader = new GLshader("simple_tex.vert", "simple_tex.frag");
 	m_VertexBuffer = new GLbuffer(GL_ARRAY_BUFFER, sizeof(c_RenderQuad));
@@ -33,49 +79,125 @@ Surface::Surface(unsigned int width, unsigned int height)
 	m_Shader->SetBufferFloat3(m_VertexBuffer, 0, 0);
 	m_Shader->SetBufferFloat2(m_UVbuffer, 1, 0);
 	m_Shader->Deactivate();
-
+#endif
 }
 
 Surface::~Surface() {
+#if !HEADLESS_BUILD
 	delete m_VertexBuffer;
 	delete m_UVbuffer;
 	delete m_IndexBuffer;
 	delete m_Shader;
 
-	free(m_Pixels);
+	if (!m_Headless)
+	{
+		for (unsigned int b = 0; b < SURFACE_PBO_COUNT; b++)
+		{
+			if (m_UploadFences[b]) glDeleteSync(m_UploadFences[b]);
+			if (!m_MappedPixels[b]) continue;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_PixelBuffers[b]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(SURFACE_PBO_COUNT, m_PixelBuffers);
+		glDeleteTextures(1, &m_RenderTexture);
+	}
+#endif
+
+	// Mapped memory is released along with the buffers.
+	if (!m_MappedPixels[0]) free(m_Pixels);
+
+	for (unsigned int b = 0; b < SURFACE_PBO_COUNT; b++) delete[] m_PixelTiles[b];
+	delete[] m_TextureTiles;
+	delete[] m_UploadTiles;
 }
 
 void Surface::Draw() {
+	if (m_Headless) return;
+#if !HEADLESS_BUILD
 	m_Shader->Activate();
 	glBindTexture(GL_TEXTURE_2D, m_RenderTexture);
 	m_Shader->DrawTriangles(6, m_IndexBuffer, GL_UNSIGNED_INT);
 	m_Shader->Deactivate();
+#endif
 }
 
 void Surface::SyncPixels()
 {
+	if (m_Headless) return;
+#if !HEADLESS_BUILD
+	PROFILE_SCOPE("SyncPixels");
+
+	// Tiles drawn to this frame changed, and so did the tiles that still show the last upload, as they are cleared now.
+	unsigned int nTiles = m_TilesX * m_TilesY;
+	for (unsigned int t = 0; t < nTiles; t++) m_UploadTiles[t] = m_DirtyTiles[t] | m_TextureTiles[t];
+	memcpy(m_TextureTiles, m_DirtyTiles, nTiles);
+	MergeTiles(m_UploadTiles, m_Rects);
+
+	size_t uploaded = 0;
+	for (const Rect& r : m_Rects) uploaded += (size_t)r.width * r.height;
+	m_UploadCoverage = (float)uploaded / ((float)m_Width * m_Height);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_PixelBuffers[m_CurrentBuffer]);
+	if (!m_MappedPixels[m_CurrentBuffer] && !m_Rects.empty())
+	{
+		// Orphan the buffer, such that the driver hands out fresh memory instead of waiting for the previous upload.
+		// The rectangles keep their place in the buffer, so both paths upload with the same offsets.
+		GLsizeiptr size = sizeof(Color) * m_Width * m_Height;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		Color* mapped = (Color*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (!mapped) FATAL_ERROR("Failed to map pixel buffer.");
+		for (const Rect& r : m_Rects)
+			for (uint y = r.y; y < r.y + r.height; y++) memcpy(&mapped[r.x + y * m_Width], &m_Pixels[r.x + y * m_Width], sizeof(Color) * r.width);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+	// With a pixel buffer bound, the upload reads from the buffer and returns before the copy has completed.
 	glBindTexture(GL_TEXTURE_2D, m_RenderTexture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)m_Pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_Width);
+	for (const Rect& r : m_Rects)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)(sizeof(Color) * (r.x + (size_t)r.y * m_Width)));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	glFinish();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	m_UploadFences[m_CurrentBuffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_CurrentBuffer = (m_CurrentBuffer + 1) % SURFACE_PBO_COUNT;
+
+	// The next frame goes to the oldest buffer of the ring, whose upload has normally completed long ago.
+	if (GLsync fence = m_UploadFences[m_CurrentBuffer])
+	{
+		PROFILE_SCOPE("WaitForUpload");
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		m_UploadFences[m_CurrentBuffer] = nullptr;
+	}
+	if (m_MappedPixels[m_CurrentBuffer]) m_Pixels = m_MappedPixels[m_CurrentBuffer], m_DirtyTiles = m_PixelTiles[m_CurrentBuffer];
+#endif
 }
 
+#if !HEADLESS_BUILD
 void Surface::SyncPixels(uint dx, uint dy, uint width, uint height, Color* pixels)
 {
+	if (m_Headless) return;
+	PROFILE_SCOPE("SyncPixels");
+
 	glBindTexture(GL_TEXTURE_2D, m_RenderTexture);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, dx, dy, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)pixels);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	glFinish();
 }
+#endif
 
 void Surface::PlotPixel(Color color, uint x, uint y)
 {
 	m_Pixels[x + y * m_Width] = color;
+	m_DirtyTiles[x / SURFACE_TILE_SIZE + y / SURFACE_TILE_SIZE * m_TilesX] = 1;
 }
 
 void Surface::PlotPixels(Color* colors)
 {
 	for (int y = 0; y < m_Height; y++) memcpy(m_Pixels, &colors[y * m_Width], sizeof(Color) * m_Width);
+	MarkDirty(0, 0, m_Width, m_Height);
 }
 
 void Surface::PlotPixels(Color* colors, uint dx, uint dy, uint width, uint height) {
@@ -89,14 +211,71 @@ void Surface::PlotPixels(Color* colors, uint dx, uint dy, uint width, uint heigh
 		// Compute the screen pixel index.
 		memcpy(&m_Pixels[dx + (dy + y) * m_Width], &colors[y * width], sizeof(Color) * width);
 	}
+	MarkDirty(dx, dy, width, height);
+}
+
+void Surface::MarkDirty(uint dx, uint dy, uint width, uint height)
+{
+	if (width == 0 || height == 0) return;
+
+	uint tx0 = dx / SURFACE_TILE_SIZE, tx1 = (dx + width - 1) / SURFACE_TILE_SIZE;
+	uint ty0 = dy / SURFACE_TILE_SIZE, ty1 = (dy + height - 1) / SURFACE_TILE_SIZE;
+	for (uint ty = ty0; ty <= ty1; ty++)
+		for (uint tx = tx0; tx <= tx1; tx++) m_DirtyTiles[tx + ty * m_TilesX] = 1;
 }
 
 void Surface::Clear()
 {
-	// Loop over each row of pixels.
-	for (int y = 0; y < m_Height; y++)
+	PROFILE_SCOPE("Clear");
+
+	// Only the tiles drawn to since the last clear of this pixel array hold pixels.
+	MergeTiles(m_DirtyTiles, m_Rects);
+	memset(m_DirtyTiles, 0, m_TilesX * m_TilesY);
+
+	size_t cleared = 0;
+	for (const Rect& r : m_Rects)
 	{
-		// Compute the screen pixel index.
-		memset(&m_Pixels[y * m_Width], 0, sizeof(Color) * m_Width);
+		// Loop over each row of pixels.
+		for (uint y = r.y; y < r.y + r.height; y++) std::fill_n(&m_Pixels[r.x + y * m_Width], r.width, Color());
+		cleared += (size_t)r.width * r.height;
+	}
+	m_ClearCoverage = (float)cleared / ((float)m_Width * m_Height);
+}
+
+void Surface::MergeTiles(const unsigned char* tiles, std::vector<Rect>& rects) const
+{
+	rects.clear();
+
+	// Rectangles reaching the previous row of tiles, ordered by x.
+	std::vector<size_t> open, next;
+	for (uint ty = 0; ty < m_TilesY; ty++)
+	{
+		uint y = ty * SURFACE_TILE_SIZE, height = glm::min(m_Height - y, (uint)SURFACE_TILE_SIZE);
+		const unsigned char* row = &tiles[ty * m_TilesX];
+
+		next.clear();
+		size_t o = 0;
+		for (uint tx = 0; tx < m_TilesX; tx++)
+		{
+			if (!row[tx]) continue;
+			uint start = tx;
+			while (tx + 1 < m_TilesX && row[tx + 1]) tx++;
+
+			uint x = start * SURFACE_TILE_SIZE, width = glm::min((tx + 1) * SURFACE_TILE_SIZE, m_Width) - x;
+
+			// Extend the rectangle above when it spans the same run.
+			while (o < open.size() && rects[open[o]].x < x) o++;
+			if (o < open.size() && rects[open[o]].x == x && rects[open[o]].width == width)
+			{
+				rects[open[o]].height += height;
+				next.push_back(open[o++]);
+			}
+			else
+			{
+				rects.push_back({ x, y, width, height });
+				next.push_back(rects.size() - 1);
+			}
+		}
+		std::swap(open, next);
 	}
 }
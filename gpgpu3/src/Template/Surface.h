@@ -1,5 +1,10 @@
 #pragma once
+#if !HEADLESS_BUILD
 #include "Shader.h"
+#endif
+
+#define SURFACE_PBO_COUNT 3		// Number of pixel buffers the texture uploads rotate through.
+#define SURFACE_TILE_SIZE 64	// Width and height of the tiles whose changes are tracked.
 
 /*
 * Surface used for rendering to the screen.An OpenGL texture is used to render to a quad.
@@ -12,8 +17,9 @@ public:
 	* Initialize the surface according to the specified size.
 	* @param[in] width		Surface width.
 	* @param[in] height		Surface height.
+	* @param[in] headless	Only allocate the pixels in memory, without any OpenGL resources.
 	*/
-	Surface(unsigned int width, unsigned int height);
+	Surface(unsigned int width, unsigned int height, bool headless = false);
 	~Surface();
 
 	/*
@@ -22,9 +28,11 @@ public:
 	void Draw();
 
 	/*
-	* Synchronize the entire pixel array to the GPU.
+	* Synchronize the pixel array to the GPU. Only the tiles drawn to since the last clear, and those that
+	* were drawn to in the previous upload, are uploaded. The upload runs asynchronously and overlaps the next frame.
 	*/
 	void SyncPixels();
+#if !HEADLESS_BUILD
 	/*
 	* Synchronize the defined area to the GPU.
 	* @param[in] colors		Colors to write to the surface.
@@ -35,6 +43,7 @@ public:
 	* @param[in] pixels		Array containing pixel data.
 	*/
 	void SyncPixels(uint dx, uint dy, uint width, uint height, Color* pixels);
+#endif
 
 	/*
 	* Plot a single pixel.
@@ -58,30 +67,72 @@ public:
 	*/
 	void PlotPixels(Color* colors, uint dx, uint dy, uint width, uint height);
 
+	/*
+	* Marks an area as drawn to, such that it is cleared and uploaded. Only needed when writing to the pixel
+	* buffer directly, the plot functions mark the pixels they write.
+	* @param[in] dx			x-offset.
+	* @param[in] dy			y-offset.
+	* @param[in] width		Number of pixels in x-direction.
+	* @param[in] height		Number of pixels in y-direction.
+	*/
+	void MarkDirty(uint dx, uint dy, uint width, uint height);
+
 	/* 
 	* Sets all pixels on the screen to black. Make sure to call SyncPixels to update device texture.
+	* Only the tiles drawn to since the last clear are written.
 	*/
 	void Clear();
 
+	/*
+	* Retrieve the fraction of the surface written by the last clear.
+	*/
+	float ClearCoverage() const { return m_ClearCoverage; }
+	/*
+	* Retrieve the fraction of the surface sent to the GPU by the last upload.
+	*/
+	float UploadCoverage() const { return m_UploadCoverage; }
+
 	/*
 	* Retrieve the surface's pixel buffer for direct manipulation.
 	* Note that the pixels need to be synced to the GPU before applying
-	* the changes visually.
+	* the changes visually. The buffer may move to another pixel buffer
+	* of the ring after every sync, holding the pixels of an older frame,
+	* so retrieve it again and redraw the frame after syncing.
 	*
 	* @returns			Pointer to the pixels.
 	*/
 	Color* PixelBuffer() { return m_Pixels; };
 
+#if !HEADLESS_BUILD
 	inline GLuint& GetRenderTexture() { return m_RenderTexture; }
+#endif
 	inline unsigned int GetWidth() { return m_Width; }
 	inline unsigned int GetHeight() { return m_Height; }
 
 private:
+	/*
+	* Area of the surface in pixels.
+	*/
+	struct Rect { uint x, y, width, height; };
+
+	/*
+	* Merges the marked tiles into rectangles. Runs of tiles in a row form a rectangle,
+	* which grows downwards as long as the rows below hold the same run.
+	* @param[in] tiles		Flag per tile.
+	* @param[out] rects		Rectangles covering exactly the marked tiles.
+	*/
+	void MergeTiles(const unsigned char* tiles, std::vector<Rect>& rects) const;
+
 	/*
 	* Surface dimensions.
 	*/
 	unsigned int m_Width, m_Height;
+	/*
+	* Surface without OpenGL resources, drawing and syncing do nothing.
+	*/
+	bool m_Headless;
 
+#if !HEADLESS_BUILD
 	/*
 	* Shader used for rendering.
 	*/
@@ -124,9 +175,63 @@ private:
 	const GLuint c_Indices[6] = {
 		0, 1, 2, 3, 4, 5
 	};
+#endif
 
 	/*
-	* Array containing our CPU pixel data.
+	* Array containing our CPU pixel data. With persistently mapped pixel buffers,
+	* this points into the mapped buffer the current frame is written to.
 	*/
 	Color* m_Pixels = nullptr;
+
+#if !HEADLESS_BUILD
+	/*
+	* Ring of pixel buffers the texture is uploaded from. While the GPU copies
+	* one buffer into the texture, the next frame is written to another one.
+	*/
+	GLuint m_PixelBuffers[SURFACE_PBO_COUNT] = {};
+	/*
+	* Fences signalled once the upload from a pixel buffer has completed.
+	*/
+	GLsync m_UploadFences[SURFACE_PBO_COUNT] = {};
+#endif
+	/*
+	* Pixel buffer the current frame is uploaded from.
+	*/
+	unsigned int m_CurrentBuffer = 0;
+	/*
+	* Mapped memory of every pixel buffer, only set when the buffers are
+	* persistently mapped (GL_ARB_buffer_storage). Otherwise the buffers are
+	* orphaned and filled from m_Pixels on every sync.
+	*/
+	Color* m_MappedPixels[SURFACE_PBO_COUNT] = {};
+
+	/*
+	* Number of tiles in x and y-direction.
+	*/
+	unsigned int m_TilesX, m_TilesY;
+	/*
+	* Tiles drawn to since the last clear, for every pixel array. Without persistent
+	* mapping only the first is used, as there is a single pixel array.
+	*/
+	unsigned char* m_PixelTiles[SURFACE_PBO_COUNT] = {};
+	/*
+	* Tiles of the pixel array currently drawn to.
+	*/
+	unsigned char* m_DirtyTiles = nullptr;
+	/*
+	* Tiles holding pixels in the texture, that is the tiles drawn to before the last upload.
+	*/
+	unsigned char* m_TextureTiles = nullptr;
+	/*
+	* Tiles sent by the current upload.
+	*/
+	unsigned char* m_UploadTiles = nullptr;
+	/*
+	* Rectangles of the current clear or upload.
+	*/
+	std::vector<Rect> m_Rects;
+	/*
+	* Fraction of the surface written by the last clear and sent by the last upload.
+	*/
+	float m_ClearCoverage = 1.0f, m_UploadCoverage = 1.0f;
 };
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "stdfax.h"
+#include "clGridBuilder.h"
+
+clGridBuilder::clGridBuilder(clContext* context, uint capacity, uint resolution)
+	: m_Capacity(capacity), m_Resolution(resolution)
+{
+	// Sort as many digits as the largest cell index has.
+	uint nCells = resolution * resolution, keyBits = 1;
+	while ((nCells - 1) >> keyBits) keyBits++;
+	m_Passes = (keyBits + GRID_RADIX_BITS - 1) / GRID_RADIX_BITS;
+
+	// The kernels size their local memory by the same values the builder enqueues with.
+	m_Program = new clProgram(context, "grid.cl", {
+		{ "RADIX_BITS", std::to_string(GRID_RADIX_BITS) },
+		{ "GRID_LOCAL_SIZE", std::to_string(GRID_LOCAL_SIZE) } });
+	m_ComputeKeys = new clKernel(m_Program, "ComputeKeys");
+	m_RadixHistogram = new clKernel(m_Program, "RadixHistogram");
+	m_RadixScatter = new clKernel(m_Program, "RadixScatter");
+	m_ScanBlocks = new clKernel(m_Program, "ScanBlocks");
+	m_AddBlockSums = new clKernel(m_Program, "AddBlockSums");
+	m_FindCellStarts = new clKernel(m_Program, "FindCellStarts");
+
+	m_Cells = new clBuffer(context, sizeof(uint) * capacity, BufferFlags::READ_WRITE);
+	m_Indices = new clBuffer(context, sizeof(uint) * capacity, BufferFlags::READ_WRITE);
+	for (int b = 0; b < 2; b++)
+	{
+		m_Keys[b] = new clBuffer(context, sizeof(uint) * capacity, BufferFlags::READ_WRITE);
+		m_Values[b] = new clBuffer(context, sizeof(uint) * capacity, BufferFlags::READ_WRITE);
+	}
+	m_CellStart = new clBuffer(context, sizeof(uint) * (nCells + 1), BufferFlags::READ_WRITE);
+
+	// One histogram per block of keys, and one level of block sums per scan recursion.
+	uint nBlocks = (capacity + GRID_LOCAL_SIZE - 1) / GRID_LOCAL_SIZE;
+	uint n = nBlocks * (1 << GRID_RADIX_BITS);
+	m_Histograms = new clBuffer(context, sizeof(uint) * n, BufferFlags::READ_WRITE);
+	do
+	{
+		n = (n + GRID_LOCAL_SIZE - 1) / GRID_LOCAL_SIZE;
+		m_BlockSums.push_back(new clBuffer(context, sizeof(uint) * n, BufferFlags::READ_WRITE));
+	} while (n > 1);
+}
+
+clGridBuilder::~clGridBuilder()
+{
+	delete m_ComputeKeys;
+	delete m_RadixHistogram;
+	delete m_RadixScatter;
+	delete m_ScanBlocks;
+	delete m_AddBlockSums;
+	delete m_FindCellStarts;
+	delete m_Program;
+
+	delete m_Cells;
+	delete m_Indices;
+	for (int b = 0; b < 2; b++) delete m_Keys[b], delete m_Values[b];
+	delete m_Histograms;
+	for (clBuffer* sums : m_BlockSums) delete sums;
+	delete m_CellStart;
+}
+
+void clGridBuilder::Build(clCommandQueue* queue, clBuffer* posX, clBuffer* posY, uint count, uint width, uint height, std::vector<gpu_event>* events)
+{
+	uint cellWidth = width / m_Resolution, cellHeight = height / m_Resolution;
+	uint nCells = m_Resolution * m_Resolution;
+	uint nBlocks = (count + GRID_LOCAL_SIZE - 1) / GRID_LOCAL_SIZE;
+
+	m_ComputeKeys->SetArgument(0, posX);
+	m_ComputeKeys->SetArgument(1, posY);
+	m_ComputeKeys->SetArgument(2, m_Cells);
+	m_ComputeKeys->SetArgument(3, m_Indices);
+	m_ComputeKeys->SetArgument(4, &count, sizeof(uint));
+	m_ComputeKeys->SetArgument(5, &cellWidth, sizeof(uint));
+	m_ComputeKeys->SetArgument(6, &cellHeight, sizeof(uint));
+	m_ComputeKeys->SetArgument(7, &m_Resolution, sizeof(uint));
+	Enqueue(queue, m_ComputeKeys, count, events);
+
+	// The first pass reads the unsorted pairs, which keeps the cell of every particle for later stages.
+	for (uint pass = 0; pass < m_Passes; pass++)
+	{
+		uint shift = pass * GRID_RADIX_BITS;
+		clBuffer* keysIn = pass == 0 ? m_Cells : m_Keys[(pass - 1) % 2];
+		clBuffer* valuesIn = pass == 0 ? m_Indices : m_Values[(pass - 1) % 2];
+
+		m_RadixHistogram->SetArgument(0, keysIn);
+		m_RadixHistogram->SetArgument(1, &count, sizeof(uint));
+		m_RadixHistogram->SetArgument(2, &shift, sizeof(uint));
+		m_RadixHistogram->SetArgument(3, m_Histograms);
+		Enqueue(queue, m_RadixHistogram, count, events);
+
+		Scan(queue, m_Histograms, nBlocks * (1 << GRID_RADIX_BITS), 0, events);
+
+		m_RadixScatter->SetArgument(0, keysIn);
+		m_RadixScatter->SetArgument(1, valuesIn);
+		m_RadixScatter->SetArgument(2, m_Keys[pass % 2]);
+		m_RadixScatter->SetArgument(3, m_Values[pass % 2]);
+		m_RadixScatter->SetArgument(4, &count, sizeof(uint));
+		m_RadixScatter->SetArgument(5, &shift, sizeof(uint));
+		m_RadixScatter->SetArgument(6, m_Histograms);
+		Enqueue(queue, m_RadixScatter, count, events);
+	}
+
+	m_FindCellStarts->SetArgument(0, m_Keys[(m_Passes - 1) % 2]);
+	m_FindCellStarts->SetArgument(1, &count, sizeof(uint));
+	m_FindCellStarts->SetArgument(2, &nCells, sizeof(uint));
+	m_FindCellStarts->SetArgument(3, m_CellStart);
+	Enqueue(queue, m_FindCellStarts, count + 1, events);
+}
+
+void clGridBuilder::Enqueue(clCommandQueue* queue, clKernel* kernel, uint count, std::vector<gpu_event>* events)
+{
+	size_t globalSize = (count + GRID_LOCAL_SIZE - 1) / GRID_LOCAL_SIZE * GRID_LOCAL_SIZE;
+
+	gpu_event kernelEvent;
+	kernel->Enqueue(queue, globalSize, GRID_LOCAL_SIZE, events ? &kernelEvent : NULL);
+	if (events) events->push_back(kernelEvent);
+}
+
+void clGridBuilder::Scan(clCommandQueue* queue, clBuffer* data, uint n, uint level, std::vector<gpu_event>* events)
+{
+	uint nBlocks = (n + GRID_LOCAL_SIZE - 1) / GRID_LOCAL_SIZE;
+
+	m_ScanBlocks->SetArgument(0, data);
+	m_ScanBlocks->SetArgument(1, &n, sizeof(uint));
+	m_ScanBlocks->SetArgument(2, m_BlockSums[level]);
+	Enqueue(queue, m_ScanBlocks, n, events);
+
+	// A single block is scanned completely, otherwise the block sums are scanned and added to their blocks.
+	if (nBlocks == 1) return;
+	Scan(queue, m_BlockSums[level], nBlocks, level + 1, events);
+
+	m_AddBlockSums->SetArgument(0, data);
+	m_AddBlockSums->SetArgument(1, &n, sizeof(uint));
+	m_AddBlockSums->SetArgument(2, m_BlockSums[level]);
+	Enqueue(queue, m_AddBlockSums, n, events);
+}
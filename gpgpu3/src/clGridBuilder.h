@@ -0,0 +1,84 @@
+#pragma once
+#include "clWorkSizes.h"
+
+/*
+* Builds a particle grid on an OpenCL device by sorting (cell, particle) pairs with an LSD radix sort. Every pass
+* counts the digits of each block in local memory, scans the counts of all blocks and moves the pairs to their
+* place. The sort is stable, so the grid equals the one of the CPU counting sort: the particles in cell c are
+* CellParticles()[CellStart()[c]] up to (but not including) CellParticles()[CellStart()[c + 1]], sorted by index.
+* Unlike per-cell counters, the sort takes no atomics on global memory and has no limit on the particles per cell.
+*/
+class clGridBuilder
+{
+public:
+	/*
+	* Creates the program and the buffers.
+	* @param[in] context			Valid OpenCL context.
+	* @param[in] capacity			Maximum number of particles.
+	* @param[in] resolution			Number of grid cells in x and y-direction.
+	*/
+	clGridBuilder(clContext* context, uint capacity, uint resolution);
+	~clGridBuilder();
+
+	/*
+	* Enqueues the construction of the grid.
+	* @param[in] queue				Valid command queue, the grid is ready once the queue reaches this point.
+	* @param[in] posX, posY			Particle positions in pixels.
+	* @param[in] count				Number of particles, at most the capacity.
+	* @param[in] width, height		Size of the area the particles move in, in pixels.
+	* @param[out] events			Optional, receives the profiling events of all commands. The caller releases them.
+	*/
+	void Build(clCommandQueue* queue, clBuffer* posX, clBuffer* posY, uint count, uint width, uint height, std::vector<gpu_event>* events = nullptr);
+
+	/*
+	* Retrieve the cell of every particle.
+	*/
+	clBuffer* ParticleCells() const { return m_Cells; }
+	/*
+	* Retrieve the particle indices sorted by cell.
+	*/
+	clBuffer* CellParticles() const { return m_Values[(m_Passes - 1) % 2]; }
+	/*
+	* Retrieve the start of every cell in CellParticles(), followed by the number of particles.
+	*/
+	clBuffer* CellStart() const { return m_CellStart; }
+	/*
+	* Retrieve the number of radix passes per build.
+	*/
+	uint Passes() const { return m_Passes; }
+
+private:
+	uint m_Capacity, m_Resolution, m_Passes;
+
+	clProgram* m_Program = nullptr;
+	clKernel* m_ComputeKeys = nullptr;
+	clKernel* m_RadixHistogram = nullptr;
+	clKernel* m_RadixScatter = nullptr;
+	clKernel* m_ScanBlocks = nullptr;
+	clKernel* m_AddBlockSums = nullptr;
+	clKernel* m_FindCellStarts = nullptr;
+
+	/* Cell and index of every particle, the input of the first pass. */
+	clBuffer* m_Cells = nullptr;
+	clBuffer* m_Indices = nullptr;
+	/* Sorted pairs, the passes alternate between both buffers. */
+	clBuffer* m_Keys[2] = {};
+	clBuffer* m_Values[2] = {};
+	/* Digit counts of every block, scanned into the output offsets. */
+	clBuffer* m_Histograms = nullptr;
+	/* Block sums of every level of the scan, the last level fits in a single block. */
+	std::vector<clBuffer*> m_BlockSums;
+	clBuffer* m_CellStart = nullptr;
+
+	/*
+	* Enqueues a kernel with a work-item per element, rounded up to whole work-groups.
+	*/
+	void Enqueue(clCommandQueue* queue, clKernel* kernel, uint count, std::vector<gpu_event>* events);
+	/*
+	* Enqueues an exclusive scan, recursing over the block sums.
+	* @param[in] data				Values to scan in place.
+	* @param[in] n					Number of values.
+	* @param[in] level				Level of the block sums to use.
+	*/
+	void Scan(clCommandQueue* queue, clBuffer* data, uint n, uint level, std::vector<gpu_event>* events);
+};
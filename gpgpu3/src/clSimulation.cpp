@@ -0,0 +1,237 @@
+#include "stdfax.h"
+#include "clSimulation.h"
+#include "Profiler.h"
+
+clSimulation::clSimulation(clContext* context, uint count, uint resolution, uint width, uint height)
+	: m_Count(count), m_Resolution(resolution), m_Width(width), m_Height(height)
+{
+	// Stages are timed with the events of their commands.
+	m_Queue = new clCommandQueue(context, false, true);
+	m_Programs = new clProgramVariants(context, "particles.cl");
+
+	m_PosX = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_PosY = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_VelX = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_VelY = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_Radius = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_ONLY);
+	m_InvMass = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_ONLY);
+	m_PrevX = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_PrevY = new clBuffer(context, sizeof(float) * count, BufferFlags::READ_WRITE);
+	m_Color = new clBuffer(context, sizeof(uint) * count, BufferFlags::WRITE_ONLY);
+	m_GridBuilder = new clGridBuilder(context, count, resolution);
+
+	// Start with the generic variant, the specialized one replaces it once it has been built in the background.
+	m_Specialization = { { "GRID_RESOLUTION", std::to_string(resolution) }, { "PARTICLE_COUNT", std::to_string(count) } };
+	CreateKernels(m_Programs->Get(clDefines()));
+	m_Programs->Request(m_Specialization);
+}
+
+clSimulation::~clSimulation()
+{
+	// Nothing may still refer to the buffers.
+	m_Queue->Synchronize();
+	CollectStageTimes();
+
+	DeleteKernels();
+
+	delete m_PosX;
+	delete m_PosY;
+	delete m_VelX;
+	delete m_VelY;
+	delete m_Radius;
+	delete m_InvMass;
+	delete m_PrevX;
+	delete m_PrevY;
+	delete m_Color;
+	delete m_GridBuilder;
+
+	delete m_Programs;
+	delete m_Queue;
+}
+
+void clSimulation::Upload(const ParticleStore& particles)
+{
+	PROFILE_SCOPE("clUpload");
+
+	// The copies are non-blocking, so the host arrays must stay alive until the queue finished.
+	m_PosX->CopyToDevice(m_Queue, particles.posX, false);
+	m_PosY->CopyToDevice(m_Queue, particles.posY, false);
+	m_VelX->CopyToDevice(m_Queue, particles.velX, false);
+	m_VelY->CopyToDevice(m_Queue, particles.velY, false);
+	m_Radius->CopyToDevice(m_Queue, particles.radius, false);
+	m_InvMass->CopyToDevice(m_Queue, particles.invMass, false);
+	m_Queue->Synchronize();
+}
+
+void clSimulation::Download(ParticleStore& particles)
+{
+	PROFILE_SCOPE("clDownload");
+
+	m_PosX->CopyToHost(m_Queue, particles.posX, false);
+	m_PosY->CopyToHost(m_Queue, particles.posY, false);
+	m_VelX->CopyToHost(m_Queue, particles.velX, false);
+	m_VelY->CopyToHost(m_Queue, particles.velY, false);
+	m_Queue->Synchronize();
+	CollectStageTimes();
+}
+
+void clSimulation::BuildGrid()
+{
+	// Commands enqueued with the generic kernels keep them alive until they ran.
+	if (!m_Specialized)
+		if (clProgram* program = m_Programs->Request(m_Specialization))
+		{
+			DeleteKernels();
+			CreateKernels(program);
+			m_Specialized = true;
+		}
+
+	Enqueue(m_KeepPositions, m_Count, clStage::GRID);
+
+	std::vector<gpu_event> events;
+	m_GridBuilder->Build(m_Queue, m_PosX, m_PosY, m_Count, m_Width, m_Height, &events);
+	for (gpu_event e : events) m_Events.emplace_back(clStage::GRID, e);
+}
+
+void clSimulation::Collide(float dt)
+{
+	// One work-item per cell of a colour class, the classes run one after another in the same order as on the CPU.
+	// Rounded up for odd resolutions, the kernel skips the work-items beyond the grid.
+	uint perRow = (m_Resolution + 2) / 3;
+	m_CollideCells->SetArgument(11, &dt, sizeof(float));
+	for (uint cy = 0; cy < 2; cy++)
+		for (uint cx = 0; cx < 3; cx++)
+		{
+			m_CollideCells->SetArgument(9, &cx, sizeof(uint));
+			m_CollideCells->SetArgument(10, &cy, sizeof(uint));
+			Enqueue(m_CollideCells, perRow * ((m_Resolution + 1) / 2), clStage::COLLISIONS);
+		}
+}
+
+void clSimulation::ApplyInput(glm::vec2 cursor, float dt)
+{
+	// The same cells around the cursor as Game::HandleUserInput.
+	int res = (int)m_Resolution;
+	int gx = res * cursor.x / m_Width;
+	int gy = res * cursor.y / m_Height;
+
+	int xmin = glm::max(0, gx - 5);
+	int xmax = glm::min(res - 1, gx + 6);
+	int ymin = glm::max(0, gy - 2);
+	int ymax = glm::min(res - 1, gy + 3);
+
+	m_ApplyInput->SetArgument(7, &xmin, sizeof(int));
+	m_ApplyInput->SetArgument(8, &xmax, sizeof(int));
+	m_ApplyInput->SetArgument(9, &ymin, sizeof(int));
+	m_ApplyInput->SetArgument(10, &ymax, sizeof(int));
+	m_ApplyInput->SetArgument(11, &cursor.x, sizeof(float));
+	m_ApplyInput->SetArgument(12, &cursor.y, sizeof(float));
+	m_ApplyInput->SetArgument(13, &dt, sizeof(float));
+	Enqueue(m_ApplyInput, m_Count, clStage::INPUT);
+}
+
+void clSimulation::Integrate(float dt)
+{
+	m_Integrate->SetArgument(8, &dt, sizeof(float));
+	Enqueue(m_Integrate, m_Count, clStage::INTEGRATE);
+}
+
+void clSimulation::ReadSnapshot(float* prevX, float* prevY, float* posX, float* posY, float* radius, uint* color)
+{
+	PROFILE_SCOPE("clReadSnapshot");
+
+	Enqueue(m_WriteColors, m_Count, clStage::READBACK);
+
+	// Only the last read blocks, the queue executes the commands in order.
+	clBuffer* buffers[6] = { m_PrevX, m_PrevY, m_PosX, m_PosY, m_Radius, m_Color };
+	void* targets[6] = { prevX, prevY, posX, posY, radius, color };
+	for (int b = 0; b < 6; b++)
+	{
+		gpu_event readEvent;
+		buffers[b]->CopyToHost(m_Queue, targets[b], b == 5, &readEvent);
+		m_Events.emplace_back(clStage::READBACK, readEvent);
+	}
+
+	CollectStageTimes();
+}
+
+void clSimulation::CreateKernels(clProgram* program)
+{
+	m_KeepPositions = new clKernel(program, "KeepPositions");
+	m_CollideCells = new clKernel(program, "CollideCells");
+	m_ApplyInput = new clKernel(program, "ApplyInput");
+	m_Integrate = new clKernel(program, "Integrate");
+	m_WriteColors = new clKernel(program, "WriteColors");
+
+	// The buffers never change, so only the per-tick arguments are set when enqueueing.
+	float fWidth = (float)m_Width, fHeight = (float)m_Height;
+
+	m_KeepPositions->SetArgument(0, m_PosX);
+	m_KeepPositions->SetArgument(1, m_PosY);
+	m_KeepPositions->SetArgument(2, m_PrevX);
+	m_KeepPositions->SetArgument(3, m_PrevY);
+	m_KeepPositions->SetArgument(4, &m_Count, sizeof(uint));
+
+	m_CollideCells->SetArgument(0, m_PosX);
+	m_CollideCells->SetArgument(1, m_PosY);
+	m_CollideCells->SetArgument(2, m_VelX);
+	m_CollideCells->SetArgument(3, m_VelY);
+	m_CollideCells->SetArgument(4, m_Radius);
+	m_CollideCells->SetArgument(5, m_InvMass);
+	m_CollideCells->SetArgument(6, m_GridBuilder->CellStart());
+	m_CollideCells->SetArgument(7, m_GridBuilder->CellParticles());
+	m_CollideCells->SetArgument(8, &m_Resolution, sizeof(uint));
+
+	m_ApplyInput->SetArgument(0, m_PosX);
+	m_ApplyInput->SetArgument(1, m_PosY);
+	m_ApplyInput->SetArgument(2, m_VelX);
+	m_ApplyInput->SetArgument(3, m_VelY);
+	m_ApplyInput->SetArgument(4, m_GridBuilder->ParticleCells());
+	m_ApplyInput->SetArgument(5, &m_Count, sizeof(uint));
+	m_ApplyInput->SetArgument(6, &m_Resolution, sizeof(uint));
+
+	m_Integrate->SetArgument(0, m_PosX);
+	m_Integrate->SetArgument(1, m_PosY);
+	m_Integrate->SetArgument(2, m_VelX);
+	m_Integrate->SetArgument(3, m_VelY);
+	m_Integrate->SetArgument(4, m_Radius);
+	m_Integrate->SetArgument(5, &m_Count, sizeof(uint));
+	m_Integrate->SetArgument(6, &fWidth, sizeof(float));
+	m_Integrate->SetArgument(7, &fHeight, sizeof(float));
+
+	m_WriteColors->SetArgument(0, m_VelX);
+	m_WriteColors->SetArgument(1, m_VelY);
+	m_WriteColors->SetArgument(2, m_Color);
+	m_WriteColors->SetArgument(3, &m_Count, sizeof(uint));
+}
+
+void clSimulation::DeleteKernels()
+{
+	delete m_KeepPositions;
+	delete m_CollideCells;
+	delete m_ApplyInput;
+	delete m_Integrate;
+	delete m_WriteColors;
+}
+
+void clSimulation::Enqueue(clKernel* kernel, uint count, clStage stage)
+{
+	size_t globalSize = (count + CL_LOCAL_SIZE - 1) / CL_LOCAL_SIZE * CL_LOCAL_SIZE;
+
+	gpu_event kernelEvent;
+	kernel->Enqueue(m_Queue, globalSize, CL_LOCAL_SIZE, &kernelEvent);
+	m_Events.emplace_back(stage, kernelEvent);
+}
+
+void clSimulation::CollectStageTimes()
+{
+	if (m_Events.empty()) return;
+
+	memset(m_StageTimes, 0, sizeof(m_StageTimes));
+	for (std::pair<clStage, gpu_event>& e : m_Events)
+	{
+		m_StageTimes[(int)e.first] += (float)GetGPUCommandExecutionTime(e.second);
+		CL_ERROR(clReleaseEvent(e.second), "Failed to release event.");
+	}
+	m_Events.clear();
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "ParticleStore.h"
+#include "clGridBuilder.h"
+#include "clWorkSizes.h"
+
+/*
+* Stages of a device tick that are timed separately.
+*/
+enum class clStage : int
+{
+	/* Building the grid and keeping the positions at the start of the tick. */
+	GRID = 0,
+	/* Resolving the collisions in colour classes. */
+	COLLISIONS,
+	/* Forces applied by the user. */
+	INPUT,
+	/* Position update and boundary checks. */
+	INTEGRATE,
+	/* Colouring the particles and reading them back to the host. */
+	READBACK,
+	COUNT
+};
+
+/*
+* Particle simulation running on an OpenCL device. The particle state lives in device buffers across ticks, the
+* host only reads it back to draw it. Every stage mirrors the CPU simulation with the scalar narrow phase, without
+* Verlet lists, reordering or two-phase collisions: the grid holds the particles of every cell sorted by index and
+* the cells are processed in the same 3x2 colour classes, so both visit the colliding pairs in the same order.
+*/
+class clSimulation
+{
+public:
+	/*
+	* Creates the device buffers and kernels.
+	* @param[in] context			Valid OpenCL context.
+	* @param[in] count				Number of particles.
+	* @param[in] resolution			Number of grid cells in x and y-direction.
+	* @param[in] width, height		Size of the area the particles move in, in pixels.
+	*/
+	clSimulation(clContext* context, uint count, uint resolution, uint width, uint height);
+	~clSimulation();
+
+	/*
+	* Copies the particle state to the device. Blocks until the copy finished.
+	* @param[in] particles			Particle state of the size given on construction.
+	*/
+	void Upload(const ParticleStore& particles);
+	/*
+	* Copies the positions and velocities back to the host. Blocks until the device finished.
+	* @param[out] particles			Particle state of the size given on construction.
+	*/
+	void Download(ParticleStore& particles);
+
+	/*
+	* Fills the grid and keeps the positions at the start of the tick. Switches to the specialized kernels once they
+	* have been built, which only happens here as every tick starts with the grid.
+	*/
+	void BuildGrid();
+	/*
+	* Resolves the collisions of all particles. Expects an up-to-date grid.
+	*/
+	void Collide(float dt);
+	/*
+	* Pushes the particles around the cursor away from it. Expects an up-to-date grid.
+	* @param[in] cursor				Cursor position in pixels.
+	*/
+	void ApplyInput(glm::vec2 cursor, float dt);
+	/*
+	* Moves the particles and bounces them off the area boundaries.
+	*/
+	void Integrate(float dt);
+	/*
+	* Colours the particles and reads back everything needed to draw them. Blocks until the device finished, after
+	* which the stage times of the tick are available.
+	* @param[out] prevX, prevY		Positions at the start of the tick.
+	* @param[out] posX, posY		Positions at the end of the tick.
+	* @param[out] radius			Radii in pixels.
+	* @param[out] color				Colors packed as 0xRRGGBBAA.
+	*/
+	void ReadSnapshot(float* prevX, float* prevY, float* posX, float* posY, float* radius, uint* color);
+
+	/*
+	* Retrieve the time the device spent in a stage of the last tick that was read back.
+	* @param[in] stage				Device stage.
+	* @returns						Time in milliseconds.
+	*/
+	float StageTime(clStage stage) const { return m_StageTimes[(int)stage]; }
+	/*
+	* Checks if the kernels specialized for the particle count and grid resolution replaced the generic ones.
+	*/
+	bool Specialized() const { return m_Specialized; }
+
+private:
+	uint m_Count, m_Resolution, m_Width, m_Height;
+
+	clCommandQueue* m_Queue = nullptr;
+	/*
+	* Generic variant of the kernels, and the variant specialized for the particle count and grid resolution.
+	*/
+	clProgramVariants* m_Programs = nullptr;
+	clDefines m_Specialization;
+	bool m_Specialized = false;
+
+	/* Particle state. */
+	clBuffer* m_PosX = nullptr, * m_PosY = nullptr;
+	clBuffer* m_VelX = nullptr, * m_VelY = nullptr;
+	clBuffer* m_Radius = nullptr, * m_InvMass = nullptr;
+	/* Positions at the start of the tick and colours, only written for the renderer. */
+	clBuffer* m_PrevX = nullptr, * m_PrevY = nullptr;
+	clBuffer* m_Color = nullptr;
+	/*
+	* Builds the grid, stored like the CPU grid.
+	*/
+	clGridBuilder* m_GridBuilder = nullptr;
+
+	clKernel* m_KeepPositions = nullptr;
+	clKernel* m_CollideCells = nullptr;
+	clKernel* m_ApplyInput = nullptr;
+	clKernel* m_Integrate = nullptr;
+	clKernel* m_WriteColors = nullptr;
+
+	/*
+	* Profiling events of the commands enqueued since the last readback, along with their stage.
+	*/
+	std::vector<std::pair<clStage, gpu_event>> m_Events;
+	float m_StageTimes[(int)clStage::COUNT] = {};
+
+	/*
+	* Creates the kernels of a program variant and sets their fixed arguments.
+	*/
+	void CreateKernels(clProgram* program);
+	void DeleteKernels();
+	/*
+	* Enqueues a kernel with a work-item per element, rounded up to whole work-groups.
+	* @param[in] kernel				Kernel to run.
+	* @param[in] count				Number of elements.
+	* @param[in] stage				Stage the time of the kernel counts towards.
+	*/
+	void Enqueue(clKernel* kernel, uint count, clStage stage);
+	/*
+	* Sums the times of the finished commands per stage and releases their events.
+	*/
+	void CollectStageTimes();
+};
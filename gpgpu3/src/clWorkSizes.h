@@ -0,0 +1,8 @@
+#pragma once
+
+/*
+* Work sizes of the OpenCL kernels, shared by the classes enqueueing them and the tests emulating them on the host.
+*/
+#define CL_LOCAL_SIZE				64				// Work-group size of the kernels running one work-item per particle or cell.
+#define GRID_RADIX_BITS				4				// Bits of the cell index sorted per radix pass, passed on to grid.cl.
+#define GRID_LOCAL_SIZE				256				// Work-group size of the grid kernels, passed on to grid.cl.
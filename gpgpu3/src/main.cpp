@@ -0,0 +1,64 @@
+#include "stdfax.h"
+#include "Template/Application.h"
+
+int main(int argc, char** argv) {
+	// Configure the job system with: --workers <count> --placement <none|logical|physical|physical-only>
+	uint nWorkers = 0;
+	WorkerPlacement placement = WorkerPlacement::PHYSICAL_FIRST;
+	for (int a = 1; a + 1 < argc; a++) {
+		if (strcmp(argv[a], "--workers") == 0) nWorkers = (uint)atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--placement") == 0) {
+			const char* value = argv[a + 1];
+			if (strcmp(value, "none") == 0) placement = WorkerPlacement::NONE;
+			else if (strcmp(value, "logical") == 0) placement = WorkerPlacement::LOGICAL;
+			else if (strcmp(value, "physical") == 0) placement = WorkerPlacement::PHYSICAL_FIRST;
+			else if (strcmp(value, "physical-only") == 0) placement = WorkerPlacement::PHYSICAL_ONLY;
+		}
+	}
+	JobManager::Initialize(nWorkers, placement);
+
+	// Tick the simulation on the main thread, once per frame, when started with: --single-threaded
+	for (int a = 1; a < argc; a++)
+		if (strcmp(argv[a], "--single-threaded") == 0) Application::SetThreadedSimulation(false);
+
+#if !HEADLESS_BUILD
+	// Step the particles on the OpenCL device when started with: --opencl, or compare it against the CPU with: --opencl-validate
+	for (int a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "--opencl") == 0) Application::SetOpenCLSimulation(true);
+		else if (strcmp(argv[a], "--opencl-validate") == 0) Application::SetOpenCLSimulation(true, true);
+	}
+
+	// Compare the host and device grid construction without a window when started with: --grid-benchmark [iterations]
+	for (int a = 1; a < argc; a++)
+		if (strcmp(argv[a], "--grid-benchmark") == 0) {
+			uint iterations = a + 1 < argc ? (uint)atoi(argv[a + 1]) : 100;
+			Application::InitializeHeadless(4096, 4096);
+			Application::RunGridBenchmark(iterations > 0 ? iterations : 100);
+			JobManager::Terminate();
+			return 0;
+		}
+#endif
+
+	// Run a benchmark without a window when started with: --headless [frames]
+	for (int a = 1; a < argc; a++)
+		if (strcmp(argv[a], "--headless") == 0) {
+			uint frames = a + 1 < argc ? (uint)atoi(argv[a + 1]) : 1000;
+			Application::InitializeHeadless(4096, 4096);
+			Application::RunHeadless(frames > 0 ? frames : 1000);
+			JobManager::Terminate();
+			return 0;
+		}
+
+#if HEADLESS_BUILD
+	// There is no window to fall back to.
+	Application::InitializeHeadless(4096, 4096);
+	Application::RunHeadless(1000);
+#else
+	Application::Initialize(4096, 4096);
+	Application::Run();
+#endif
+
+	// The workers wait on the job system's condition variable, which must outlive them.
+	JobManager::Terminate();
+	return 0;
+}
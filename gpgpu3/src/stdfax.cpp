@@ -1,8 +1,11 @@
 #include "stdfax.h"
+#include "Profiler.h"
+#include "Template/IOUtils.h"
 #include <stdarg.h>     /* va_list, va_start, va_arg, va_end */
 #include <fstream>
+#include <algorithm>
+#include <chrono>
 
-#define MAX_JOBS 1024
 
 
 
@@ -38,6 +41,7 @@ std::string readFile(const char* filePath) {
 }
 
 
+#if !HEADLESS_BUILD
 #pragma region GLdebug
 
 const char* DebugTypeToString(GLenum type) {
@@ -94,6 +98,7 @@ void DisableGLdebugInfo() {
 	glDebugMessageCallback(nullptr, 0);
 }
 #pragma endregion
+#endif
 
 #pragma region Color
 
@@ -157,7 +162,7 @@ Color Color::operator-=(Color rhs) {
 
 #pragma endregion
 
-
+#if !HEADLESS_BUILD
 /*
 * Array containing human-friendly names for OpenCL error codes.
 * Source: https://github.com/martijnberger/clew/blob/master/src/clew.c
@@ -298,30 +303,45 @@ void clContext::GetPlatformAndDevice() {
 	// Retrieve all platforms for the system.
 	cl_uint platformCount;
 
-	(clGetPlatformIDs(0, NULL, &platformCount), "unable to retrieve platforms");
+	CL_ERROR(clGetPlatformIDs(0, NULL, &platformCount), "unable to retrieve platforms");
 
 	cl_platform_id* platforms = new cl_platform_id[platformCount];
 	CL_ERROR(clGetPlatformIDs(platformCount, platforms, NULL), "unable to retrieve platforms");
 
+	// Prefer the first Nvidia or AMD GPU, then any GPU, then any device at all (e.g. a CPU implementation).
+	// A platform without a matching device is skipped instead of failing.
 	char pInfo[512];
-	// Retrieve the first Nvidia or AMD GPU that we can find.
-	for (cl_uint i = 0; i < platformCount; i++) {
-		if (CL_ERROR(clGetPlatformInfo(platforms[i], CL_PLATFORM_VENDOR, 512, &pInfo, NULL), "unable to retrieve platform info"))
-			// Remove this line if you do not have a dedicated NVIDIA or AMD GPU.
-			if (strstr(pInfo, "NVIDIA") || strstr(pInfo, "AMD"))
-				if (CL_ERROR(clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &m_DeviceID, NULL), "unable to retrieve devices")) {
-					m_PlatformID = platforms[i];
-					delete[] platforms;
-					return;
-				}
+	for (int pass = 0; pass < 3; pass++) {
+		for (cl_uint i = 0; i < platformCount; i++) {
+			if (pass == 0) {
+				CL_ERROR(clGetPlatformInfo(platforms[i], CL_PLATFORM_VENDOR, 512, &pInfo, NULL), "unable to retrieve platform info");
+				if (!strstr(pInfo, "NVIDIA") && !strstr(pInfo, "AMD")) continue;
+			}
+
+			cl_device_type type = pass < 2 ? CL_DEVICE_TYPE_GPU : CL_DEVICE_TYPE_ALL;
+			if (clGetDeviceIDs(platforms[i], type, 1, &m_DeviceID, NULL) == CL_SUCCESS) {
+				m_PlatformID = platforms[i];
+				delete[] platforms;
+				return;
+			}
+		}
 	}
 
 	delete[] platforms;
 
-	FATAL_ERROR("Unable to find a suitable GPU.");
+	FATAL_ERROR("Unable to find a suitable OpenCL device.");
 }
 
 void clContext::CreateContext(bool glInteropEnabled) {
+	// Sharing requires a device driving the OpenGL context, other devices get a plain context.
+	if (glInteropEnabled) {
+		size_t size = 0;
+		CL_ERROR(clGetDeviceInfo(m_DeviceID, CL_DEVICE_EXTENSIONS, 0, NULL, &size), "unable to retrieve device extensions");
+		std::string extensions(size, '\0');
+		CL_ERROR(clGetDeviceInfo(m_DeviceID, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL), "unable to retrieve device extensions");
+		glInteropEnabled = extensions.find("cl_khr_gl_sharing") != std::string::npos;
+	}
+
 	cl_context_properties properties[]{
 			CL_GL_CONTEXT_KHR, (cl_context_properties)wglGetCurrentContext(),
 				CL_WGL_HDC_KHR, (cl_context_properties)wglGetCurrentDC(),
@@ -411,37 +431,68 @@ void clContext::PrintDeviceInfo() {
 #pragma endregion
 
 #pragma region Program
-clProgram::clProgram(clContext* context, const char* path) {
+#define CL_PROGRAM_CACHE_DIRECTORY "cache"
+#define CL_PROGRAM_CACHE_MAGIC 0x4E424C43	// "CLBN"
+#define CL_BUILD_OPTIONS "-cl-fast-relaxed-math -cl-mad-enable -cl-denorms-are-zero -cl-no-signed-zeros -cl-unsafe-math-optimizations -cl-finite-math-only"
+
+/*
+* Precedes every cached program binary.
+*/
+struct clBinaryHeader {
+	uint magic;
+	uint reserved;
+	ulong key;
+	ulong size;
+};
+
+clProgram::clProgram(clContext* context, const char* path, const clDefines& defines) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::string variant;
+	m_Options = CL_BUILD_OPTIONS;
+	for (const std::pair<const std::string, std::string>& define : defines) {
+		m_Options += " -D " + define.first + "=" + define.second;
+		variant += " " + define.first + "=" + define.second;
+	}
 
-	CreateProgram(context, path);
-	BuildProgram(context);
+	size_t size;
+	char* source = ReadSource(path, &size);
+
+	// One binary per source file and key, such that the binaries of different configurations do not replace each other.
+	const char* fileName = path;
+	for (const char* c = path; *c; c++) if (*c == '/' || *c == '\\') fileName = c + 1;
+	ulong key = CacheKey(context, source);
+	char cachePath[2048];
+	snprintf(cachePath, sizeof(cachePath), "%s/%s.%016llx.bin", CL_PROGRAM_CACHE_DIRECTORY, fileName, (unsigned long long)key);
+
+	bool hit = LoadBinary(context, cachePath, key);
+	if (!hit) {
+		CreateProgram(context, source, size);
+		BuildProgram(context);
+		StoreBinary(cachePath, key);
+	}
+	free(source);
+
+	float buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("clProgram: %s%s binary cache %s, built in %.1f ms\n", fileName, variant.c_str(), hit ? "hit" : "miss", buildTime);
 }
 
 clProgram::~clProgram() {
 	CL_ERROR(clReleaseProgram(m_Program), "failed to release program");
 }
 
-void clProgram::CreateProgram(clContext* context, const char* path) {
-	// Load and build our OpenCL source code.
-	const char* source;
-	size_t* sizes = (size_t*)malloc(sizeof(size_t) * 1);
-	source = ReadSource(path, sizes);
-
+void clProgram::CreateProgram(clContext* context, const char* source, size_t size) {
 	// Error code.
 	cl_int errorCode;
 	// Try to create the program.
-	m_Program = clCreateProgramWithSource(context->GetContext(), 1, &source, sizes, &errorCode);
+	m_Program = clCreateProgramWithSource(context->GetContext(), 1, &source, &size, &errorCode);
 
 	// Check for errors.
 	CL_ERROR(errorCode, "could not create cl program.");
 }
 
 void clProgram::BuildProgram(clContext* context) {
-	cl_int buildStatus =
-		clBuildProgram(m_Program, 1, &context->GetDeviceID(),
-			"-cl-fast-relaxed-math -cl-mad-enable -cl-denorms-are-zero -cl-no-signed-zeros -cl-unsafe-math-optimizations -cl-finite-math-only",
-			NULL, NULL
-		);
+	cl_int buildStatus = clBuildProgram(m_Program, 1, &context->GetDeviceID(), m_Options.c_str(), NULL, NULL);
 
 	// Check for errors during building.
 	if (buildStatus != CL_SUCCESS) {
@@ -455,6 +506,87 @@ void clProgram::BuildProgram(clContext* context) {
 	}
 }
 
+bool clProgram::LoadBinary(clContext* context, const char* cachePath, ulong key) {
+	fio::FileHandle file = fio::OpenFileReadOnly(cachePath, fio::io_share_mode::share_read, fio::io_flags_and_attributes::flag_sequential_scan);
+	if (!file) return false;
+
+	// A binary with a different key or size was not written completely or for another program.
+	clBinaryHeader header = {};
+	ulong nBytesRead = 0;
+	int fileSize = fio::FileSize(file);
+	bool valid = fileSize > (int)sizeof(header) && fio::ReadFromFile(file, &header, sizeof(header), nBytesRead) && nBytesRead == sizeof(header)
+		&& header.magic == CL_PROGRAM_CACHE_MAGIC && header.key == key && header.size == (ulong)fileSize - sizeof(header);
+
+	std::vector<uchar> binary;
+	if (valid) {
+		binary.resize(header.size);
+		nBytesRead = 0;
+		valid = fio::ReadFromFile(file, binary.data(), header.size, nBytesRead) && nBytesRead == header.size;
+	}
+	fio::CloseFileHandle(file);
+
+	// The driver validates the binary itself, a binary of an older driver or a damaged one is rebuilt from source.
+	if (valid) {
+		const uchar* data = binary.data();
+		size_t size = binary.size();
+		cl_int binaryStatus = CL_INVALID_BINARY, errorCode;
+		m_Program = clCreateProgramWithBinary(context->GetContext(), 1, &context->GetDeviceID(), &size, &data, &binaryStatus, &errorCode);
+		valid = errorCode == CL_SUCCESS && binaryStatus == CL_SUCCESS
+			&& clBuildProgram(m_Program, 1, &context->GetDeviceID(), m_Options.c_str(), NULL, NULL) == CL_SUCCESS;
+	}
+
+	if (!valid) {
+		printf("clProgram: discarding invalid binary %s\n", cachePath);
+		if (m_Program) clReleaseProgram(m_Program), m_Program = 0;
+		fio::DeleteExistingFile(cachePath);
+	}
+	return valid;
+}
+
+void clProgram::StoreBinary(const char* cachePath, ulong key) {
+	// Some drivers do not provide binaries at all.
+	size_t size = 0;
+	CL_ERROR(clGetProgramInfo(m_Program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL), "unable to retrieve program binary size");
+	if (size == 0) return;
+
+	std::vector<uchar> binary(size);
+	uchar* data = binary.data();
+	CL_ERROR(clGetProgramInfo(m_Program, CL_PROGRAM_BINARIES, sizeof(uchar*), &data, NULL), "unable to retrieve program binary");
+
+	if (!fio::DirectoryExists(CL_PROGRAM_CACHE_DIRECTORY)) fio::CreateDirectoryRecursively(CL_PROGRAM_CACHE_DIRECTORY);
+	fio::DeleteExistingFile(cachePath);
+
+	fio::FileHandle file = fio::CreateNewFile(cachePath, fio::io_share_mode::share_none, fio::io_flags_and_attributes::flag_sequential_scan);
+	if (!file) {
+		fio::PrintLastIOError();
+		return;
+	}
+
+	clBinaryHeader header = { CL_PROGRAM_CACHE_MAGIC, 0, key, (ulong)size };
+	ulong nBytesWritten = 0;
+	bool written = fio::WriteToFile(file, &header, sizeof(header), nBytesWritten) && nBytesWritten == sizeof(header);
+	nBytesWritten = 0;
+	written = written && fio::WriteToFile(file, binary.data(), (ulong)size, nBytesWritten) && nBytesWritten == size;
+	fio::CloseFileHandle(file);
+
+	// A partial binary would only be discarded on the next run.
+	if (!written) fio::DeleteExistingFile(cachePath);
+}
+
+ulong clProgram::CacheKey(clContext* context, const char* source) {
+	char deviceName[256] = {}, driverVersion[256] = {};
+	CL_ERROR(clGetDeviceInfo(context->GetDeviceID(), CL_DEVICE_NAME, sizeof(deviceName), deviceName, NULL), "unable to retrieve device name");
+	CL_ERROR(clGetDeviceInfo(context->GetDeviceID(), CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL), "unable to retrieve driver version");
+
+	// The terminating zeros are hashed as well, so moving text from one string to the next changes the key.
+	ulong hash = 0xCBF29CE484222325ull;
+	for (const char* text : { source, m_Options.c_str(), (const char*)deviceName, (const char*)driverVersion }) {
+		const char* c = text;
+		do hash = (hash ^ (uchar)*c) * 0x100000001B3ull; while (*c++);
+	}
+	return hash;
+}
+
 char* clProgram::ReadSource(const char* filePath, size_t* size) {
 	std::string source;
 	// extract path from source file name
@@ -528,6 +660,47 @@ char* clProgram::ReadSource(const char* filePath, size_t* size) {
 	fclose(f);
 	return t;
 }
+
+clProgramVariants::clProgramVariants(clContext* context, const char* path)
+	: m_Context(context), m_Path(path) {
+}
+
+clProgramVariants::~clProgramVariants() {
+	// The builders only touch their own variant, so they can finish without holding the lock.
+	for (std::pair<const clDefines, Variant>& variant : m_Variants)
+		if (variant.second.builder.joinable()) variant.second.builder.join();
+	for (std::pair<const clDefines, Variant>& variant : m_Variants)
+		delete variant.second.program;
+}
+
+clProgram* clProgramVariants::Request(const clDefines& defines) {
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	std::map<clDefines, Variant>::iterator it = m_Variants.find(defines);
+	if (it != m_Variants.end()) return it->second.program;
+
+	// Entries of a map never move, so the builder can refer to its variant while others are added.
+	Variant& variant = m_Variants[defines];
+	variant.builder = std::thread([this, defines, &variant] {
+		Profiler::SetThreadName("clProgram builder");
+		clProgram* program = new clProgram(m_Context, m_Path.c_str(), defines);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		variant.program = program;
+		m_Built.notify_all();
+	});
+	return nullptr;
+}
+
+clProgram* clProgramVariants::Get(const clDefines& defines) {
+	clProgram* program = Request(defines);
+	if (program) return program;
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	Variant& variant = m_Variants[defines];
+	m_Built.wait(lock, [&variant] { return variant.program != nullptr; });
+	return variant.program;
+}
 #pragma endregion
 
 #pragma region Command Queue
@@ -761,103 +934,4 @@ void clKernel::Enqueue(clCommandQueue* queue, unsigned int workDim, size_t* glob
 	);
 }
 #pragma endregion
-
-
-#pragma region JobManager
-/* --- Static variable declarations. --- */
-bool JobManager::m_Initialized = false;
-unsigned int JobManager::m_NumWorkerThreads = 0;
-unsigned int JobManager::m_JobsRemaining = 0;
-WorkerThread* JobManager::m_ThreadPool = nullptr;
-Job** JobManager::m_JobPool;
-CRITICAL_SECTION JobManager::m_CriticalSection;
-HANDLE* JobManager::m_ThreadFinishedEvents;
-
-DWORD WorkerThreadProc(LPVOID lpParameter) {
-	WorkerThread* thread = (WorkerThread*)lpParameter;
-	thread->Run();
-	return 0;
-}
-
-void JobManager::Initialize() {
-	if (m_Initialized) return;
-
-	// Retrieve the number of logical processors.
-	SYSTEM_INFO sysInfo; GetSystemInfo(&sysInfo);
-	m_NumWorkerThreads = sysInfo.dwNumberOfProcessors;
-
-	// Initialize the worker threads.
-	m_ThreadPool = new WorkerThread[m_NumWorkerThreads];
-	m_ThreadFinishedEvents = new HANDLE[m_NumWorkerThreads];
-	for (unsigned int t = 0; t < m_NumWorkerThreads; t++)
-		m_ThreadPool[t].Initialize(t), m_ThreadFinishedEvents[t] = CreateEventA(NULL, false, false, NULL);
-
-	// Initialize the JobPool.
-	m_JobPool = new Job * [MAX_JOBS];
-	m_JobsRemaining = 0;
-
-	InitializeCriticalSection(&m_CriticalSection);
-
-	m_Initialized = true;
-}
-
-void JobManager::Terminate() {
-	if (!JobManager::m_Initialized) return;
-
-	DeleteCriticalSection(&m_CriticalSection);
-
-	delete m_ThreadPool;
-	delete m_JobPool;
-	delete m_ThreadFinishedEvents;
-
-	m_Initialized = false;
-}
-
-void JobManager::QueueJob(Job* job) {
-	JobManager::m_JobPool[m_JobsRemaining++] = job;
-}
-
-Job* JobManager::GetNextJob() {
-	Job* job = nullptr;
-	EnterCriticalSection(&m_CriticalSection);
-	if (m_JobsRemaining > 0) job = m_JobPool[--m_JobsRemaining];
-	LeaveCriticalSection(&m_CriticalSection);
-	return job;
-}
-
-void JobManager::ThreadDone(unsigned int threadID) {
-	SetEvent(m_ThreadFinishedEvents[threadID]);
-}
-
-void JobManager::ExecuteJobs() {
-	for (unsigned int t = 0; t < m_NumWorkerThreads; t++) SetEvent(m_ThreadPool[t].m_StartEvent);
-	WaitForMultipleObjects(m_NumWorkerThreads, m_ThreadFinishedEvents, true, INFINITE);
-}
-
-void WorkerThread::Initialize(unsigned int lCoreID) {
-	m_StartEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
-	m_ThreadHandle = CreateThread(NULL, NULL, (LPTHREAD_START_ROUTINE)&WorkerThreadProc, (LPVOID)this, 0, 0);
-	SetThreadAffinityMask(m_ThreadHandle, (DWORD_PTR)(1) << lCoreID);	// Pin thread to a single core.
-	m_LogicalCoreID = lCoreID;
-}
-
-void WorkerThread::Run() {
-
-	while (true) {
-		// Wait for the worker-thread to start running.
-		WaitForSingleObject(m_StartEvent, INFINITE);
-
-		Job* nextJob = JobManager::GetNextJob();
-
-		// Start Job-handling process.
-		while (nextJob) {
-			nextJob->Execute();
-			nextJob = JobManager::GetNextJob();
-		}
-
-		// Signal for the thread that it is done. 
-		JobManager::ThreadDone(m_LogicalCoreID);
-	}
-}
-
-#pragma endregion
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -7,7 +7,22 @@
 #include <iostream>
 #include <map>
 #include <bitset>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <cstring>
 
+/*
+* Set to 1 to build the headless benchmark only, without a window, OpenGL, ImGui or OpenCL. The simulation,
+* the raster into the surface memory and the JSON output depend on none of these, so this build runs on Linux.
+*/
+#ifndef HEADLESS_BUILD
+#define HEADLESS_BUILD 0
+#endif
+
+#if !HEADLESS_BUILD
 #include <glew/glew.h>
 #include <glfw/glfw3.h>
 
@@ -16,7 +31,10 @@
 
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
+#endif
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 
 typedef uint8_t uchar;
@@ -33,10 +51,12 @@ void FATAL_ERROR(const char* format, ...);
 */
 std::string readFile(const char* filePath);
 
+#if !HEADLESS_BUILD
 #pragma region GLdebug
 void EnableGLdebugInfo();
 void DisableGLdebugInfo();
 #pragma endregion
+#endif
 
 struct Color {
 	Color() : r(0), g(0), b(0), a(0) {}
@@ -67,6 +87,7 @@ struct Color {
 
 };
 
+#if !HEADLESS_BUILD
 #pragma region OpenCL
 typedef cl_event gpu_event;
 
@@ -175,15 +196,22 @@ private:
 	void CreateContext(bool glInteropEnabled);
 };
 
+/*
+* Preprocessor definitions a program is built with, passed as -D name=value.
+*/
+typedef std::map<std::string, std::string> clDefines;
+
 class clProgram {
 
 public:
 	/*
-	* Creates an OpenCL context and constructs a program from the provided path.
+	* Creates an OpenCL context and constructs a program from the provided path. A binary of the program is cached
+	* on disk, later runs with the same source, build options, device and driver load it instead of compiling.
 	* @param[in] context	Valid OpenCL context.
 	* @param[in] path		Path to the OpenCL source code.
+	* @param[in] defines	Definitions to specialize the program with.
 	*/
-	clProgram(clContext* context, const char* path);
+	clProgram(clContext* context, const char* path, const clDefines& defines = clDefines());
 	~clProgram();
 
 	/*
@@ -194,19 +222,45 @@ public:
 private:
 
 	cl_program m_Program = 0;
+	/*
+	* Build options, including the definitions.
+	*/
+	std::string m_Options;
 
 	/*
 	* Create a cl_program form the given source.
 	* @param[in] context	Valid OpenCL context.
-	* @param[in] path		Path to the OpenCL source code.
+	* @param[in] source		Expanded OpenCL source code.
+	* @param[in] size		Length of the source code.
 	*/
-	void CreateProgram(clContext* context, const char* path);
+	void CreateProgram(clContext* context, const char* source, size_t size);
 	/*
 	* Builds the cl_program.
 	* @param[in] context	Valid OpenCL context.
 	*/
 	void BuildProgram(clContext* context);
 	/*
+	* Creates and builds the cl_program from a cached binary.
+	* @param[in] context	Valid OpenCL context.
+	* @param[in] cachePath	Path to the cached binary.
+	* @param[in] key		Hash the binary was stored with.
+	* @returns				False if there is no valid binary or the driver rejects it, the program is then not created.
+	*/
+	bool LoadBinary(clContext* context, const char* cachePath, ulong key);
+	/*
+	* Stores the binary of the built cl_program. Failing to store it is not an error.
+	* @param[in] cachePath	Path to the cached binary.
+	* @param[in] key		Hash to store the binary with.
+	*/
+	void StoreBinary(const char* cachePath, ulong key);
+	/*
+	* Hashes everything the binary of a program depends on.
+	* @param[in] context	Valid OpenCL context.
+	* @param[in] source		Expanded OpenCL source code.
+	* @returns				64-bit FNV-1a hash of the source, build options, device name and driver version.
+	*/
+	ulong CacheKey(clContext* context, const char* source);
+	/*
 	* Reads an OpenCL file and does some funky pre-processing. No idea where this method came from.
 	* @param[in] filePath		File path to the OpenCL file.
 	* @param[out] size			Pointer to where the size of the string should be stored. Cannot be NULL. I think.
@@ -215,6 +269,50 @@ private:
 	char* ReadSource(const char* filePath, size_t* size);
 };
 
+/*
+* Variants of a program, each built once for its set of definitions. Variants are built on a thread of their own,
+* such that specializing a program for the current configuration never stalls the caller.
+*/
+class clProgramVariants {
+
+public:
+	/*
+	* @param[in] context	Valid OpenCL context, must outlive the variants.
+	* @param[in] path		Path to the OpenCL source code.
+	*/
+	clProgramVariants(clContext* context, const char* path);
+	/*
+	* Waits for the variants still being built and releases all of them.
+	*/
+	~clProgramVariants();
+
+	/*
+	* Retrieves a variant without waiting for it. The first request starts building it in the background.
+	* @param[in] defines	Definitions of the variant.
+	* @returns				The variant, or nullptr while it is being built.
+	*/
+	clProgram* Request(const clDefines& defines);
+	/*
+	* Retrieves a variant, building it first or waiting until its build finished.
+	* @param[in] defines	Definitions of the variant.
+	* @returns				The variant.
+	*/
+	clProgram* Get(const clDefines& defines);
+
+private:
+	struct Variant {
+		clProgram* program = nullptr;
+		std::thread builder;
+	};
+
+	clContext* m_Context;
+	std::string m_Path;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Built;
+	std::map<clDefines, Variant> m_Variants;
+};
+
 class clCommandQueue {
 
 public:
@@ -502,77 +600,83 @@ private:
 
 };
 #pragma endregion
+#endif
 
-#pragma region JobManager
-class Job {
+#include "JobManager.h"
 
-public:
-	virtual void Execute() = 0;
-};
-
-class WorkerThread {
+#pragma region Lock-free
+/*
+* Lock-free triple buffer handing the latest state from a single producer to a single consumer. The producer writes
+* the back buffer and publishes it, the consumer swaps the latest published buffer to the front. Neither side ever
+* waits for the other, states published in between two swaps are skipped.
+*/
+template <typename T>
+class TripleBuffer {
 
 public:
-	/* Initializes the WorkerThread.
-	* @param[in] lCoreID		ID of the logical core to which the thread is pinned.
-	*/
-	void Initialize(unsigned int lCoreID);
-	/* Starts the thread's main-loop. */
-	void Run();
+	TripleBuffer() : m_Back(0), m_Front(1), m_Middle(2) {}
+
+	/* Retrieve the buffer to write the next state to. Producer only. */
+	T& Back() { return m_Buffers[m_Back]; }
+	/* Publishes the back buffer, after which the producer continues with another buffer. Producer only. */
+	void Publish() {
+		m_Back = m_Middle.exchange(m_Back | NEW_STATE, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	/* Swaps the latest published buffer to the front. Consumer only.
+	* @returns		False if nothing was published since the last swap, the front buffer then stays the same.
+	*/
+	bool Consume() {
+		if (!(m_Middle.load(std::memory_order_relaxed) & NEW_STATE)) return false;
+		m_Front = m_Middle.exchange(m_Front, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+	/* Retrieve the buffer holding the latest consumed state. Consumer only. */
+	const T& Front() const { return m_Buffers[m_Front]; }
 
 private:
-	/* Befriend the JobManager. */
-	friend class JobManager;
-	/* ID of the logical core on which the thread is processed. */
-	unsigned int m_LogicalCoreID;
-	/* Handle to the thread object. */
-	HANDLE m_ThreadHandle, m_StartEvent;
+	static const unsigned int INDEX_MASK = 3, NEW_STATE = 4;
+
+	T m_Buffers[3];
+	/* Buffers owned by the producer and the consumer. */
+	unsigned int m_Back, m_Front;
+	/* Buffer in between the two, flagged when it holds a state that was not consumed yet. */
+	std::atomic<unsigned int> m_Middle;
 };
 
 /*
-* Job manager (Singleton) who manages the multithreaded job-system.
-* Based on Jacco Bikker's template (https://github.com/jbikker/tmpl8).
+* Lock-free bounded queue with a single producer and a single consumer thread.
 */
-class JobManager {
+template <typename T, unsigned int Capacity>
+class SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two.");
 
 public:
-	/* Initializes the JobManager. Returns if previously initialized. */
-	static void Initialize();
-	/* Terminates the JobManager. Returns if not previously initialized. */
-	static void Terminate();
-
-	/* Add a new Job to the Job pool.
-	* @param[in] job		Pointer to a valid Job object.
-	*/
-	static void QueueJob(Job* job);
-	/* Retrieve the next Job.
-	* @returns		A previously queued Job.
-	*/
-	static Job* GetNextJob();
-	/* Signal that a thread is done.
-	* @param[in] threadID		ID of the thread that finished.
-	*/
-	static void ThreadDone(unsigned int threadID);
-
-	/* Execute all previously queued jobs and waits until they have finished. */
-	static void ExecuteJobs();
+	/* Appends an item. Producer only.
+	* @returns		False if the queue is full.
+	*/
+	bool Push(const T& item) {
+		unsigned int head = m_Head.load(std::memory_order_relaxed);
+		if (head - m_Tail.load(std::memory_order_acquire) == Capacity) return false;
+		m_Items[head & (Capacity - 1)] = item;
+		m_Head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	/* Removes the oldest item. Consumer only.
+	* @returns		False if the queue is empty.
+	*/
+	bool Pop(T& item) {
+		unsigned int tail = m_Tail.load(std::memory_order_relaxed);
+		if (tail == m_Head.load(std::memory_order_acquire)) return false;
+		item = m_Items[tail & (Capacity - 1)];
+		m_Tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
 
 private:
-	/* True if Initialize() was called. */
-	static bool m_Initialized;
-	/* Number of worker-threads. */
-	static unsigned int m_NumWorkerThreads;
-	/* Pool of worker threads. */
-	static WorkerThread* m_ThreadPool;
-	/* Array of events (one per worker thread) used to signal that a thread has finished. */
-	static HANDLE* m_ThreadFinishedEvents;
-
-	/* Indicates the total number of jobs remaining in the job-pool. */
-	static unsigned int m_JobsRemaining;
-	/* Array containing the jobs waiting in the pool to be executed. */
-	static Job** m_JobPool;
-
-	/* Critical section used for locking the job-retrieval. */
-	static CRITICAL_SECTION m_CriticalSection;
+	/* Kept on separate cache lines, as each is written by a different thread. */
+	alignas(64) std::atomic<unsigned int> m_Head = 0;
+	alignas(64) std::atomic<unsigned int> m_Tail = 0;
+	T m_Items[Capacity];
 };
 #pragma endregion
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "stdfax.h"
+#include "Template/Application.h"
+
+/*
+* Feeds a sequence of frame times to the fixed-step accumulator and checks the number of steps of every frame and
+* the interpolation factor after it.
+* @param[in] name			Name of the case.
+* @param[in] frameTimes		Frame times in steps.
+* @param[in] steps			Expected number of steps of every frame.
+* @param[in] alphas			Expected fraction of a step left after every frame.
+* @returns					True if the case failed.
+*/
+static bool CheckFrames(const char* name, std::vector<float> frameTimes, std::vector<uint> steps, std::vector<float> alphas)
+{
+	const float step = Application::FixedTimeStep();
+	float accumulator = 0.0f;
+	bool failed = false;
+
+	for (uint f = 0; f < frameTimes.size(); f++)
+	{
+		uint nTicks = 0;
+		bool wrongStep = false;
+		float alpha = Application::StepFixedTime(accumulator, frameTimes[f] * step, [&](float dt) { nTicks++, wrongStep |= dt != step; });
+
+		if (nTicks != steps[f] || Application::Substeps() != steps[f] || wrongStep || !(glm::abs(alpha - alphas[f]) < 1e-3f))
+		{
+			printf("%s, frame %u: %u steps (%u counted) and alpha %f, expected %u steps and alpha %f%s, FAILED\n",
+				name, f, nTicks, Application::Substeps(), alpha, steps[f], alphas[f], wrongStep ? ", ticked with another step" : "");
+			failed = true;
+		}
+	}
+	if (!failed) printf("%s: passed\n", name);
+	return failed;
+}
+
+/*
+* Checks that the fixed-step accumulator takes one step per step of frame time, carries the remainder over to the
+* next frame, stops at the maximum number of steps and drops the time that does not fit, and clamps long frames.
+*/
+int main()
+{
+	// 4 steps per frame at most, and frames of more than 7.5 steps are clamped.
+	const float step = 1.0f / 60.0f;
+	Application::SetFixedTimeStep(step, 4, 7.5f * step);
+
+	uint nFailed = 0;
+	nFailed += CheckFrames("Frames of one step", { 1.0f, 1.0f, 1.0f }, { 1, 1, 1 }, { 0.0f, 0.0f, 0.0f });
+	nFailed += CheckFrames("Carried remainder", { 0.4f, 0.4f, 0.4f, 1.5f }, { 0, 0, 1, 1 }, { 0.4f, 0.8f, 0.2f, 0.7f });
+	nFailed += CheckFrames("Several steps", { 2.5f, 0.75f }, { 2, 1 }, { 0.5f, 0.25f });
+	nFailed += CheckFrames("Maximum steps", { 6.25f, 0.5f }, { 4, 0 }, { 0.25f, 0.75f });
+	nFailed += CheckFrames("Clamped frame", { 60.0f, 0.25f }, { 4, 0 }, { 0.5f, 0.75f });
+	return nFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+#include "stdfax.h"
+#include "Template/Application.h"
+#include "Game.h"
+
+/*
+* Checks that the counting sort fills the grid as a CSR structure: the cells start where the previous one ends, every
+* particle is in the cell of the position it was sorted with exactly once, and the particles of a cell keep their order.
+*/
+int main()
+{
+	Application::InitializeHeadless(1024, 1024);
+	Game* game = new Game();
+	uint cellWidth = Application::RenderWidth() / GRID_RESOLUTION, cellHeight = Application::RenderHeight() / GRID_RESOLUTION;
+
+	uint nFailed = 0;
+	std::vector<uint> seen(N_PARTICLES);
+	for (uint f = 0; f < 5; f++)
+	{
+		JobManager::NewFrame();
+		game->Tick(1.0f / 60.0f);
+
+		const uint* cellStart = game->CellStart();
+		const uint* cellParticles = game->CellParticles();
+		const float* posX = game->PreviousPositionsX();
+		const float* posY = game->PreviousPositionsY();
+
+		uint nErrors = 0;
+		if (cellStart[0] != 0 || cellStart[GRID_CELLS] != N_PARTICLES)
+		{
+			printf("Tick %u: the cells span %u to %u instead of all %u particles.\n", f, cellStart[0], cellStart[GRID_CELLS], N_PARTICLES);
+			nErrors++;
+		}
+
+		std::fill(seen.begin(), seen.end(), 0u);
+		for (uint c = 0; c < GRID_CELLS && nErrors == 0; c++)
+		{
+			if (cellStart[c + 1] < cellStart[c])
+			{
+				printf("Tick %u: cell %u ends at %u before it starts at %u.\n", f, c, cellStart[c + 1], cellStart[c]);
+				nErrors++;
+				break;
+			}
+
+			for (uint i = cellStart[c]; i < cellStart[c + 1]; i++)
+			{
+				uint p = cellParticles[i];
+				uint x = glm::min((uint)(posX[p] / cellWidth), GRID_RESOLUTION - 1u), y = glm::min((uint)(posY[p] / cellHeight), GRID_RESOLUTION - 1u);
+				if (p >= N_PARTICLES || seen[p]++ > 0) printf("Tick %u: particle %u is in the grid more than once.\n", f, p), nErrors++;
+				else if (x + y * GRID_RESOLUTION != c) printf("Tick %u: particle %u is in cell %u instead of %u.\n", f, p, c, x + y * GRID_RESOLUTION), nErrors++;
+				else if (i > cellStart[c] && cellParticles[i - 1] > p) printf("Tick %u: particle %u follows %u in cell %u.\n", f, p, cellParticles[i - 1], c), nErrors++;
+				if (nErrors > 0) break;
+			}
+		}
+		nFailed += nErrors > 0;
+	}
+
+	delete game;
+	JobManager::Terminate();
+
+	if (nFailed == 0) printf("The grid holds every particle once, in its cell and in order.\n");
+	return nFailed > 0 ? 1 : 0;
+}
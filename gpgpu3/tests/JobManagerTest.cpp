@@ -0,0 +1,49 @@
+#include "stdfax.h"
+#include "JobManager.h"
+
+/*
+* Runs data-parallel loops from several threads at once, while one of them restarts the JobManager now and then,
+* and checks every result.
+*/
+int main()
+{
+	const uint nThreads = 4, nRounds = 200, count = 100000;
+	JobManager::Initialize(3, WorkerPlacement::NONE);
+
+	std::atomic<uint> nErrors(0);
+	auto submitter = [&](uint thread)
+	{
+		std::vector<uint> values(count), offsets(count);
+		for (uint round = 0; round < nRounds; round++)
+		{
+			JobManager::NewFrame();
+			if (thread == 0 && round % 50 == 49) JobManager::Restart(1 + round / 50, WorkerPlacement::NONE);
+
+			ParallelFor(0, count, 0, [&](uint i) { values[i] = i % 7 + thread; });
+			uint sum = ParallelReduce(0, count, 0, 0u, [&](uint i) { return values[i]; }, [](uint a, uint b) { return a + b; });
+			uint total = ParallelScan(values.data(), offsets.data(), count, 0, 0u, [](uint a, uint b) { return a + b; });
+
+			// Nested loops wait on jobs queued by a job.
+			std::atomic<uint> nested(0);
+			ParallelFor(0, 16, 1, [&](uint) { ParallelFor(0, 1000, 10, [&](uint) { nested.fetch_add(1, std::memory_order_relaxed); }); });
+
+			uint expected = 0;
+			for (uint i = 0; i < count; i++) expected += i % 7 + thread;
+			if (sum != expected || total != expected || offsets[count - 1] != expected - values[count - 1] || nested != 16 * 1000)
+				nErrors.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint t = 0; t < nThreads; t++) threads.emplace_back(submitter, t);
+	for (std::thread& thread : threads) thread.join();
+	JobManager::Terminate();
+
+	if (nErrors > 0)
+	{
+		printf("%u of %u rounds gave a wrong result.\n", nErrors.load(), nThreads * nRounds);
+		return 1;
+	}
+	printf("%u threads ran %u rounds each without errors.\n", nThreads, nRounds);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include "stdfax.h"
+#include "Collision.h"
+
+/*
+* Copies the particles of a store into a new one.
+*/
+static void CopyParticles(const ParticleStore& from, ParticleStore& to)
+{
+	for (uint i = 0; i < from.count; i++)
+		to.Set(i, { from.posX[i], from.posY[i] }, { from.velX[i], from.velY[i] }, 1.0f / from.invMass[i], from.radius[i], 0);
+}
+
+/*
+* Largest difference in position or velocity between two stores, infinite if either holds NaN.
+*/
+static float MaxDifference(const ParticleStore& a, const ParticleStore& b)
+{
+	float maxDifference = 0.0f;
+	for (uint i = 0; i < a.count; i++)
+	{
+		float difference = glm::max(glm::max(glm::abs(a.posX[i] - b.posX[i]), glm::abs(a.posY[i] - b.posY[i])),
+			glm::max(glm::abs(a.velX[i] - b.velX[i]), glm::abs(a.velY[i] - b.velY[i])));
+		maxDifference = glm::isnan(difference) ? INFINITY : glm::max(maxDifference, difference);
+	}
+	return maxDifference;
+}
+
+/*
+* Runs the gather kernel of an instruction set for every particle in the candidate list against those after it.
+*/
+static void RunGatherKernel(SimdLevel level, ParticleStore& particles, const std::vector<uint>& candidates, uint nFirst, float dt)
+{
+	NarrowPhaseKernel kernel = GetNarrowPhaseKernel(level);
+	uint count = (uint)candidates.size();
+	for (uint i = 0; i < nFirst; i++) kernel(particles, candidates[i], &candidates[i + 1], count - i - 1, dt);
+}
+
+/*
+* Runs the block kernel of an instruction set over the candidate list.
+*/
+static void RunBlockKernel(SimdLevel level, ParticleStore& particles, const std::vector<uint>& candidates, uint nFirst, float dt)
+{
+	uint count = (uint)candidates.size();
+	ParticleBlock block;
+	GatherBlock(particles, candidates.data(), count, block);
+	GetNarrowPhaseBlockKernel(level)(block, count, nFirst, dt);
+	ScatterBlock(particles, candidates.data(), count, block);
+}
+
+/*
+* Checks that the SIMD kernels resolve separate pairs of colliding particles like the scalar narrow phase. Every
+* particle has at most one contact, so the batches resolve the same contacts in the same state as the scalar loop.
+* The pair counts leave partial batches and padding in the block at every particle.
+*/
+static uint CheckScalarReference(float dt)
+{
+	uint nFailed = 0;
+	for (uint nPairs : { 1u, 4u, 13u, 30u })
+	{
+		// Pairs approaching each other on a coarse lattice, followed by a single particle that touches nothing.
+		uint count = nPairs * 2 + 1;
+		ParticleStore initial(count);
+		srand(nPairs);
+		for (uint p = 0; p < nPairs; p++)
+		{
+			glm::vec2 center(60.0f * (p % 6), 60.0f * (p / 6));
+			glm::vec2 direction = glm::normalize(glm::vec2(rand() % 200 - 100.0f, rand() % 200 - 100.0f) + glm::vec2(0.1f));
+			float ri = 6.0f + rand() % 4, rj = 6.0f + rand() % 4, gap = (ri + rj) * 0.8f;
+			initial.Set(p * 2, center - direction * gap * 0.5f, direction * (float)(rand() % 100), ri * 4.0f, ri, 0);
+			initial.Set(p * 2 + 1, center + direction * gap * 0.5f, -direction * (float)(rand() % 100), rj * 2.0f, rj, 0);
+		}
+		initial.Set(count - 1, glm::vec2(-500.0f), glm::vec2(10.0f), 16.0f, 8.0f, 0);
+
+		// Shuffle the candidates, so the partners of a pair end up in different batches.
+		std::vector<uint> candidates(count);
+		for (uint i = 0; i < count; i++) candidates[i] = i;
+		for (uint i = count - 1; i > 0; i--) std::swap(candidates[i], candidates[rand() % (i + 1)]);
+
+		ParticleStore reference(count);
+		CopyParticles(initial, reference);
+		RunGatherKernel(SimdLevel::SCALAR, reference, candidates, count, dt);
+
+		for (SimdLevel level : { SimdLevel::SSE4, SimdLevel::AVX2 })
+		{
+			if (level > DetectSimdLevel()) continue;
+			ParticleStore gathered(count), blocked(count);
+			CopyParticles(initial, gathered);
+			CopyParticles(initial, blocked);
+			RunGatherKernel(level, gathered, candidates, count, dt);
+			RunBlockKernel(level, blocked, candidates, count, dt);
+
+			// The SIMD kernels divide by the length where the scalar one multiplies with its inverse square root.
+			float gatherDifference = MaxDifference(reference, gathered), blockDifference = MaxDifference(reference, blocked);
+			bool failed = !(gatherDifference < 1e-3f) || !(blockDifference < 1e-3f);
+			printf("%s kernels, %u particles: largest difference to scalar %g (gather), %g (block)%s\n",
+				SimdLevelName(level), count, gatherDifference, blockDifference, failed ? ", FAILED" : "");
+			nFailed += failed;
+		}
+
+		// Make sure the scene has contacts at all.
+		float moved = MaxDifference(initial, reference);
+		if (!(moved > 1.0f))
+		{
+			printf("Scalar narrow phase, %u particles: no contacts resolved, FAILED\n", count);
+			nFailed++;
+		}
+	}
+	return nFailed;
+}
+
+/*
+* Checks that the narrow phase over gathered blocks resolves a crowded cell like the gather kernel of the same
+* SIMD level does, including particles that coincide, which the scalar narrow phase has no normal for.
+*/
+static uint CheckCrowdedBlock(float dt)
+{
+	const uint count = 200, nFirst = 40;
+
+	ParticleStore initial(count);
+	srand(1);
+	for (uint i = 0; i < count; i++)
+	{
+		glm::vec2 position(rand() % 64, rand() % 64), velocity(rand() % 200 - 100.0f, rand() % 200 - 100.0f);
+		float radius = 6.0f + rand() % 4;
+		initial.Set(i, position, velocity, radius * 4.0f, radius, 0);
+	}
+	initial.posX[1] = initial.posX[0], initial.posY[1] = initial.posY[0];
+
+	// Candidates in reverse order, so the block is not just a copy of the store.
+	std::vector<uint> candidates(count);
+	for (uint i = 0; i < count; i++) candidates[i] = count - 1 - i;
+
+	uint nFailed = 0;
+	for (SimdLevel level : { SimdLevel::SSE4, SimdLevel::AVX2 })
+	{
+		if (level > DetectSimdLevel()) continue;
+		ParticleStore gathered(count), blocked(count);
+		CopyParticles(initial, gathered);
+		CopyParticles(initial, blocked);
+		RunGatherKernel(level, gathered, candidates, nFirst, dt);
+		RunBlockKernel(level, blocked, candidates, nFirst, dt);
+
+		// The horizontal sums add the partners up in another order.
+		float maxDifference = MaxDifference(gathered, blocked);
+		bool failed = !(maxDifference < 1e-2f);
+		printf("%s block kernel, crowded cell: largest difference %g%s\n", SimdLevelName(level), maxDifference, failed ? ", FAILED" : "");
+		nFailed += failed;
+	}
+	return nFailed;
+}
+
+int main()
+{
+	const float dt = 1.0f / 60.0f;
+	uint nFailed = CheckScalarReference(dt) + CheckCrowdedBlock(dt);
+	return nFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+#include "stdfax.h"
+#include "Template/Application.h"
+#include "Game.h"
+
+/*
+* Checks that the binned raster draws exactly the same pixels as drawing the particles one by one.
+*/
+int main()
+{
+	Application::InitializeHeadless(1024, 1024);
+	Game* game = new Game();
+
+	// Let the particles move and overlap a bit.
+	for (uint f = 0; f < 10; f++)
+	{
+		JobManager::NewFrame();
+		game->Tick(1.0f / 60.0f);
+	}
+
+	// Without pipelining, every draw rasterizes the same latest state.
+	Surface* screen = Application::Screen();
+	uint nPixels = screen->GetWidth() * screen->GetHeight();
+	game->SetRasterMode(false, false);
+	game->Draw();
+	std::vector<Color> scalar(screen->PixelBuffer(), screen->PixelBuffer() + nPixels);
+
+	game->SetRasterMode(true, false);
+	game->Draw();
+	const Color* binned = screen->PixelBuffer();
+
+	const Color black;
+	uint nDrawn = 0, nDifferent = 0, first = nPixels;
+	for (uint p = 0; p < nPixels; p++)
+	{
+		if (memcmp(&scalar[p], &binned[p], sizeof(Color)) != 0) nDifferent++, first = glm::min(first, p);
+		if (memcmp(&scalar[p], &black, sizeof(Color)) != 0) nDrawn++;
+	}
+
+	delete game;
+	JobManager::Terminate();
+
+	if (nDrawn == 0)
+	{
+		printf("The scalar raster drew nothing.\n");
+		return 1;
+	}
+	if (nDifferent > 0)
+	{
+		printf("%u of %u pixels differ, the first at (%u, %u).\n", nDifferent, nPixels, first % screen->GetWidth(), first / screen->GetWidth());
+		return 1;
+	}
+	printf("Binned and scalar raster agree on all %u pixels, %u of which are drawn.\n", nPixels, nDrawn);
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include "stdfax.h"
+#include "Template/Application.h"
+#include "Game.h"
+
+#include <algorithm>
+#include <array>
+
+typedef std::array<float, 5> ParticleState;
+
+/*
+* Runs the simulation for a few ticks and collects the state of all particles after the first tick, sorted such that
+* it does not depend on the order of the particles.
+* @param[in] reorder		Reorder the particles on every tick.
+* @param[out] state			Position, velocity and radius of every particle.
+* @returns					Number of ticks after which the grid did not match the particles.
+*/
+static uint Simulate(bool reorder, std::vector<ParticleState>& state)
+{
+	Game* game = new Game();
+	SimulationSettings settings = game->Settings();
+	settings.reorderEnabled = reorder, settings.reorderInterval = 0;
+	game->SetSettings(settings);
+
+	uint cellWidth = Application::RenderWidth() / GRID_RESOLUTION, cellHeight = Application::RenderHeight() / GRID_RESOLUTION;
+	uint nErrors = 0;
+	for (uint f = 0; f < 3; f++)
+	{
+		JobManager::NewFrame();
+		game->Tick(1.0f / 60.0f);
+
+		// The grid is remapped along with the particles, so it must still hold every particle in the cell of its position.
+		// Right after reordering, the particles of a cell are also next to each other in memory.
+		const uint* cellStart = game->CellStart();
+		const uint* cellParticles = game->CellParticles();
+		const float* posX = game->PreviousPositionsX();
+		const float* posY = game->PreviousPositionsY();
+		uint nMisplaced = 0, nScattered = 0;
+		for (uint c = 0; c < GRID_CELLS; c++)
+			for (uint i = cellStart[c]; i < cellStart[c + 1]; i++)
+			{
+				uint p = cellParticles[i];
+				uint x = glm::min((uint)(posX[p] / cellWidth), GRID_RESOLUTION - 1u), y = glm::min((uint)(posY[p] / cellHeight), GRID_RESOLUTION - 1u);
+				nMisplaced += x + y * GRID_RESOLUTION != c;
+				nScattered += i > cellStart[c] && p != cellParticles[i - 1] + 1;
+			}
+
+		if (nMisplaced > 0) printf("%s, tick %u: %u particles are not in the cell of their position.\n", reorder ? "Reordered" : "Not reordered", f, nMisplaced);
+		if (reorder && nScattered > 0) printf("Reordered, tick %u: %u particles do not follow the previous particle of their cell.\n", f, nScattered);
+		nErrors += nMisplaced > 0 || (reorder && nScattered > 0);
+
+		// Later ticks sort the particles of a cell by their reordered indices, which changes the order of the collisions.
+		if (f > 0) continue;
+		const ParticleStore& particles = game->Particles();
+		state.resize(N_PARTICLES);
+		for (uint i = 0; i < N_PARTICLES; i++) state[i] = { particles.posX[i], particles.posY[i], particles.velX[i], particles.velY[i], particles.radius[i] };
+		std::sort(state.begin(), state.end());
+	}
+
+	delete game;
+	return nErrors;
+}
+
+/*
+* Checks that reordering the particles into Morton order permutes the particles and the grid consistently. The cells
+* keep the order of their particles, so the first tick must give exactly the same particles as without reordering.
+*/
+int main()
+{
+	Application::InitializeHeadless(1024, 1024);
+
+	std::vector<ParticleState> original, reordered;
+	uint nErrors = Simulate(false, original) + Simulate(true, reordered);
+	JobManager::Terminate();
+
+	uint nDifferent = 0;
+	for (uint i = 0; i < N_PARTICLES; i++) nDifferent += original[i] != reordered[i];
+	if (nDifferent > 0) printf("%u of %u particles differ from the simulation without reordering.\n", nDifferent, N_PARTICLES);
+	else if (nErrors == 0) printf("Reordering gives the same %u particles as not reordering.\n", N_PARTICLES);
+	return nErrors > 0 || nDifferent > 0 ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+#include "stdfax.h"
+#include "Collision.h"
+
+/*
+* Checks that generating contacts and resolving them afterwards gives the same particles as resolving every collision
+* right away, for separate pairs of colliding particles, where every particle has a single contact. Particles that
+* coincide have no normal and must not produce a contact.
+*/
+int main()
+{
+	const uint nPairs = 30, count = nPairs * 2 + 2;
+	const float dt = 1.0f / 60.0f;
+
+	// Pairs approaching each other on a coarse lattice, followed by two particles at the same position.
+	ParticleStore initial(count);
+	srand(3);
+	for (uint p = 0; p < nPairs; p++)
+	{
+		glm::vec2 center(60.0f * (p % 6), 60.0f * (p / 6));
+		glm::vec2 direction = glm::normalize(glm::vec2(rand() % 200 - 100.0f, rand() % 200 - 100.0f) + glm::vec2(0.1f));
+		float ri = 6.0f + rand() % 4, rj = 6.0f + rand() % 4, gap = (ri + rj) * 0.8f;
+		initial.Set(p * 2, center - direction * gap * 0.5f, direction * (float)(rand() % 100), ri * 4.0f, ri, 0);
+		initial.Set(p * 2 + 1, center + direction * gap * 0.5f, -direction * (float)(rand() % 100), rj * 2.0f, rj, 0);
+	}
+	initial.Set(count - 2, glm::vec2(-500.0f), glm::vec2(0.0f), 16.0f, 8.0f, 0);
+	initial.Set(count - 1, glm::vec2(-500.0f), glm::vec2(0.0f), 16.0f, 8.0f, 0);
+
+	std::vector<uint> candidates(count);
+	for (uint i = 0; i < count; i++) candidates[i] = i;
+
+	uint nFailed = 0;
+	for (SimdLevel level : { SimdLevel::SCALAR, SimdLevel::SSE4, SimdLevel::AVX2 })
+	{
+		if (level > DetectSimdLevel()) continue;
+		ParticleStore direct(count), twoPhase(count);
+		for (ParticleStore* particles : { &direct, &twoPhase })
+			for (uint i = 0; i < count; i++)
+				particles->Set(i, { initial.posX[i], initial.posY[i] }, { initial.velX[i], initial.velY[i] }, 1.0f / initial.invMass[i], initial.radius[i], 0);
+
+		// The coinciding particles are left out of the direct pass, the scalar narrow phase has no normal for them either.
+		NarrowPhaseKernel narrowPhase = GetNarrowPhaseKernel(level);
+		for (uint i = 0; i < count - 2; i++) narrowPhase(direct, i, &candidates[i + 1], count - 3 - i, dt);
+
+		std::vector<Contact> contacts;
+		ContactKernel contactKernel = GetContactKernel(level);
+		for (uint i = 0; i < count; i++) contactKernel(twoPhase, i, &candidates[i + 1], count - i - 1, dt, contacts);
+		ResolveContacts(twoPhase, contacts.data(), (uint)contacts.size());
+
+		float maxDifference = 0.0f;
+		for (uint i = 0; i < count; i++)
+		{
+			float difference = glm::max(glm::max(glm::abs(direct.posX[i] - twoPhase.posX[i]), glm::abs(direct.posY[i] - twoPhase.posY[i])),
+				glm::max(glm::abs(direct.velX[i] - twoPhase.velX[i]), glm::abs(direct.velY[i] - twoPhase.velY[i])));
+			maxDifference = glm::isnan(difference) ? INFINITY : glm::max(maxDifference, difference);
+		}
+
+		bool failed = contacts.size() != nPairs || !(maxDifference < 1e-3f);
+		printf("%s: %u contacts for %u pairs, largest difference to direct resolution %g%s\n",
+			SimdLevelName(level), (uint)contacts.size(), nPairs, maxDifference, failed ? ", FAILED" : "");
+		nFailed += failed;
+	}
+	return nFailed > 0 ? 1 : 0;
+}